@@ -2,11 +2,19 @@
 #include <vector>
 #include <cassert>
 #include <string>
+#include <cstring>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
 #include <fstream>
 #include <vector>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include "../OpenGLTutorial/bmf.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet_builder.h"
 
 struct Position {
     float x, y, z;
@@ -25,8 +33,15 @@ struct Mesh {
     std::vector<Position> normals;
     std::vector<uint32_t> indices;
     Material material;
+    // Simplified levels of detail over the same vertices, coarsest last
+    std::vector<std::vector<uint32_t>> lods;
+    std::vector<float> lodErrors;
+    // Clusters of the full mesh, each a contiguous range of its indices
+    std::vector<BmfMeshlet> meshlets;
 };
 
+static_assert(sizeof(Material) == sizeof(BmfMaterial), "Material must match the bmf material layout");
+
 std::vector<Mesh> meshes;
 std::vector<Material> materials;
 
@@ -119,30 +134,127 @@ void processMaterials(const aiScene* scene) {
 }
 
 
-int main(int argc, char** argv)
-{
-    if (argc != 2) {
-        std::cout << "Usage: " << argv[0] << " <modelfilename>" << std::endl;
+// Splits a mesh into parts of at most 65535 vertices so every part can use 16 bit indices
+std::vector<Mesh> splitMesh(const Mesh& mesh) {
+    const size_t maxVertices = 0xFFFF;
+    std::vector<Mesh> parts;
+    std::vector<uint32_t> remap(mesh.positions.size(), UINT32_MAX);
+    std::vector<uint32_t> usedVertices;
+    Mesh part;
+    part.material = mesh.material;
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        size_t newVertices = 0;
+        for (size_t j = 0; j < 3; j++) {
+            uint32_t index = mesh.indices[i + j];
+            if (remap[index] == UINT32_MAX && (j < 1 || index != mesh.indices[i]) && (j < 2 || index != mesh.indices[i + 1])) {
+                newVertices++;
+            }
+        }
+        if (part.positions.size() + newVertices > maxVertices) {
+            parts.push_back(std::move(part));
+            part = Mesh();
+            part.material = mesh.material;
+            for (uint32_t index : usedVertices) {
+                remap[index] = UINT32_MAX;
+            }
+            usedVertices.clear();
+        }
+        for (size_t j = 0; j < 3; j++) {
+            uint32_t index = mesh.indices[i + j];
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = (uint32_t)part.positions.size();
+                part.positions.push_back(mesh.positions[index]);
+                part.normals.push_back(mesh.normals[index]);
+                usedVertices.push_back(index);
+            }
+            part.indices.push_back(remap[index]);
+        }
+    }
+    if (!part.indices.empty()) {
+        parts.push_back(std::move(part));
     }
+    return parts;
+}
 
-    Assimp::Importer importer;
-    // aiProcess_PreTransformVertices not working in Debug mode
-    const aiScene* scene = importer.ReadFile(argv[argc - 1], aiProcess_PreTransformVertices | aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality);
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE, !scene->mRootNode) {
-        std::cout << "Error while loading model with assimp: " << importer.GetErrorString() << std::endl;
-        return EXIT_FAILURE;
+void splitLargeMeshes() {
+    std::vector<Mesh> splitMeshes;
+    for (Mesh& mesh : meshes) {
+        if (mesh.positions.size() <= 0xFFFF) {
+            splitMeshes.push_back(std::move(mesh));
+            continue;
+        }
+        std::vector<Mesh> parts = splitMesh(mesh);
+        std::cout << "Split mesh with " << mesh.positions.size() << " vertices into " << parts.size() << " parts" << std::endl;
+        for (Mesh& part : parts) {
+            splitMeshes.push_back(std::move(part));
+        }
     }
+    meshes = std::move(splitMeshes);
+}
 
-    processMaterials(scene);
-    processNode(scene->mRootNode, scene);
+void printStatistics(const char* label, const Mesh& mesh) {
+    VertexCacheStatistics cache = analyzeVertexCache(mesh.indices, mesh.positions.size());
+    OverdrawStatistics overdraw = analyzeOverdraw(mesh.indices, (const float*)mesh.positions.data(), mesh.positions.size());
+    VertexFetchStatistics fetch = analyzeVertexFetch(mesh.indices, mesh.positions.size(), 2 * sizeof(Position));
+    std::cout << "  " << label << " ACMR " << cache.acmr << ", ATVR " << cache.atvr
+        << ", overdraw " << overdraw.overdraw << ", overfetch " << fetch.overfetch << std::endl;
+}
 
-    std::string filename = std::string(getFilename(argv[argc - 1]));
-    std::string filenameWithoutExtension = filename.substr(0, filename.find_last_of('.'));
-    // .bmf own file extension
-    std::string outputFilename = filenameWithoutExtension + ".bmf";
+// Reorders the triangles of the full mesh into meshlets, the levels of detail are not touched
+void generateMeshlets(Mesh& mesh) {
+    mesh.meshlets = buildMeshlets(mesh.indices, (const float*)mesh.positions.data(), mesh.positions.size());
+    uint32_t cullable = 0;
+    for (const BmfMeshlet& meshlet : mesh.meshlets) {
+        cullable += meshlet.coneCutoff <= 1.0f;
+    }
+    std::cout << "  " << mesh.meshlets.size() << " meshlets, " << (float)mesh.indices.size() / 3 / std::max(mesh.meshlets.size(), (size_t)1)
+        << " triangles per meshlet, " << cullable << " with a normal cone" << std::endl;
+}
+
+// Reorders triangles for the post-transform vertex cache, then for overdraw, then vertices for fetch locality.
+// With meshlets the triangles are grouped into meshlets instead, which optimize their own triangles for the cache,
+// and whole meshlets are sorted for overdraw. The vertices are renumbered last, so the statistics are those of the
+// index order that is written.
+void optimizeMesh(Mesh& mesh, bool meshlets) {
+    printStatistics("before:", mesh);
+
+    if (meshlets) {
+        generateMeshlets(mesh);
+        optimizeMeshletOverdraw(mesh.indices, (const float*)mesh.positions.data(), mesh.meshlets);
+    }
+    else {
+        optimizeVertexCache(mesh.indices, mesh.positions.size());
+        optimizeOverdraw(mesh.indices, (const float*)mesh.positions.data(), mesh.positions.size());
+    }
+
+    size_t numVertices = 0;
+    std::vector<uint32_t> remap = optimizeVertexFetch(mesh.indices, mesh.positions.size(), numVertices);
+    std::vector<Position> positions(numVertices);
+    std::vector<Position> normals(numVertices);
+    for (size_t i = 0; i < remap.size(); i++) {
+        if (remap[i] != UINT32_MAX) {
+            positions[remap[i]] = mesh.positions[i];
+            normals[remap[i]] = mesh.normals[i];
+        }
+    }
+    mesh.positions.swap(positions);
+    mesh.normals.swap(normals);
+
+    printStatistics("after: ", mesh);
+}
+
+// Adds up to BMF_MAX_LODS simplified levels over the vertices of the mesh, reordered for the vertex cache like the full mesh
+void generateLods(Mesh& mesh) {
+    buildLodChain(mesh.indices, (const float*)mesh.positions.data(), (const float*)mesh.normals.data(), mesh.positions.size(), BMF_MAX_LODS, 0.1f, mesh.lods, mesh.lodErrors);
+    for (size_t i = 0; i < mesh.lods.size(); i++) {
+        optimizeVertexCache(mesh.lods[i], mesh.positions.size());
+        std::cout << "  lod " << i + 1 << ": " << mesh.lods[i].size() / 3 << " triangles, error " << mesh.lodErrors[i] << std::endl;
+    }
+}
 
+void writeVersion1(const std::string& outputFilename) {
     std::ofstream output(outputFilename, std::ios::out | std::ios::binary);
-    std::cout << "Writing bmf file..." << std::endl;
     uint64_t numMeshes = meshes.size();
     output.write((char*)&numMeshes, sizeof(uint64_t));
     for (Mesh& mesh : meshes) {
@@ -169,6 +281,172 @@ int main(int argc, char** argv)
         }
     }
     output.close();
+}
+
+bool writeVersion2(const std::string& outputFilename, bool quantize, uint32_t compression) {
+    // Interleaved vertex data has to stay alive until the file is written
+    std::vector<std::vector<float>> vertexData(meshes.size());
+    std::vector<std::vector<BmfQuantizedVertex>> quantizedData(meshes.size());
+    std::vector<std::vector<uint32_t>> allIndices(meshes.size());
+    std::vector<std::vector<uint16_t>> narrowedIndices(meshes.size());
+    std::vector<BmfMeshData> meshData(meshes.size());
+    for (size_t m = 0; m < meshes.size(); m++) {
+        Mesh& mesh = meshes[m];
+        BmfMeshData& data = meshData[m];
+        std::vector<float>& vertices = vertexData[m];
+
+        Position boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        Position boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        vertices.reserve(mesh.positions.size() * 6);
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            const Position& position = mesh.positions[i];
+            const Position& normal = mesh.normals[i];
+            vertices.insert(vertices.end(), { position.x, position.y, position.z, normal.x, normal.y, normal.z });
+            boundsMin = { std::min(boundsMin.x, position.x), std::min(boundsMin.y, position.y), std::min(boundsMin.z, position.z) };
+            boundsMax = { std::max(boundsMax.x, position.x), std::max(boundsMax.y, position.y), std::max(boundsMax.z, position.z) };
+        }
+
+        memcpy(&data.material, &mesh.material, sizeof(Material));
+        data.vertexFormat = BMF_VERTEX_FORMAT_FLOAT;
+        data.vertexStride = 6 * sizeof(float);
+        data.vertices = vertices.data();
+        data.numVertices = mesh.positions.size();
+        // The levels of detail follow the indices of the full mesh
+        std::vector<uint32_t>& indices = allIndices[m];
+        indices = mesh.indices;
+        data.numLods = (uint32_t)std::min(mesh.lods.size(), (size_t)BMF_MAX_LODS);
+        for (uint32_t i = 0; i < data.numLods; i++) {
+            indices.insert(indices.end(), mesh.lods[i].begin(), mesh.lods[i].end());
+            data.lodNumIndices[i] = (uint32_t)mesh.lods[i].size();
+            data.lodErrors[i] = mesh.lodErrors[i];
+        }
+        data.indices = indices.data();
+        data.numIndices = mesh.indices.size();
+        data.meshlets = mesh.meshlets.data();
+        data.numMeshlets = (uint32_t)mesh.meshlets.size();
+        data.indexElementSize = sizeof(uint32_t);
+        if (data.numVertices <= 0xFFFF) {
+            narrowedIndices[m] = bmfNarrowIndices(indices.data(), indices.size());
+            data.indices = narrowedIndices[m].data();
+            data.indexElementSize = sizeof(uint16_t);
+        }
+        memcpy(data.boundsMin, &boundsMin, sizeof(data.boundsMin));
+        memcpy(data.boundsMax, &boundsMax, sizeof(data.boundsMax));
+        data.compression = compression;
+
+        if (quantize) {
+            quantizedData[m].resize(data.numVertices);
+            bmfQuantizeVertices(vertices.data(), data.numVertices, data.boundsMin, data.boundsMax, quantizedData[m].data());
+            data.vertexFormat = BMF_VERTEX_FORMAT_QUANTIZED;
+            data.vertexStride = sizeof(BmfQuantizedVertex);
+            data.vertices = quantizedData[m].data();
+        }
+    }
+    return bmfWriteVersion2(outputFilename.c_str(), meshData);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " [--v1] [--quantize] [--split] [--no-optimize] [--no-lod] [--no-meshlets] [--compress] [--lz4] <modelfilename>" << std::endl;
+        std::cout << "  --v1           write the legacy unversioned bmf layout" << std::endl;
+        std::cout << "  --quantize     store 16 bit positions and 10 bit normals (12 instead of 24 bytes per vertex)" << std::endl;
+        std::cout << "  --split        split meshes with 65536 or more vertices so they can use 16 bit indices" << std::endl;
+        std::cout << "  --no-optimize  skip the vertex cache, overdraw and vertex fetch optimization" << std::endl;
+        std::cout << "  --no-lod       skip generating simplified levels of detail" << std::endl;
+        std::cout << "  --no-meshlets  skip splitting meshes into meshlets for cluster culling" << std::endl;
+        std::cout << "  --compress     delta encode vertices and indices" << std::endl;
+        std::cout << "  --lz4          delta encode and LZ4 compress vertices and indices" << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool legacyFormat = false;
+    bool quantize = false;
+    bool split = false;
+    bool optimize = true;
+    bool lods = true;
+    bool meshlets = true;
+    uint32_t compression = BMF_COMPRESSION_NONE;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--v1") == 0) {
+            legacyFormat = true;
+        }
+        else if (strcmp(argv[i], "--quantize") == 0) {
+            quantize = true;
+        }
+        else if (strcmp(argv[i], "--split") == 0) {
+            split = true;
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0) {
+            optimize = false;
+        }
+        else if (strcmp(argv[i], "--no-lod") == 0) {
+            lods = false;
+        }
+        else if (strcmp(argv[i], "--no-meshlets") == 0) {
+            meshlets = false;
+        }
+        else if (strcmp(argv[i], "--compress") == 0) {
+            compression |= BMF_COMPRESSION_DELTA;
+        }
+        else if (strcmp(argv[i], "--lz4") == 0) {
+            compression |= BMF_COMPRESSION_DELTA | BMF_COMPRESSION_LZ4;
+        }
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+        }
+    }
+
+    Assimp::Importer importer;
+    // aiProcess_PreTransformVertices not working in Debug mode
+    const aiScene* scene = importer.ReadFile(argv[argc - 1], aiProcess_PreTransformVertices | aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE, !scene->mRootNode) {
+        std::cout << "Error while loading model with assimp: " << importer.GetErrorString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    processMaterials(scene);
+    processNode(scene->mRootNode, scene);
+    if (split) {
+        splitLargeMeshes();
+    }
+    // v1 files have no room for meshlets
+    bool withMeshlets = meshlets && !legacyFormat;
+    if (optimize) {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            std::cout << "Optimizing mesh " << i << " (" << meshes[i].positions.size() << " vertices, " << meshes[i].indices.size() / 3 << " triangles)" << std::endl;
+            optimizeMesh(meshes[i], withMeshlets);
+        }
+    }
+    else if (withMeshlets) {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            std::cout << "Building meshlets of mesh " << i << std::endl;
+            generateMeshlets(meshes[i]);
+        }
+    }
+    // v1 files have no room for levels of detail
+    if (lods && !legacyFormat) {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            std::cout << "Simplifying mesh " << i << " (" << meshes[i].indices.size() / 3 << " triangles)" << std::endl;
+            generateLods(meshes[i]);
+        }
+    }
+
+    std::string filename = std::string(getFilename(argv[argc - 1]));
+    std::string filenameWithoutExtension = filename.substr(0, filename.find_last_of('.'));
+    // .bmf own file extension
+    std::string outputFilename = filenameWithoutExtension + ".bmf";
+
+    std::cout << "Writing bmf file..." << std::endl;
+    if (legacyFormat) {
+        if (quantize || compression != BMF_COMPRESSION_NONE) {
+            std::cout << "--quantize and compression are ignored for v1 files" << std::endl;
+        }
+        writeVersion1(outputFilename);
+    }
+    else if (!writeVersion2(outputFilename, quantize, compression)) {
+        std::cout << "Error while writing " << outputFilename << std::endl;
+        return EXIT_FAILURE;
+    }
     std::cout << "Finished!" << std::endl;
     std::getchar();
     return EXIT_SUCCESS;
@@ -0,0 +1,370 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Index and vertex reordering passes run by the exporter before a mesh is written.
+// Positions are passed as tightly packed float triples.
+
+struct VertexCacheStatistics {
+    uint32_t misses;
+    // Average cache miss ratio, misses per triangle (0.5 is ideal for large meshes, 3 the worst case)
+    float acmr;
+    // Average transformed vertex ratio, misses per vertex (1 is ideal)
+    float atvr;
+};
+
+struct OverdrawStatistics {
+    uint64_t pixelsCovered;
+    uint64_t pixelsShaded;
+    // Shaded per covered pixel (1 is ideal)
+    float overdraw;
+};
+
+struct VertexFetchStatistics {
+    uint64_t bytesFetched;
+    // Bytes fetched per byte of vertex data (1 is ideal)
+    float overfetch;
+};
+
+// Simulates a FIFO post-transform cache of the given size
+inline VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t numVertices, uint32_t cacheSize = 16) {
+    // A vertex is cached when it was inserted within the last cacheSize misses
+    std::vector<uint32_t> timestamps(numVertices, 0);
+    uint32_t time = cacheSize + 1;
+    VertexCacheStatistics statistics = {};
+    for (uint32_t index : indices) {
+        if (time - timestamps[index] > cacheSize) {
+            timestamps[index] = time++;
+            statistics.misses++;
+        }
+    }
+    size_t numTriangles = indices.size() / 3;
+    statistics.acmr = numTriangles ? (float)statistics.misses / numTriangles : 0.0f;
+    statistics.atvr = numVertices ? (float)statistics.misses / numVertices : 0.0f;
+    return statistics;
+}
+
+// Simulates vertex fetches of the post-transform cache misses through a cache of 64 byte lines
+inline VertexFetchStatistics analyzeVertexFetch(const std::vector<uint32_t>& indices, size_t numVertices, size_t vertexSize) {
+    const uint32_t cacheSize = 16;
+    const uint32_t lineCount = 256;
+    const size_t lineSize = 64;
+
+    std::vector<uint32_t> vertexTimestamps(numVertices, 0);
+    uint32_t vertexTime = cacheSize + 1;
+    std::vector<uint32_t> lineTimestamps((numVertices * vertexSize + lineSize - 1) / lineSize, 0);
+    uint32_t lineTime = lineCount + 1;
+
+    VertexFetchStatistics statistics = {};
+    for (uint32_t index : indices) {
+        if (vertexTime - vertexTimestamps[index] <= cacheSize) {
+            continue;
+        }
+        vertexTimestamps[index] = vertexTime++;
+        size_t firstLine = index * vertexSize / lineSize;
+        size_t lastLine = (index * vertexSize + vertexSize - 1) / lineSize;
+        for (size_t line = firstLine; line <= lastLine; line++) {
+            if (lineTime - lineTimestamps[line] > lineCount) {
+                lineTimestamps[line] = lineTime++;
+                statistics.bytesFetched += lineSize;
+            }
+        }
+    }
+    statistics.overfetch = numVertices ? (float)statistics.bytesFetched / (numVertices * vertexSize) : 0.0f;
+    return statistics;
+}
+
+// Rasterizes the mesh orthographically from six axis directions with depth test and backface culling
+inline OverdrawStatistics analyzeOverdraw(const std::vector<uint32_t>& indices, const float* positions, size_t numVertices) {
+    const int gridSize = 256;
+    OverdrawStatistics statistics = {};
+    if (numVertices == 0) {
+        return statistics;
+    }
+
+    float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < numVertices; i++) {
+        for (int j = 0; j < 3; j++) {
+            boundsMin[j] = std::min(boundsMin[j], positions[i * 3 + j]);
+            boundsMax[j] = std::max(boundsMax[j], positions[i * 3 + j]);
+        }
+    }
+    float extent = std::max(std::max(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]);
+    float scale = extent > 0.0f ? (gridSize - 1) / extent : 0.0f;
+
+    std::vector<float> depthBuffer(gridSize * gridSize);
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        for (float direction : { 1.0f, -1.0f }) {
+            std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+            for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+                float x[3], y[3], z[3];
+                for (int k = 0; k < 3; k++) {
+                    const float* p = positions + indices[t + k] * 3;
+                    x[k] = (p[u] - boundsMin[u]) * scale;
+                    y[k] = (p[v] - boundsMin[v]) * scale;
+                    z[k] = (p[axis] - boundsMin[axis]) * scale * direction;
+                }
+                // Looking down the axis mirrors the image, so front faces wind clockwise. Looking down the other
+                // direction mirrors it again.
+                float area = ((x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0])) * direction;
+                if (area >= 0.0f) {
+                    continue;
+                }
+                int minX = std::max(0, (int)std::floor(std::min(std::min(x[0], x[1]), x[2])));
+                int maxX = std::min(gridSize - 1, (int)std::ceil(std::max(std::max(x[0], x[1]), x[2])));
+                int minY = std::max(0, (int)std::floor(std::min(std::min(y[0], y[1]), y[2])));
+                int maxY = std::min(gridSize - 1, (int)std::ceil(std::max(std::max(y[0], y[1]), y[2])));
+                float invArea = direction / area;
+                for (int py = minY; py <= maxY; py++) {
+                    for (int px = minX; px <= maxX; px++) {
+                        float cx = px + 0.5f;
+                        float cy = py + 0.5f;
+                        float w0 = ((x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1])) * invArea;
+                        float w1 = ((x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2])) * invArea;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                            continue;
+                        }
+                        float depth = w0 * z[0] + w1 * z[1] + w2 * z[2];
+                        float& stored = depthBuffer[py * gridSize + px];
+                        if (depth < stored) {
+                            stored = depth;
+                            statistics.pixelsShaded++;
+                        }
+                    }
+                }
+            }
+            for (float depth : depthBuffer) {
+                statistics.pixelsCovered += depth != FLT_MAX;
+            }
+        }
+    }
+    statistics.overdraw = statistics.pixelsCovered ? (float)statistics.pixelsShaded / statistics.pixelsCovered : 0.0f;
+    return statistics;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation, reorders triangles for an LRU cache of 32 vertices
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t numVertices) {
+    const int cacheSize = 32;
+    const size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0) {
+        return;
+    }
+
+    auto vertexScore = [](int cachePosition, uint32_t remainingTriangles) {
+        if (remainingTriangles == 0) {
+            return -1.0f;
+        }
+        float score = 0.0f;
+        if (cachePosition >= 3) {
+            score = std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        }
+        else if (cachePosition >= 0) {
+            // The last triangle's vertices get a fixed score so the next triangle does not just reuse its edge
+            score = 0.75f;
+        }
+        return score + 2.0f / std::sqrt((float)remainingTriangles);
+    };
+
+    // Triangles adjacent to every vertex, compacted as triangles get emitted
+    std::vector<uint32_t> remaining(numVertices, 0);
+    for (uint32_t index : indices) {
+        remaining[index]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(numVertices + 1, 0);
+    for (size_t i = 0; i < numVertices; i++) {
+        adjacencyOffsets[i + 1] = adjacencyOffsets[i] + remaining[i];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t t = 0; t < numTriangles; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+        }
+    }
+
+    std::vector<int> cachePositions(numVertices, -1);
+    std::vector<float> scores(numVertices);
+    for (size_t i = 0; i < numVertices; i++) {
+        scores[i] = vertexScore(-1, remaining[i]);
+    }
+    std::vector<float> triangleScores(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++) {
+        triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    }
+    std::vector<bool> emitted(numTriangles, false);
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> newCache;
+    size_t inputCursor = 0;
+    int64_t bestTriangle = 0;
+
+    while (true) {
+        if (bestTriangle < 0) {
+            // Nothing in the cache is connected to unemitted triangles, continue in input order
+            while (inputCursor < numTriangles && emitted[inputCursor]) {
+                inputCursor++;
+            }
+            if (inputCursor == numTriangles) {
+                break;
+            }
+            bestTriangle = (int64_t)inputCursor;
+        }
+
+        const uint32_t* triangle = &indices[bestTriangle * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+        for (int k = 0; k < 3; k++) {
+            uint32_t vertex = triangle[k];
+            uint32_t* begin = &adjacency[adjacencyOffsets[vertex]];
+            uint32_t* end = begin + remaining[vertex];
+            *std::find(begin, end, (uint32_t)bestTriangle) = *(end - 1);
+            remaining[vertex]--;
+        }
+
+        newCache.assign(triangle, triangle + 3);
+        for (uint32_t vertex : cache) {
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+                newCache.push_back(vertex);
+            }
+        }
+        for (size_t i = cacheSize; i < newCache.size(); i++) {
+            cachePositions[newCache[i]] = -1;
+            scores[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+        }
+        if (newCache.size() > (size_t)cacheSize) {
+            newCache.resize(cacheSize);
+        }
+        cache.swap(newCache);
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); i++) {
+            cachePositions[cache[i]] = (int)i;
+            scores[cache[i]] = vertexScore((int)i, remaining[cache[i]]);
+        }
+        for (uint32_t vertex : cache) {
+            for (uint32_t a = 0; a < remaining[vertex]; a++) {
+                uint32_t t = adjacency[adjacencyOffsets[vertex] + a];
+                triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+    }
+    indices.swap(result);
+}
+
+// Sorts the clusters of triangles [clusterStarts[c], clusterStarts[c + 1]) so that outward facing clusters are
+// drawn first and occlude the inner parts of the mesh. clusterStarts ends with the number of triangles.
+// Returns the new order of the clusters.
+inline std::vector<uint32_t> sortClustersForOverdraw(std::vector<uint32_t>& indices, const float* positions, const std::vector<uint32_t>& clusterStarts) {
+    float meshCentroid[3] = {};
+    float meshArea = 0.0f;
+    size_t numClusters = clusterStarts.size() - 1;
+    std::vector<float> clusterCentroids(numClusters * 3, 0.0f);
+    std::vector<float> clusterNormals(numClusters * 3, 0.0f);
+    for (size_t c = 0; c < numClusters; c++) {
+        float clusterArea = 0.0f;
+        for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const float* p0 = positions + indices[t * 3] * 3;
+            const float* p1 = positions + indices[t * 3 + 1] * 3;
+            const float* p2 = positions + indices[t * 3 + 2] * 3;
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for (int j = 0; j < 3; j++) {
+                float centroid = (p0[j] + p1[j] + p2[j]) / 3.0f;
+                clusterCentroids[c * 3 + j] += centroid * area;
+                clusterNormals[c * 3 + j] += normal[j];
+                meshCentroid[j] += centroid * area;
+            }
+            clusterArea += area;
+        }
+        meshArea += clusterArea;
+        for (int j = 0; j < 3; j++) {
+            clusterCentroids[c * 3 + j] /= clusterArea > 0.0f ? clusterArea : 1.0f;
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        meshCentroid[j] /= meshArea > 0.0f ? meshArea : 1.0f;
+    }
+
+    std::vector<float> sortKeys(numClusters);
+    for (size_t c = 0; c < numClusters; c++) {
+        const float* normal = &clusterNormals[c * 3];
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            key += (clusterCentroids[c * 3 + j] - meshCentroid[j]) * (length > 0.0f ? normal[j] / length : 0.0f);
+        }
+        sortKeys[c] = key;
+    }
+    std::vector<uint32_t> order(numClusters);
+    for (size_t c = 0; c < numClusters; c++) {
+        order[c] = (uint32_t)c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order) {
+        result.insert(result.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    }
+    indices.swap(result);
+    return order;
+}
+
+// Sorts clusters of cache coherent triangles for overdraw, see sortClustersForOverdraw. Clusters start where the
+// vertex cache is cold anyway, so the reordering does not hurt the cache efficiency gained by optimizeVertexCache.
+inline void optimizeOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t numVertices, uint32_t cacheSize = 16) {
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0) {
+        return;
+    }
+
+    std::vector<uint32_t> clusterStarts;
+    std::vector<uint32_t> timestamps(numVertices, 0);
+    uint32_t time = cacheSize + 1;
+    for (size_t t = 0; t < numTriangles; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t index = indices[t * 3 + k];
+            if (time - timestamps[index] > cacheSize) {
+                timestamps[index] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3) {
+            clusterStarts.push_back((uint32_t)t);
+        }
+    }
+    clusterStarts.push_back((uint32_t)numTriangles);
+    sortClustersForOverdraw(indices, positions, clusterStarts);
+}
+
+// Renumbers vertices in the order the index buffer first references them and drops unreferenced vertices.
+// Returns the remap table (old index -> new index, UINT32_MAX for dropped vertices) and the new vertex count.
+inline std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t numVertices, size_t& newNumVertices) {
+    std::vector<uint32_t> remap(numVertices, UINT32_MAX);
+    uint32_t next = 0;
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    newNumVertices = next;
+    return remap;
+}
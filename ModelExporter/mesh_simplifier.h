@@ -0,0 +1,564 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Quadric error metric simplification for the levels of detail the exporter writes.
+// Edges are collapsed into one of their vertices, so every level is an index list over the vertices of the full mesh.
+// Positions and normals are passed as tightly packed float triples.
+
+// Garland-Heckbert quadric over N dimensions, the first three are the position
+template<int N>
+struct SimplifierQuadric {
+    // Upper triangle of the symmetric matrix, row by row
+    double a[N * (N + 1) / 2] = {};
+    double b[N] = {};
+    double c = 0.0;
+    // Summed area (or edge length) of what was added, the error is averaged over it
+    double weight = 0.0;
+
+    // Squared distance to the plane of the triangle spanned by q0, q1 and q2
+    void addTriangle(const double* q0, const double* q1, const double* q2, double w) {
+        double e1[N];
+        double e2[N];
+        double length1 = 0.0;
+        for (int i = 0; i < N; i++) {
+            e1[i] = q1[i] - q0[i];
+            e2[i] = q2[i] - q0[i];
+            length1 += e1[i] * e1[i];
+        }
+        length1 = std::sqrt(length1);
+        if (length1 == 0.0) {
+            return;
+        }
+        double projection = 0.0;
+        for (int i = 0; i < N; i++) {
+            e1[i] /= length1;
+            projection += e1[i] * e2[i];
+        }
+        double length2 = 0.0;
+        for (int i = 0; i < N; i++) {
+            e2[i] -= projection * e1[i];
+            length2 += e2[i] * e2[i];
+        }
+        length2 = std::sqrt(length2);
+        if (length2 == 0.0) {
+            return;
+        }
+        double p1 = 0.0;
+        double p2 = 0.0;
+        double q0q0 = 0.0;
+        for (int i = 0; i < N; i++) {
+            e2[i] /= length2;
+            p1 += q0[i] * e1[i];
+            p2 += q0[i] * e2[i];
+            q0q0 += q0[i] * q0[i];
+        }
+        int k = 0;
+        for (int i = 0; i < N; i++) {
+            for (int j = i; j < N; j++) {
+                a[k++] += w * ((i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j]);
+            }
+            b[i] += w * (p1 * e1[i] + p2 * e2[i] - q0[i]);
+        }
+        c += w * (q0q0 - p1 * p1 - p2 * p2);
+        weight += w;
+    }
+
+    // Squared distance to the plane dot(normal, position) + d = 0, attributes are left free
+    void addPlane(const double* normal, double d, double w) {
+        int k = 0;
+        for (int i = 0; i < N; i++) {
+            for (int j = i; j < N; j++) {
+                a[k++] += i < 3 && j < 3 ? w * normal[i] * normal[j] : 0.0;
+            }
+            b[i] += i < 3 ? w * d * normal[i] : 0.0;
+        }
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const SimplifierQuadric& other) {
+        for (int i = 0; i < N * (N + 1) / 2; i++) {
+            a[i] += other.a[i];
+        }
+        for (int i = 0; i < N; i++) {
+            b[i] += other.b[i];
+        }
+        c += other.c;
+        weight += other.weight;
+    }
+
+    double evaluate(const double* v) const {
+        double result = c;
+        int k = 0;
+        for (int i = 0; i < N; i++) {
+            result += a[k++] * v[i] * v[i];
+            for (int j = i + 1; j < N; j++) {
+                result += 2.0 * a[k++] * v[i] * v[j];
+            }
+            result += 2.0 * b[i] * v[i];
+        }
+        return std::fabs(result);
+    }
+};
+
+// Simplifies a mesh step by step, every simplify() call continues where the last one stopped so the levels are
+// nested and their errors only grow.
+// Vertices that share a position always move together, so no cracks open between them. Normals are part of the
+// quadrics, collapses that smooth out creases or bend normals are expensive and happen late.
+// Open borders only collapse along themselves and are held in place by extra border quadrics, vertices where a
+// border meets a normal seam or the mesh is not manifold stay locked.
+class MeshSimplifier {
+public:
+    // normalWeight scales normals against positions, relative to the largest extent of the mesh
+    MeshSimplifier(const std::vector<uint32_t>& indices, const float* positions, const float* normals, size_t numVertices, float normalWeight = 0.25f, float borderWeight = 10.0f)
+        : indices(indices), numVertices(numVertices), points(numVertices * 6), welded(numVertices), wedges(numVertices), kinds(numVertices, Locked),
+        positionQuadrics(numVertices), attributeQuadrics(numVertices) {
+        double boundsMin[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+        double boundsMax[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+        for (size_t i = 0; i < numVertices * 3; i++) {
+            boundsMin[i % 3] = std::min(boundsMin[i % 3], (double)positions[i]);
+            boundsMax[i % 3] = std::max(boundsMax[i % 3], (double)positions[i]);
+        }
+        double extent = std::max(std::max(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]);
+        for (size_t i = 0; i < numVertices; i++) {
+            for (int j = 0; j < 3; j++) {
+                points[i * 6 + j] = positions[i * 3 + j];
+                points[i * 6 + 3 + j] = normals[i * 3 + j] * normalWeight * extent;
+            }
+        }
+        weldPositions();
+        buildAdjacency();
+        classifyVertices();
+        computeQuadrics(borderWeight);
+    }
+
+    // Collapses edges until at most targetIndexCount indices are left or every remaining collapse would move the
+    // surface further than maxError
+    void simplify(size_t targetIndexCount, float maxError) {
+        while (indices.size() > targetIndexCount) {
+            buildAdjacency();
+            std::vector<Collapse> collapses = pickCollapses(maxError);
+            if (collapses.empty() || performCollapses(collapses, (indices.size() - targetIndexCount) / 3) == 0) {
+                break;
+            }
+        }
+    }
+
+    const std::vector<uint32_t>& getIndices() {
+        return indices;
+    }
+
+    // Largest distance of the simplified surface from the full mesh so far
+    float getError() {
+        return error;
+    }
+private:
+    enum Kind : uint8_t {
+        // Closed fan of triangles, can collapse into any neighbor
+        Manifold,
+        // On an open border, only collapses along it
+        Border,
+        // Closed fan split into vertices with different normals, all of them collapse together
+        Seam,
+        Locked
+    };
+
+    struct Collapse {
+        uint32_t vertex;
+        uint32_t target;
+        double cost;
+        double error;
+    };
+
+    // Links vertices with the same position into rings and maps all of them to the first one
+    void weldPositions() {
+        std::vector<uint32_t> order(numVertices);
+        for (uint32_t i = 0; i < numVertices; i++) {
+            order[i] = i;
+        }
+        auto position = [&](uint32_t vertex) {
+            return &points[vertex * 6];
+        };
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return std::lexicographical_compare(position(a), position(a) + 3, position(b), position(b) + 3);
+        });
+        for (size_t i = 0; i < numVertices;) {
+            size_t end = i + 1;
+            while (end < numVertices && std::equal(position(order[i]), position(order[i]) + 3, position(order[end]))) {
+                end++;
+            }
+            uint32_t first = *std::min_element(order.begin() + i, order.begin() + end);
+            for (size_t j = i; j < end; j++) {
+                welded[order[j]] = first;
+                wedges[order[j]] = order[j + 1 < end ? j + 1 : i];
+            }
+            i = end;
+        }
+    }
+
+    // Triangles around every vertex, by vertex and by welded position
+    void buildAdjacency() {
+        auto build = [&](std::vector<uint32_t>& offsets, std::vector<uint32_t>& triangles, bool byPosition) {
+            offsets.assign(numVertices + 1, 0);
+            for (uint32_t index : indices) {
+                offsets[(byPosition ? welded[index] : index) + 1]++;
+            }
+            for (size_t i = 0; i < numVertices; i++) {
+                offsets[i + 1] += offsets[i];
+            }
+            triangles.resize(indices.size());
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++) {
+                triangles[fill[byPosition ? welded[indices[i]] : indices[i]]++] = (uint32_t)(i / 3);
+            }
+        };
+        build(vertexOffsets, vertexTriangles, false);
+        build(positionOffsets, positionTriangles, true);
+    }
+
+    // Whether a triangle has the directed edge from -> to, between vertices or between welded positions
+    bool hasEdge(uint32_t from, uint32_t to, bool byPosition) {
+        const std::vector<uint32_t>& offsets = byPosition ? positionOffsets : vertexOffsets;
+        const std::vector<uint32_t>& triangles = byPosition ? positionTriangles : vertexTriangles;
+        for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+            const uint32_t* triangle = &indices[triangles[i] * 3];
+            for (int k = 0; k < 3; k++) {
+                uint32_t corner = byPosition ? welded[triangle[k]] : triangle[k];
+                uint32_t next = byPosition ? welded[triangle[(k + 1) % 3]] : triangle[(k + 1) % 3];
+                if (corner == from && next == to) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool isOpenEdge(uint32_t a, uint32_t b, bool byPosition) {
+        return hasEdge(a, b, byPosition) != hasEdge(b, a, byPosition);
+    }
+
+    // Counts the edges leaving and entering vertex that have no opposite edge
+    void countOpenEdges(uint32_t vertex, bool byPosition, uint32_t& openOut, uint32_t& openIn) {
+        const std::vector<uint32_t>& offsets = byPosition ? positionOffsets : vertexOffsets;
+        const std::vector<uint32_t>& triangles = byPosition ? positionTriangles : vertexTriangles;
+        openOut = 0;
+        openIn = 0;
+        for (uint32_t i = offsets[vertex]; i < offsets[vertex + 1]; i++) {
+            const uint32_t* triangle = &indices[triangles[i] * 3];
+            for (int k = 0; k < 3; k++) {
+                if ((byPosition ? welded[triangle[k]] : triangle[k]) != vertex) {
+                    continue;
+                }
+                uint32_t next = byPosition ? welded[triangle[(k + 1) % 3]] : triangle[(k + 1) % 3];
+                uint32_t previous = byPosition ? welded[triangle[(k + 2) % 3]] : triangle[(k + 2) % 3];
+                openOut += !hasEdge(next, vertex, byPosition);
+                openIn += !hasEdge(vertex, previous, byPosition);
+            }
+        }
+    }
+
+    void classifyVertices() {
+        for (uint32_t vertex = 0; vertex < numVertices; vertex++) {
+            if (welded[vertex] != vertex) {
+                continue;
+            }
+            uint32_t openOut;
+            uint32_t openIn;
+            countOpenEdges(vertex, true, openOut, openIn);
+            Kind kind = Locked;
+            if (wedges[vertex] == vertex) {
+                if (openOut == 0 && openIn == 0) {
+                    kind = Manifold;
+                }
+                else if (openOut == 1 && openIn == 1) {
+                    kind = Border;
+                }
+            }
+            else if (openOut == 0 && openIn == 0) {
+                kind = Seam;
+            }
+            for (uint32_t wedge = vertex;;) {
+                kinds[wedge] = kind;
+                wedge = wedges[wedge];
+                if (wedge == vertex) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Position quadrics per welded position, position and normal quadrics per vertex
+    void computeQuadrics(float borderWeight) {
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            const double* q[3] = { &points[indices[t] * 6], &points[indices[t + 1] * 6], &points[indices[t + 2] * 6] };
+            double normal[3];
+            double area = triangleNormal(q[0], q[1], q[2], normal) * 0.5;
+            for (int k = 0; k < 3; k++) {
+                positionQuadrics[welded[indices[t + k]]].addTriangle(q[0], q[1], q[2], area);
+                attributeQuadrics[indices[t + k]].addTriangle(q[0], q[1], q[2], area);
+            }
+            // Planes through open edges, perpendicular to the triangle, keep the border from shrinking
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = indices[t + k];
+                uint32_t b = indices[t + (k + 1) % 3];
+                if (hasEdge(welded[b], welded[a], true)) {
+                    continue;
+                }
+                double edge[3] = { q[(k + 1) % 3][0] - q[k][0], q[(k + 1) % 3][1] - q[k][1], q[(k + 1) % 3][2] - q[k][2] };
+                double length2 = edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2];
+                double plane[3] = { edge[1] * normal[2] - edge[2] * normal[1], edge[2] * normal[0] - edge[0] * normal[2], edge[0] * normal[1] - edge[1] * normal[0] };
+                double length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+                if (length == 0.0) {
+                    continue;
+                }
+                for (int i = 0; i < 3; i++) {
+                    plane[i] /= length;
+                }
+                double d = -(plane[0] * q[k][0] + plane[1] * q[k][1] + plane[2] * q[k][2]);
+                for (uint32_t vertex : { a, b }) {
+                    positionQuadrics[welded[vertex]].addPlane(plane, d, length2 * borderWeight);
+                    attributeQuadrics[vertex].addPlane(plane, d, length2 * borderWeight);
+                }
+            }
+        }
+    }
+
+    // Unit normal of the triangle, returns twice its area
+    static double triangleNormal(const double* p0, const double* p1, const double* p2, double* normal) {
+        double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 0.0) {
+            for (int i = 0; i < 3; i++) {
+                normal[i] /= length;
+            }
+        }
+        return length;
+    }
+
+    // Finds the vertex of target every vertex of position collapses into: the one it shares an edge with, or the
+    // one with the normal it fits best when it shares none. Fails when the kinds of the positions do not allow it.
+    bool mapWedges(uint32_t position, uint32_t target, std::vector<uint32_t>& mapping) {
+        Kind kind = kinds[position];
+        Kind targetKind = kinds[target];
+        if (kind == Locked || (kind == Border && ((targetKind != Border && targetKind != Locked) || !isOpenEdge(position, target, true)))) {
+            return false;
+        }
+        mapping.clear();
+        for (uint32_t wedge = position;;) {
+            uint32_t match = UINT32_MAX;
+            bool matchConnected = false;
+            double matchCost = DBL_MAX;
+            for (uint32_t candidate = target;;) {
+                bool connected = hasEdge(wedge, candidate, false) || hasEdge(candidate, wedge, false);
+                double cost = attributeQuadrics[wedge].evaluate(&points[candidate * 6]);
+                if ((connected && !matchConnected) || (connected == matchConnected && cost < matchCost)) {
+                    match = candidate;
+                    matchConnected = connected;
+                    matchCost = cost;
+                }
+                candidate = wedges[candidate];
+                if (candidate == target) {
+                    break;
+                }
+            }
+            mapping.push_back(match);
+            wedge = wedges[wedge];
+            if (wedge == position) {
+                return true;
+            }
+        }
+    }
+
+    // Cost of moving all vertices of position onto their mapped vertices, and the distance it moves the surface
+    void evaluate(uint32_t position, const std::vector<uint32_t>& mapping, double& cost, double& distance) {
+        double sum = 0.0;
+        double weight = 0.0;
+        uint32_t wedge = position;
+        for (uint32_t target : mapping) {
+            sum += attributeQuadrics[wedge].evaluate(&points[target * 6]);
+            weight += attributeQuadrics[wedge].weight;
+            wedge = wedges[wedge];
+        }
+        cost = weight > 0.0 ? sum / weight : 0.0;
+        const SimplifierQuadric<3>& quadric = positionQuadrics[position];
+        distance = quadric.weight > 0.0 ? std::sqrt(quadric.evaluate(&points[mapping[0] * 6]) / quadric.weight) : 0.0;
+    }
+
+    // The cheaper direction of every edge that can collapse, sorted by cost
+    std::vector<Collapse> pickCollapses(float maxError) {
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                uint64_t a = welded[indices[t + k]];
+                uint64_t b = welded[indices[t + (k + 1) % 3]];
+                edges.push_back(a < b ? a << 32 | b : b << 32 | a);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        std::vector<Collapse> collapses;
+        std::vector<uint32_t> mapping;
+        for (uint64_t edge : edges) {
+            uint32_t ends[2] = { (uint32_t)(edge >> 32), (uint32_t)edge };
+            Collapse best = { 0, 0, DBL_MAX, 0.0 };
+            for (int direction = 0; direction < 2; direction++) {
+                uint32_t position = ends[direction];
+                uint32_t target = ends[1 - direction];
+                double cost;
+                double distance;
+                if (!mapWedges(position, target, mapping)) {
+                    continue;
+                }
+                evaluate(position, mapping, cost, distance);
+                if (cost < best.cost && distance <= maxError) {
+                    best = { position, target, cost, distance };
+                }
+            }
+            if (best.cost != DBL_MAX) {
+                collapses.push_back(best);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+            return a.cost < b.cost;
+        });
+        return collapses;
+    }
+
+    // Whether moving position onto target turns a remaining triangle around
+    bool flipsTriangle(uint32_t position, uint32_t target) {
+        for (uint32_t i = positionOffsets[position]; i < positionOffsets[position + 1]; i++) {
+            const uint32_t* triangle = &indices[positionTriangles[i] * 3];
+            const double* corners[3];
+            const double* moved[3];
+            bool removed = false;
+            for (int k = 0; k < 3; k++) {
+                uint32_t corner = welded[triangle[k]];
+                removed |= corner == target;
+                corners[k] = &points[triangle[k] * 6];
+                moved[k] = corner == position ? &points[target * 6] : corners[k];
+            }
+            if (removed) {
+                continue;
+            }
+            double before[3];
+            double after[3];
+            triangleNormal(corners[0], corners[1], corners[2], before);
+            triangleNormal(moved[0], moved[1], moved[2], after);
+            if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Collapses in order of cost, every position at most once per pass and none next to one that moved.
+    // Stops after removing maxTriangles triangles. Returns the number of collapses.
+    size_t performCollapses(const std::vector<Collapse>& collapses, size_t maxTriangles) {
+        // Collapses much more expensive than the ones needed to reach the target wait for the next pass
+        size_t goal = std::min(maxTriangles / 2, collapses.size() - 1);
+        double costLimit = collapses[goal].cost * 1.5;
+        std::vector<uint32_t> remap(numVertices);
+        for (uint32_t i = 0; i < numVertices; i++) {
+            remap[i] = i;
+        }
+        std::vector<uint8_t> touched(numVertices, 0);
+        std::vector<uint32_t> mapping;
+        size_t numCollapses = 0;
+        size_t removedTriangles = 0;
+        for (const Collapse& collapse : collapses) {
+            if (removedTriangles >= maxTriangles || collapse.cost > costLimit) {
+                break;
+            }
+            if (touched[collapse.vertex] || touched[collapse.target] || flipsTriangle(collapse.vertex, collapse.target)) {
+                continue;
+            }
+            mapWedges(collapse.vertex, collapse.target, mapping);
+            uint32_t wedge = collapse.vertex;
+            for (uint32_t target : mapping) {
+                remap[wedge] = target;
+                attributeQuadrics[target].add(attributeQuadrics[wedge]);
+                wedge = wedges[wedge];
+            }
+            positionQuadrics[collapse.target].add(positionQuadrics[collapse.vertex]);
+            for (uint32_t i = positionOffsets[collapse.vertex]; i < positionOffsets[collapse.vertex + 1]; i++) {
+                const uint32_t* triangle = &indices[positionTriangles[i] * 3];
+                bool removed = false;
+                for (int k = 0; k < 3; k++) {
+                    touched[welded[triangle[k]]] = 1;
+                    removed |= welded[triangle[k]] == collapse.target;
+                }
+                removedTriangles += removed;
+            }
+            error = std::max(error, (float)collapse.error);
+            numCollapses++;
+        }
+
+        size_t count = 0;
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            uint32_t a = remap[indices[t]];
+            uint32_t b = remap[indices[t + 1]];
+            uint32_t c = remap[indices[t + 2]];
+            if (welded[a] != welded[b] && welded[b] != welded[c] && welded[c] != welded[a]) {
+                indices[count++] = a;
+                indices[count++] = b;
+                indices[count++] = c;
+            }
+        }
+        indices.resize(count);
+        return numCollapses;
+    }
+
+    std::vector<uint32_t> indices;
+    size_t numVertices;
+    // Position followed by the scaled normal of every vertex
+    std::vector<double> points;
+    // First vertex with the same position
+    std::vector<uint32_t> welded;
+    // Next vertex with the same position, rings of one for vertices with a unique position
+    std::vector<uint32_t> wedges;
+    std::vector<Kind> kinds;
+    std::vector<SimplifierQuadric<3>> positionQuadrics;
+    std::vector<SimplifierQuadric<6>> attributeQuadrics;
+    std::vector<uint32_t> vertexOffsets;
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint32_t> positionOffsets;
+    std::vector<uint32_t> positionTriangles;
+    float error = 0.0f;
+};
+
+// Builds up to maxLevels levels of detail, each with about half the triangles of the one before, and their errors.
+// Stops early once a level saves too little or would deviate more than maxError times the largest mesh extent.
+inline void buildLodChain(const std::vector<uint32_t>& indices, const float* positions, const float* normals, size_t numVertices, uint32_t maxLevels, float maxError,
+    std::vector<std::vector<uint32_t>>& lods, std::vector<float>& errors) {
+    float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < numVertices * 3; i++) {
+        boundsMin[i % 3] = std::min(boundsMin[i % 3], positions[i]);
+        boundsMax[i % 3] = std::max(boundsMax[i % 3], positions[i]);
+    }
+    float extent = std::max(std::max(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]);
+
+    MeshSimplifier simplifier(indices, positions, normals, numVertices);
+    size_t numIndices = indices.size();
+    for (uint32_t level = 0; level < maxLevels; level++) {
+        simplifier.simplify(numIndices / 6 * 3, maxError * extent);
+        const std::vector<uint32_t>& simplified = simplifier.getIndices();
+        // A level that is not much smaller is not worth switching to
+        if (simplified.empty() || simplified.size() > numIndices * 3 / 4) {
+            break;
+        }
+        numIndices = simplified.size();
+        lods.push_back(simplified);
+        errors.push_back(simplifier.getError());
+    }
+}
@@ -0,0 +1,307 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "../OpenGLTutorial/bmf.h"
+#include "mesh_optimizer.h"
+
+// Splits meshes into the meshlets the renderer culls one by one.
+// Positions are passed as tightly packed float triples.
+
+// Bounding sphere and normal cone of the triangles of one meshlet, see BmfMeshlet
+inline void computeMeshletBounds(const uint32_t* indices, uint32_t numTriangles, const float* positions, BmfMeshlet& meshlet) {
+    float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t i = 0; i < numTriangles * 3; i++) {
+        const float* position = positions + indices[i] * 3;
+        for (int j = 0; j < 3; j++) {
+            boundsMin[j] = std::min(boundsMin[j], position[j]);
+            boundsMax[j] = std::max(boundsMax[j], position[j]);
+        }
+    }
+    float radius2 = 0.0f;
+    for (int j = 0; j < 3; j++) {
+        meshlet.center[j] = (boundsMin[j] + boundsMax[j]) * 0.5f;
+    }
+    for (uint32_t i = 0; i < numTriangles * 3; i++) {
+        const float* position = positions + indices[i] * 3;
+        float dx = position[0] - meshlet.center[0];
+        float dy = position[1] - meshlet.center[1];
+        float dz = position[2] - meshlet.center[2];
+        radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+    }
+    meshlet.radius = std::sqrt(radius2);
+
+    std::vector<float> normals(numTriangles * 3, 0.0f);
+    float axis[3] = {};
+    for (uint32_t t = 0; t < numTriangles; t++) {
+        const float* p0 = positions + indices[t * 3] * 3;
+        const float* p1 = positions + indices[t * 3 + 1] * 3;
+        const float* p2 = positions + indices[t * 3 + 2] * 3;
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float* normal = &normals[t * 3];
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 0.0f) {
+            for (int j = 0; j < 3; j++) {
+                normal[j] /= length;
+                axis[j] += normal[j];
+            }
+        }
+    }
+    float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (int j = 0; j < 3; j++) {
+        meshlet.coneAxis[j] = axisLength > 0.0f ? axis[j] / axisLength : 0.0f;
+        meshlet.coneApex[j] = meshlet.center[j];
+    }
+    meshlet.coneCutoff = 2.0f;
+    float minDot = 1.0f;
+    for (uint32_t t = 0; t < numTriangles; t++) {
+        const float* normal = &normals[t * 3];
+        if (normal[0] != 0.0f || normal[1] != 0.0f || normal[2] != 0.0f) {
+            minDot = std::min(minDot, normal[0] * meshlet.coneAxis[0] + normal[1] * meshlet.coneAxis[1] + normal[2] * meshlet.coneAxis[2]);
+        }
+    }
+    // Wide cones need an apex far behind the meshlet and almost never pass the test
+    if (axisLength == 0.0f || minDot <= 0.1f) {
+        return;
+    }
+    // Moves the apex behind the plane of every triangle, then a view direction inside the cone sees only back faces
+    float distance = 0.0f;
+    for (uint32_t t = 0; t < numTriangles; t++) {
+        const float* normal = &normals[t * 3];
+        const float* p0 = positions + indices[t * 3] * 3;
+        float normalDot = normal[0] * meshlet.coneAxis[0] + normal[1] * meshlet.coneAxis[1] + normal[2] * meshlet.coneAxis[2];
+        if (normalDot > 0.0f) {
+            float offset = (meshlet.center[0] - p0[0]) * normal[0] + (meshlet.center[1] - p0[1]) * normal[1] + (meshlet.center[2] - p0[2]) * normal[2];
+            distance = std::max(distance, offset / normalDot);
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        meshlet.coneApex[j] = meshlet.center[j] - meshlet.coneAxis[j] * distance;
+    }
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+// Grows meshlets of at most BMF_MESHLET_MAX_VERTICES vertices and BMF_MESHLET_MAX_TRIANGLES triangles over the
+// triangle adjacency and reorders the indices so every meshlet is a contiguous range. Triangles that add no vertex
+// or would otherwise be left alone at one of their vertices are taken first, then those that add the fewest, ties go
+// to the triangle closest to the meshlet whose normal deviates least from the meshlet's, which keeps the normal cones
+// narrow. coneWeight trades one for the other. New meshlets start next to the last one, at the triangle with the
+// fewest remaining neighbours, so the unassigned part of the surface stays compact and few small meshlets are left.
+// Within a meshlet the triangles are reordered for the vertex cache again.
+inline std::vector<BmfMeshlet> buildMeshlets(std::vector<uint32_t>& indices, const float* positions, size_t numVertices, float coneWeight = 0.25f) {
+    uint32_t numTriangles = (uint32_t)(indices.size() / 3);
+    std::vector<BmfMeshlet> meshlets;
+    if (numTriangles == 0) {
+        return meshlets;
+    }
+
+    std::vector<float> centroids(numTriangles * 3);
+    std::vector<float> normals(numTriangles * 3, 0.0f);
+    double totalArea = 0.0;
+    for (uint32_t t = 0; t < numTriangles; t++) {
+        const float* p0 = positions + indices[t * 3] * 3;
+        const float* p1 = positions + indices[t * 3 + 1] * 3;
+        const float* p2 = positions + indices[t * 3 + 2] * 3;
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        totalArea += length * 0.5;
+        for (int j = 0; j < 3; j++) {
+            centroids[t * 3 + j] = (p0[j] + p1[j] + p2[j]) / 3.0f;
+            normals[t * 3 + j] = length > 0.0f ? normal[j] / length : 0.0f;
+        }
+    }
+    // Radius of a disc covering a full meshlet of average triangles, scales the distances of the score
+    float expectedRadius = (float)std::sqrt(totalArea / numTriangles * BMF_MESHLET_MAX_TRIANGLES / 3.14159265);
+    if (expectedRadius <= 0.0f) {
+        expectedRadius = 1.0f;
+    }
+
+    // Triangles around every vertex
+    std::vector<uint32_t> adjacencyOffsets(numVertices + 1, 0);
+    for (uint32_t index : indices) {
+        adjacencyOffsets[index + 1]++;
+    }
+    for (size_t i = 0; i < numVertices; i++) {
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (uint32_t t = 0; t < numTriangles; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+        }
+    }
+
+    // Triangles around every vertex that are not in a meshlet yet
+    std::vector<uint32_t> live(numVertices);
+    for (size_t i = 0; i < numVertices; i++) {
+        live[i] = adjacencyOffsets[i + 1] - adjacencyOffsets[i];
+    }
+    std::vector<bool> emitted(numTriangles, false);
+    // Meshlet a vertex was last added to, so membership needs no clearing between meshlets
+    std::vector<uint32_t> vertexMeshlet(numVertices, UINT32_MAX);
+    std::vector<uint32_t> ordered;
+    ordered.reserve(indices.size());
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint32_t> meshletTriangles;
+    uint32_t nextUnused = 0;
+    float lastCenter[3] = {};
+
+    while (ordered.size() < indices.size()) {
+        uint32_t meshletIndex = (uint32_t)meshlets.size();
+
+        uint32_t seed = UINT32_MAX;
+        uint32_t seedLive = UINT32_MAX;
+        float seedDistance = FLT_MAX;
+        for (uint32_t vertex : meshletVertices) {
+            for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                uint32_t t = adjacency[a];
+                if (emitted[t]) {
+                    continue;
+                }
+                uint32_t neighbours = live[indices[t * 3]] + live[indices[t * 3 + 1]] + live[indices[t * 3 + 2]];
+                float dx = centroids[t * 3] - lastCenter[0];
+                float dy = centroids[t * 3 + 1] - lastCenter[1];
+                float dz = centroids[t * 3 + 2] - lastCenter[2];
+                float distance = dx * dx + dy * dy + dz * dz;
+                if (neighbours < seedLive || (neighbours == seedLive && distance < seedDistance)) {
+                    seed = t;
+                    seedLive = neighbours;
+                    seedDistance = distance;
+                }
+            }
+        }
+        if (seed == UINT32_MAX) {
+            while (emitted[nextUnused]) {
+                nextUnused++;
+            }
+            seed = nextUnused;
+        }
+
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        float centroidSum[3] = {};
+        float normalSum[3] = {};
+        uint32_t triangle = seed;
+        while (triangle != UINT32_MAX) {
+            emitted[triangle] = true;
+            meshletTriangles.push_back(triangle);
+            for (int k = 0; k < 3; k++) {
+                uint32_t vertex = indices[triangle * 3 + k];
+                live[vertex]--;
+                if (vertexMeshlet[vertex] != meshletIndex) {
+                    vertexMeshlet[vertex] = meshletIndex;
+                    meshletVertices.push_back(vertex);
+                }
+            }
+            for (int j = 0; j < 3; j++) {
+                centroidSum[j] += centroids[triangle * 3 + j];
+                normalSum[j] += normals[triangle * 3 + j];
+            }
+            if (meshletTriangles.size() == BMF_MESHLET_MAX_TRIANGLES) {
+                break;
+            }
+
+            float center[3];
+            float axis[3];
+            float axisLength = std::sqrt(normalSum[0] * normalSum[0] + normalSum[1] * normalSum[1] + normalSum[2] * normalSum[2]);
+            for (int j = 0; j < 3; j++) {
+                center[j] = centroidSum[j] / meshletTriangles.size();
+                axis[j] = axisLength > 0.0f ? normalSum[j] / axisLength : 0.0f;
+            }
+            triangle = UINT32_MAX;
+            uint32_t bestPriority = UINT32_MAX;
+            float bestScore = FLT_MAX;
+            for (uint32_t vertex : meshletVertices) {
+                for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                    uint32_t t = adjacency[a];
+                    if (emitted[t]) {
+                        continue;
+                    }
+                    uint32_t extra = 0;
+                    bool dangling = false;
+                    for (int k = 0; k < 3; k++) {
+                        extra += vertexMeshlet[indices[t * 3 + k]] != meshletIndex;
+                        dangling |= live[indices[t * 3 + k]] == 1;
+                    }
+                    if (meshletVertices.size() + extra > BMF_MESHLET_MAX_VERTICES) {
+                        continue;
+                    }
+                    uint32_t priority = dangling ? 0 : extra;
+                    if (priority > bestPriority) {
+                        continue;
+                    }
+                    float dx = centroids[t * 3] - center[0];
+                    float dy = centroids[t * 3 + 1] - center[1];
+                    float dz = centroids[t * 3 + 2] - center[2];
+                    float spread = normals[t * 3] * axis[0] + normals[t * 3 + 1] * axis[1] + normals[t * 3 + 2] * axis[2];
+                    float cone = std::max(1.0f - spread * coneWeight, 1e-3f);
+                    float score = (1.0f + std::sqrt(dx * dx + dy * dy + dz * dz) / expectedRadius * (1.0f - coneWeight)) * cone;
+                    if (priority < bestPriority || score < bestScore) {
+                        triangle = t;
+                        bestPriority = priority;
+                        bestScore = score;
+                    }
+                }
+            }
+        }
+
+        // Local vertex numbers keep the cache optimization of a meshlet independent of the mesh size
+        std::vector<uint32_t> local(meshletTriangles.size() * 3);
+        for (size_t i = 0; i < meshletTriangles.size(); i++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t vertex = indices[meshletTriangles[i] * 3 + k];
+                local[i * 3 + k] = (uint32_t)(std::find(meshletVertices.begin(), meshletVertices.end(), vertex) - meshletVertices.begin());
+            }
+        }
+        optimizeVertexCache(local, meshletVertices.size());
+
+        BmfMeshlet meshlet = {};
+        meshlet.firstIndex = (uint32_t)ordered.size();
+        meshlet.numTriangles = (uint32_t)meshletTriangles.size();
+        meshlet.numVertices = (uint32_t)meshletVertices.size();
+        for (uint32_t index : local) {
+            ordered.push_back(meshletVertices[index]);
+        }
+        computeMeshletBounds(ordered.data() + meshlet.firstIndex, meshlet.numTriangles, positions, meshlet);
+        meshlets.push_back(meshlet);
+        for (int j = 0; j < 3; j++) {
+            lastCenter[j] = meshlet.center[j];
+        }
+    }
+    indices.swap(ordered);
+    return meshlets;
+}
+
+// Sorts whole meshlets for overdraw like optimizeOverdraw sorts clusters, the meshlets follow their triangles
+inline void optimizeMeshletOverdraw(std::vector<uint32_t>& indices, const float* positions, std::vector<BmfMeshlet>& meshlets) {
+    if (meshlets.empty()) {
+        return;
+    }
+    std::vector<uint32_t> clusterStarts;
+    for (const BmfMeshlet& meshlet : meshlets) {
+        clusterStarts.push_back(meshlet.firstIndex / 3);
+    }
+    clusterStarts.push_back((uint32_t)(indices.size() / 3));
+    std::vector<uint32_t> order = sortClustersForOverdraw(indices, positions, clusterStarts);
+
+    std::vector<BmfMeshlet> sorted;
+    sorted.reserve(meshlets.size());
+    uint32_t firstIndex = 0;
+    for (uint32_t m : order) {
+        BmfMeshlet meshlet = meshlets[m];
+        meshlet.firstIndex = firstIndex;
+        firstIndex += meshlet.numTriangles * 3;
+        sorted.push_back(meshlet);
+    }
+    meshlets.swap(sorted);
+}
@@ -1,26 +1,50 @@
 #version 330 core
 
+// Variants define SHADER_VARIANT and the features they use, without it every feature is on
+#ifndef SHADER_VARIANT
+#define SPECULAR
+#define EMISSIVE
+#endif
+
 layout(location = 0) out vec4 f_color;
 
 in vec3 v_normal; 
 in vec3 v_positon;
 
-uniform vec3 u_diffuse;
-uniform vec3 u_specular;
-uniform vec3 u_emissive;
-uniform float u_shininess;
+struct Material {
+    vec3 diffuse;
+    vec3 specular;
+    vec3 emissive;
+    float shininess;
+};
+
+// Filled by the MaterialRegistry, the size has to match MATERIALS_PER_PAGE
+layout(std140) uniform Materials {
+    Material u_materials[256];
+};
+
+// Index into the currently bound page of materials
+uniform int u_materialIndex;
 
 void main()
 {
-    // Vector from fragment to camera (Camera always at 0,0,0)
-    vec3 view = normalize(-v_positon);
+    Material material = u_materials[u_materialIndex];
+
     vec3 light = normalize(vec3(1.0f,1.0f,1.0f));
     vec3 normal = normalize(v_normal);
-    vec3 reflection = reflect(-light, normal);
 
-    vec3 ambient = u_diffuse * 0.2f;
-    vec3 diffuse = max(dot(normal, light),0.0f) * u_diffuse;
-    vec3 specular = pow(max(dot(reflection, view), 0.0000001f), u_shininess) * u_specular;
+    vec3 ambient = material.diffuse * 0.2f;
+    vec3 diffuse = max(dot(normal, light),0.0f) * material.diffuse;
+    vec3 color = ambient + diffuse;
+#ifdef SPECULAR
+    // Vector from fragment to camera (Camera always at 0,0,0)
+    vec3 view = normalize(-v_positon);
+    vec3 reflection = reflect(-light, normal);
+    color += pow(max(dot(reflection, view), 0.0000001f), material.shininess) * material.specular;
+#endif
+#ifdef EMISSIVE
+    color += material.emissive;
+#endif
 
-    f_color = vec4(ambient + diffuse + specular + u_emissive, 1.0f);
+    f_color = vec4(color, 1.0f);
 }
\ No newline at end of file
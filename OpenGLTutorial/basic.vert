@@ -1,18 +1,53 @@
 #version 330 core
 
+// Variants define SHADER_VARIANT and the features they use, without it every feature except INSTANCED is on
+#ifndef SHADER_VARIANT
+#define QUANTIZED_POSITIONS
+#endif
+
 layout(location = 0) in vec3 a_position;
 layout(location = 1) in vec3 a_normal;
+#ifdef INSTANCED
+// Model matrix of the instance, takes up locations 2 to 5, and its inverse transpose, locations 6 to 8,
+// see InstanceBuffer
+layout(location = 2) in mat4 a_model;
+layout(location = 6) in mat3 a_normalMatrix;
+#endif
 
 out vec3 v_normal; 
 out vec3 v_positon;
 
+#ifdef INSTANCED
+uniform mat4 u_view;
+uniform mat4 u_projection;
+#else
 uniform mat4 u_modelViewProj;
 uniform mat4 u_modelView;
 uniform mat4 u_invModelView;
+#endif
+#ifdef QUANTIZED_POSITIONS
+// Dequantization of normalized positions
+uniform vec3 u_positionScale;
+uniform vec3 u_positionOffset;
+#endif
 
 void main()
 {
-	gl_Position = u_modelViewProj * vec4(a_position, 1.0f);
+#ifdef QUANTIZED_POSITIONS
+	vec4 position = vec4(a_position * u_positionScale + u_positionOffset, 1.0f);
+#else
+	vec4 position = vec4(a_position, 1.0f);
+#endif
+#ifdef INSTANCED
+	mat4 modelView = u_view * a_model;
+	vec4 viewPosition = modelView * position;
+	gl_Position = u_projection * viewPosition;
+	// The view matrix is a rotation and translation, it is its own inverse transpose
+	v_normal = mat3(u_view) * (a_normalMatrix * a_normal);
+	v_positon = vec3(viewPosition);
+#else
+	gl_Position = u_modelViewProj * position;
 	v_normal = mat3(u_invModelView) * a_normal;
-	v_positon = vec3(u_modelView * vec4(a_position, 1.0f));
+	v_positon = vec3(u_modelView * position);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,35 @@
+#version 430 core
+
+layout(location = 0) out vec4 f_color;
+
+in vec3 v_normal; 
+in vec3 v_positon;
+flat in int v_drawIndex;
+
+struct DrawData {
+	vec4 diffuse;
+	vec4 specular;
+	vec4 emissive;
+	vec4 positionScale;
+	vec4 positionOffset;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+	DrawData u_draws[];
+};
+
+void main()
+{
+    DrawData draw = u_draws[v_drawIndex];
+    // Vector from fragment to camera (Camera always at 0,0,0)
+    vec3 view = normalize(-v_positon);
+    vec3 light = normalize(vec3(1.0f,1.0f,1.0f));
+    vec3 normal = normalize(v_normal);
+    vec3 reflection = reflect(-light, normal);
+
+    vec3 ambient = draw.diffuse.rgb * 0.2f;
+    vec3 diffuse = max(dot(normal, light),0.0f) * draw.diffuse.rgb;
+    vec3 specular = pow(max(dot(reflection, view), 0.0000001f), draw.emissive.w) * draw.specular.rgb;
+
+    f_color = vec4(ambient + diffuse + specular + draw.emissive.rgb, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec3 a_normal;
+
+out vec3 v_normal; 
+out vec3 v_positon;
+flat out int v_drawIndex;
+
+// One entry per draw command of the model, see IndirectDrawData
+struct DrawData {
+	vec4 diffuse;
+	vec4 specular;
+	// w holds the shininess
+	vec4 emissive;
+	vec4 positionScale;
+	vec4 positionOffset;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+	DrawData u_draws[];
+};
+
+uniform mat4 u_modelViewProj;
+uniform mat4 u_modelView;
+uniform mat4 u_invModelView;
+// gl_DrawID starts at 0 for every multi draw call, this is the index of its first command
+uniform int u_drawOffset;
+
+void main()
+{
+	v_drawIndex = u_drawOffset + gl_DrawIDARB;
+	DrawData draw = u_draws[v_drawIndex];
+	vec4 position = vec4(a_position * draw.positionScale.xyz + draw.positionOffset.xyz, 1.0f);
+	gl_Position = u_modelViewProj * position;
+	v_normal = mat3(u_invModelView) * a_normal;
+	v_positon = vec3(u_modelView * position);
+}
\ No newline at end of file
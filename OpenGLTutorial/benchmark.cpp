@@ -0,0 +1,1489 @@
+#include "benchmark.h"
+#include "mesh.h"
+#include "model_loader.h"
+#include "index_buffer.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "frustum_culling.h"
+#include "bvh.h"
+#include "gpu_culling.h"
+#include "meshlet_culling.h"
+#include "program_cache.h"
+#include "uniform.h"
+#include "shader_variants.h"
+#include "../ModelExporter/mesh_simplifier.h"
+#include "../ModelExporter/meshlet_builder.h"
+#include "../dependencies/glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static double elapsedMilliseconds(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Writes a bmf file with numMeshes grid meshes of gridSize * gridSize vertices each
+static uint64_t writeSyntheticModel(const char* filename, uint64_t numMeshes, uint32_t gridSize, uint32_t version) {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	for (uint32_t y = 0; y < gridSize; y++) {
+		for (uint32_t x = 0; x < gridSize; x++) {
+			Vertex vertex;
+			vertex.positon = glm::vec3((float)x, 0.0f, (float)y);
+			vertex.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+			vertices.push_back(vertex);
+		}
+	}
+	for (uint32_t y = 0; y + 1 < gridSize; y++) {
+		for (uint32_t x = 0; x + 1 < gridSize; x++) {
+			uint32_t i = y * gridSize + x;
+			uint32_t quad[6] = { i, i + gridSize, i + 1, i + 1, i + gridSize, i + gridSize + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	Material material = { glm::vec3(0.8f), glm::vec3(0.5f), glm::vec3(0.0f), 32.0f };
+	if (version == BMF_VERSION) {
+		BmfMeshData mesh = {};
+		memcpy(&mesh.material, &material, sizeof(Material));
+		mesh.vertexFormat = BMF_VERTEX_FORMAT_FLOAT;
+		mesh.vertexStride = sizeof(Vertex);
+		mesh.vertices = vertices.data();
+		mesh.numVertices = vertices.size();
+		mesh.indices = indices.data();
+		mesh.numIndices = indices.size();
+		mesh.indexElementSize = sizeof(uint32_t);
+		mesh.boundsMax[0] = mesh.boundsMax[2] = (float)(gridSize - 1);
+		std::vector<BmfMeshData> meshes(numMeshes, mesh);
+		bmfWriteVersion2(filename, meshes);
+		std::ifstream written(filename, std::ios::in | std::ios::binary | std::ios::ate);
+		return (uint64_t)written.tellg();
+	}
+
+	std::ofstream output(filename, std::ios::out | std::ios::binary);
+	output.write((char*)&numMeshes, sizeof(uint64_t));
+	uint64_t numVertices = vertices.size();
+	uint64_t numIndices = indices.size();
+	for (uint64_t i = 0; i < numMeshes; i++) {
+		output.write((char*)&material, sizeof(Material));
+		output.write((char*)&numVertices, sizeof(uint64_t));
+		output.write((char*)&numIndices, sizeof(uint64_t));
+		output.write((char*)vertices.data(), numVertices * sizeof(Vertex));
+		output.write((char*)indices.data(), numIndices * sizeof(uint32_t));
+	}
+	return (uint64_t)output.tellp();
+}
+
+static double timeModelLoad(const char* filename, Shader* shader, ModelLoadMode mode, uint32_t repetitions) {
+	double total = 0.0;
+	for (uint32_t i = 0; i < repetitions; i++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		{
+			Model model;
+			model.Init(filename, shader, mode);
+			glFinish();
+			total += elapsedMilliseconds(start);
+		}
+	}
+	return total / repetitions;
+}
+
+static int benchmarkModelLoading(Shader* shader) {
+	struct Case {
+		const char* filename;
+		uint64_t numMeshes;
+		uint32_t gridSize;
+		uint32_t version;
+	};
+	const Case cases[] = {
+		{ "benchmark_small_v1.bmf", 16, 64, 1 },
+		{ "benchmark_medium_v1.bmf", 16, 256, 1 },
+		{ "benchmark_large_v1.bmf", 4, 1024, 1 },
+		{ "benchmark_small_v2.bmf", 16, 64, BMF_VERSION },
+		{ "benchmark_medium_v2.bmf", 16, 256, BMF_VERSION },
+		{ "benchmark_large_v2.bmf", 4, 1024, BMF_VERSION },
+	};
+	const uint32_t repetitions = 5;
+
+	for (const Case& c : cases) {
+		uint64_t fileSize = writeSyntheticModel(c.filename, c.numMeshes, c.gridSize, c.version);
+		double megabytes = (double)fileSize / (1024.0 * 1024.0);
+
+		double streamTime = timeModelLoad(c.filename, shader, ModelLoadMode::Stream, repetitions);
+		double mappedTime = timeModelLoad(c.filename, shader, ModelLoadMode::MemoryMapped, repetitions);
+
+		std::cout << c.filename << " (" << megabytes << " MB)" << std::endl;
+		std::cout << "  stream:        " << streamTime << " ms, " << megabytes / (streamTime / 1000.0) << " MB/s" << std::endl;
+		std::cout << "  memory mapped: " << mappedTime << " ms, " << megabytes / (mappedTime / 1000.0) << " MB/s" << std::endl;
+		std::remove(c.filename);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Model geometry in system memory as interleaved float vertices and 32 bit indices
+struct CpuMesh {
+	BmfMaterial material;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	float boundsMin[3];
+	float boundsMax[3];
+	// Simplified levels of detail, only written when present
+	std::vector<std::vector<uint32_t>> lods;
+	std::vector<float> lodErrors;
+	// Only written when present
+	std::vector<BmfMeshlet> meshlets;
+};
+
+// Reads a v1 bmf file, which is what models/ ships with
+static std::vector<CpuMesh> readCpuMeshes(const char* filename) {
+	std::vector<CpuMesh> meshes;
+	std::ifstream input(filename, std::ios::in | std::ios::binary);
+	uint64_t numMeshes = 0;
+	input.read((char*)&numMeshes, sizeof(uint64_t));
+	for (uint64_t i = 0; i < numMeshes && input; i++) {
+		CpuMesh mesh;
+		uint64_t numVertices = 0;
+		uint64_t numIndices = 0;
+		input.read((char*)&mesh.material, sizeof(BmfMaterial));
+		input.read((char*)&numVertices, sizeof(uint64_t));
+		input.read((char*)&numIndices, sizeof(uint64_t));
+		mesh.vertices.resize(numVertices * 6);
+		mesh.indices.resize(numIndices);
+		input.read((char*)mesh.vertices.data(), mesh.vertices.size() * sizeof(float));
+		input.read((char*)mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		for (int j = 0; j < 3; j++) {
+			mesh.boundsMin[j] = FLT_MAX;
+			mesh.boundsMax[j] = -FLT_MAX;
+		}
+		for (uint64_t v = 0; v < numVertices; v++) {
+			for (int j = 0; j < 3; j++) {
+				mesh.boundsMin[j] = std::min(mesh.boundsMin[j], mesh.vertices[v * 6 + j]);
+				mesh.boundsMax[j] = std::max(mesh.boundsMax[j], mesh.vertices[v * 6 + j]);
+			}
+		}
+		meshes.push_back(std::move(mesh));
+	}
+	return meshes;
+}
+
+// Builds a single gridSize * gridSize vertex grid mesh
+static CpuMesh gridCpuMesh(uint32_t gridSize) {
+	CpuMesh mesh = {};
+	mesh.material = { { 0.8f, 0.8f, 0.8f }, { 0.5f, 0.5f, 0.5f }, { 0.0f, 0.0f, 0.0f }, 32.0f };
+	for (uint32_t y = 0; y < gridSize; y++) {
+		for (uint32_t x = 0; x < gridSize; x++) {
+			// Some height variation so the positions do not delta encode to nothing
+			float vertex[6] = { (float)x, (float)((x * 7 + y * 13) % 5) * 0.1f, (float)y, 0.0f, 1.0f, 0.0f };
+			mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 6);
+		}
+	}
+	for (uint32_t y = 0; y + 1 < gridSize; y++) {
+		for (uint32_t x = 0; x + 1 < gridSize; x++) {
+			uint32_t i = y * gridSize + x;
+			uint32_t quad[6] = { i, i + gridSize, i + 1, i + 1, i + gridSize, i + gridSize + 1 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+	mesh.boundsMin[0] = mesh.boundsMin[1] = mesh.boundsMin[2] = 0.0f;
+	mesh.boundsMax[0] = mesh.boundsMax[2] = (float)(gridSize - 1);
+	mesh.boundsMax[1] = 0.4f;
+	return mesh;
+}
+
+// Builds a single sphere around the origin out of rings * segments quads
+static CpuMesh sphereCpuMesh(uint32_t rings, uint32_t segments, float radius) {
+	CpuMesh mesh = {};
+	mesh.material = { { 0.8f, 0.8f, 0.8f }, { 0.5f, 0.5f, 0.5f }, { 0.0f, 0.0f, 0.0f }, 32.0f };
+	for (uint32_t ring = 0; ring <= rings; ring++) {
+		float theta = glm::radians(180.0f) * (float)ring / (float)rings;
+		for (uint32_t segment = 0; segment <= segments; segment++) {
+			float phi = glm::radians(360.0f) * (float)segment / (float)segments;
+			glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			float vertex[6] = { normal.x * radius, normal.y * radius, normal.z * radius, normal.x, normal.y, normal.z };
+			mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 6);
+		}
+	}
+	for (uint32_t ring = 0; ring < rings; ring++) {
+		for (uint32_t segment = 0; segment < segments; segment++) {
+			uint32_t i = ring * (segments + 1) + segment;
+			uint32_t quad[6] = { i, i + 1, i + segments + 1, i + 1, i + segments + 2, i + segments + 1 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+	for (int j = 0; j < 3; j++) {
+		mesh.boundsMin[j] = -radius;
+		mesh.boundsMax[j] = radius;
+	}
+	return mesh;
+}
+
+// Writes the meshes as a v2 file in the given vertex format and returns the GPU size of their vertices
+static uint64_t writeConvertedModel(const char* filename, const std::vector<CpuMesh>& meshes, uint32_t vertexFormat, uint32_t compression = BMF_COMPRESSION_NONE) {
+	std::vector<std::vector<BmfQuantizedVertex>> quantized(meshes.size());
+	std::vector<std::vector<uint32_t>> allIndices(meshes.size());
+	std::vector<std::vector<uint16_t>> narrowedIndices(meshes.size());
+	std::vector<BmfMeshData> meshData(meshes.size());
+	uint64_t vertexBytes = 0;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		const CpuMesh& mesh = meshes[i];
+		BmfMeshData& data = meshData[i];
+		data.material = mesh.material;
+		data.vertexFormat = vertexFormat;
+		data.vertexStride = bmfVertexStride(vertexFormat);
+		data.vertices = mesh.vertices.data();
+		data.numVertices = mesh.vertices.size() / 6;
+		allIndices[i] = mesh.indices;
+		data.numLods = (uint32_t)std::min(mesh.lods.size(), (size_t)BMF_MAX_LODS);
+		for (uint32_t lod = 0; lod < data.numLods; lod++) {
+			allIndices[i].insert(allIndices[i].end(), mesh.lods[lod].begin(), mesh.lods[lod].end());
+			data.lodNumIndices[lod] = (uint32_t)mesh.lods[lod].size();
+			data.lodErrors[lod] = mesh.lodErrors[lod];
+		}
+		data.indices = allIndices[i].data();
+		data.numIndices = mesh.indices.size();
+		data.meshlets = mesh.meshlets.data();
+		data.numMeshlets = (uint32_t)mesh.meshlets.size();
+		data.indexElementSize = sizeof(uint32_t);
+		if (data.numVertices <= 0xFFFF) {
+			narrowedIndices[i] = bmfNarrowIndices(allIndices[i].data(), allIndices[i].size());
+			data.indices = narrowedIndices[i].data();
+			data.indexElementSize = sizeof(uint16_t);
+		}
+		memcpy(data.boundsMin, mesh.boundsMin, sizeof(data.boundsMin));
+		memcpy(data.boundsMax, mesh.boundsMax, sizeof(data.boundsMax));
+		if (vertexFormat == BMF_VERTEX_FORMAT_QUANTIZED) {
+			quantized[i].resize(data.numVertices);
+			bmfQuantizeVertices(mesh.vertices.data(), data.numVertices, mesh.boundsMin, mesh.boundsMax, quantized[i].data());
+			data.vertices = quantized[i].data();
+		}
+		data.compression = compression;
+		vertexBytes += data.numVertices * data.vertexStride;
+	}
+	bmfWriteVersion2(filename, meshData);
+	return vertexBytes;
+}
+
+// Draws the model drawsPerFrame times per frame and returns the average frame time
+static double timeFrames(Model& model, Shader* shader, uint32_t frames, uint32_t drawsPerFrame) {
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Uniform<glm::mat4> modelViewProjUniform(shader, SHADER_NAME("u_modelViewProj"));
+	Uniform<glm::mat4> modelViewUniform(shader, SHADER_NAME("u_modelView"));
+	Uniform<glm::mat4> invModelViewUniform(shader, SHADER_NAME("u_invModelView"));
+
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
+	glFinish();
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		for (uint32_t draw = 0; draw < drawsPerFrame; draw++) {
+			glm::mat4 modelMatrix = glm::rotate(glm::mat4(1.0f), (float)draw * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::mat4 modelView = view * modelMatrix;
+			glm::mat4 modelViewProj = projection * modelView;
+			glm::mat4 invModelView = glm::transpose(glm::inverse(modelView));
+			modelViewProjUniform.set(modelViewProj);
+			modelViewUniform.set(modelView);
+			invModelViewUniform.set(invModelView);
+			model.render();
+		}
+		glFinish();
+	}
+	return elapsedMilliseconds(start) / frames;
+}
+
+static int benchmarkQuantizedVertices(Shader* shader) {
+	const char* filenames[] = { "../models/monkey.bmf", "../models/Tree01.bmf" };
+	const char* convertedFilename = "benchmark_converted.bmf";
+	const uint32_t frames = 100;
+	const uint32_t drawsPerFrame = 1000;
+
+	for (const char* filename : filenames) {
+		std::vector<CpuMesh> meshes = readCpuMeshes(filename);
+		if (meshes.empty()) {
+			std::cout << "Could not read " << filename << std::endl;
+			continue;
+		}
+		std::cout << filename << std::endl;
+		for (uint32_t vertexFormat : { BMF_VERTEX_FORMAT_FLOAT, BMF_VERTEX_FORMAT_QUANTIZED }) {
+			uint64_t vertexBytes = writeConvertedModel(convertedFilename, meshes, vertexFormat);
+			Model model;
+			model.Init(convertedFilename, shader);
+			double frameTime = timeFrames(model, shader, frames, drawsPerFrame);
+			std::cout << "  " << (vertexFormat == BMF_VERTEX_FORMAT_FLOAT ? "float:     " : "quantized: ")
+				<< bmfVertexStride(vertexFormat) << " bytes per vertex, " << vertexBytes / 1024.0 << " KB vertex memory, "
+				<< frameTime << " ms per frame (" << drawsPerFrame << " draws)" << std::endl;
+		}
+		std::remove(convertedFilename);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Average time to decode all meshes of the file in system memory, without the upload
+static double timeDecode(const char* filename, uint32_t repetitions) {
+	MappedFile file(filename);
+	if (!file.isOpen() || !bmfIsVersion2(file.getData(), file.getSize())) {
+		return 0.0;
+	}
+	const BmfHeader* header = (const BmfHeader*)file.getData();
+	const BmfMeshEntry* entries = (const BmfMeshEntry*)(file.getData() + header->meshTableOffset);
+	std::vector<uint8_t> vertices;
+	std::vector<uint8_t> indices;
+	std::vector<uint8_t> scratch;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < repetitions; i++) {
+		for (uint32_t j = 0; j < header->numMeshes; j++) {
+			const BmfMeshEntry& entry = entries[j];
+			if (entry.compression == BMF_COMPRESSION_NONE) {
+				vertices.assign(file.getData() + entry.vertexOffset, file.getData() + entry.vertexOffset + entry.vertexSize);
+				indices.assign(file.getData() + entry.indexOffset, file.getData() + entry.indexOffset + entry.indexSize);
+			}
+			else {
+				bmfDecodeMesh(entry, file.getData() + entry.vertexOffset, file.getData() + entry.indexOffset, vertices, indices, scratch);
+			}
+		}
+	}
+	return elapsedMilliseconds(start) / repetitions;
+}
+
+static int benchmarkCompression(Shader* shader) {
+	const char* filenames[] = { "../models/monkey.bmf", "../models/Tree01.bmf", nullptr };
+	const char* convertedFilename = "benchmark_compressed.bmf";
+	const uint32_t repetitions = 5;
+	struct Variant {
+		const char* name;
+		uint32_t compression;
+	};
+	const Variant variants[] = {
+		{ "none:       ", BMF_COMPRESSION_NONE },
+		{ "delta:      ", BMF_COMPRESSION_DELTA },
+		{ "delta + lz4:", BMF_COMPRESSION_DELTA | BMF_COMPRESSION_LZ4 },
+	};
+
+	for (const char* filename : filenames) {
+		std::vector<CpuMesh> meshes;
+		if (filename) {
+			meshes = readCpuMeshes(filename);
+		}
+		else {
+			filename = "synthetic 1024 x 1024 grid";
+			meshes.push_back(gridCpuMesh(1024));
+		}
+		if (meshes.empty()) {
+			std::cout << "Could not read " << filename << std::endl;
+			continue;
+		}
+		std::cout << filename << std::endl;
+		for (uint32_t vertexFormat : { BMF_VERTEX_FORMAT_FLOAT, BMF_VERTEX_FORMAT_QUANTIZED }) {
+			std::cout << (vertexFormat == BMF_VERTEX_FORMAT_FLOAT ? "  float vertices" : "  quantized vertices") << std::endl;
+			for (const Variant& variant : variants) {
+				writeConvertedModel(convertedFilename, meshes, vertexFormat, variant.compression);
+				uint64_t fileSize = MappedFile(convertedFilename).getSize();
+				uint64_t decodedSize = 0;
+				for (const CpuMesh& mesh : meshes) {
+					uint64_t numVertices = mesh.vertices.size() / 6;
+					decodedSize += numVertices * bmfVertexStride(vertexFormat) + mesh.indices.size() * (numVertices <= 0xFFFF ? sizeof(uint16_t) : sizeof(uint32_t));
+				}
+				double decodeTime = timeDecode(convertedFilename, repetitions);
+				double loadTime = timeModelLoad(convertedFilename, shader, ModelLoadMode::MemoryMapped, repetitions);
+				std::cout << "    " << variant.name << " " << fileSize / 1024.0 << " KB, decode " << decodeTime << " ms ("
+					<< (double)decodedSize / (decodeTime / 1000.0) / 1e9 << " GB/s), load " << loadTime << " ms" << std::endl;
+			}
+		}
+		std::remove(convertedFilename);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Compares the frame that blocks on Model::Init with streaming the same model in through a ModelLoader
+static int benchmarkAsyncLoading(Shader* shader) {
+	const char* filename = "benchmark_async.bmf";
+	uint64_t fileSize = writeSyntheticModel(filename, 64, 256, BMF_VERSION);
+	std::cout << filename << " (" << fileSize / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+	{
+		Model model;
+		auto start = std::chrono::high_resolution_clock::now();
+		model.Init(filename, shader);
+		double loadTime = elapsedMilliseconds(start);
+		double frameTime = timeFrames(model, shader, 1, 1);
+		std::cout << "  synchronous: " << loadTime + frameTime << " ms blocked frame" << std::endl;
+	}
+
+	const uint64_t budgets[] = { 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+	for (uint64_t budget : budgets) {
+		ModelLoader loader(2, budget);
+		Model model;
+		auto start = std::chrono::high_resolution_clock::now();
+		loader.load(&model, filename, shader);
+		uint32_t frames = 0;
+		double maxFrameTime = 0.0;
+		while (model.getState() == ModelState::Pending) {
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			loader.update();
+			timeFrames(model, shader, 1, 1);
+			maxFrameTime = std::max(maxFrameTime, elapsedMilliseconds(frameStart));
+			frames++;
+		}
+		double totalTime = elapsedMilliseconds(start);
+		std::cout << "  async, " << budget / (1024 * 1024) << " MB per frame: " << frames << " frames, "
+			<< totalTime << " ms until ready, " << maxFrameTime << " ms longest frame" << std::endl;
+	}
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// Streams a model in with glBufferSubData uploads and through staging rings of different sizes
+static int benchmarkStaging(Shader* shader) {
+	const char* filename = "benchmark_staging.bmf";
+	const uint64_t uploadBudget = 4 * 1024 * 1024;
+	writeSyntheticModel(filename, 64, 256, BMF_VERSION);
+
+	const uint64_t capacities[] = { 0, 8 * 1024 * 1024, 32 * 1024 * 1024 };
+	for (uint64_t capacity : capacities) {
+		StagingRing* staging = capacity ? new StagingRing(capacity) : nullptr;
+		if (staging && !staging->isSupported()) {
+			delete staging;
+			break;
+		}
+		StagingStats total;
+		double maxFrameTime = 0.0;
+		double totalTime = 0.0;
+		uint32_t frames = 0;
+		{
+			GeometryPool geometry(staging);
+			ModelLoader loader(2, uploadBudget, 64 * 1024 * 1024, &geometry);
+			Model model;
+			loader.load(&model, filename, shader);
+			while (model.getState() == ModelState::Pending) {
+				auto frameStart = std::chrono::high_resolution_clock::now();
+				loader.update();
+				timeFrames(model, shader, 1, 1);
+				if (staging) {
+					StagingStats stats = staging->endFrame();
+					total.bytesUploaded += stats.bytesUploaded;
+					total.stalls += stats.stalls;
+					total.wrapWaits += stats.wrapWaits;
+				}
+				double frameTime = elapsedMilliseconds(frameStart);
+				maxFrameTime = std::max(maxFrameTime, frameTime);
+				totalTime += frameTime;
+				frames++;
+			}
+		}
+		if (staging) {
+			std::cout << "  staging ring " << capacity / (1024 * 1024) << " MB: ";
+		}
+		else {
+			std::cout << "  glBufferSubData:   ";
+		}
+		std::cout << totalTime / frames << " ms average frame, " << maxFrameTime << " ms longest frame";
+		if (staging) {
+			std::cout << ", " << total.bytesUploaded / (1024.0 * 1024.0) << " MB uploaded, " << total.stalls << " stalls, " << total.wrapWaits << " ring wrap waits";
+		}
+		std::cout << std::endl;
+		delete staging;
+	}
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// Draws many small meshes from buffers of their own and from a shared geometry arena
+static int benchmarkGeometryArena(Shader* shader) {
+	const char* filename = "benchmark_arena.bmf";
+	const uint32_t numMeshes = 1024;
+	const uint32_t gridSize = 16;
+	const uint32_t frames = 100;
+	writeSyntheticModel(filename, numMeshes, gridSize, BMF_VERSION);
+	CpuMesh grid = gridCpuMesh(gridSize);
+	Material material = { glm::vec3(0.8f), glm::vec3(0.5f), glm::vec3(0.0f), 32.0f };
+	glm::vec3 positionScale(1.0f);
+	glm::vec3 positionOffset(0.0f);
+	MaterialRegistry materials;
+	uint32_t materialIndex = materials.add(material);
+	MeshUniforms uniforms;
+	uniforms.lookUp(shader);
+
+	{
+		// One VAO, vertex and index buffer per mesh
+		std::vector<VertexBuffer*> vertexBuffers;
+		std::vector<IndexBuffer*> indexBuffers;
+		for (uint32_t i = 0; i < numMeshes; i++) {
+			vertexBuffers.push_back(new VertexBuffer(grid.vertices.data(), (uint32_t)grid.vertices.size() / 6));
+			indexBuffers.push_back(new IndexBuffer(grid.indices.data(), (uint32_t)grid.indices.size(), sizeof(uint32_t)));
+		}
+		glFinish();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			materials.prepare();
+			for (uint32_t i = 0; i < numMeshes; i++) {
+				vertexBuffers[i]->bind();
+				indexBuffers[i]->bind();
+				uniforms.materialIndex.set((GLint)materials.bind(materialIndex));
+				uniforms.positionScale.set(positionScale);
+				uniforms.positionOffset.set(positionOffset);
+				glDrawElements(GL_TRIANGLES, (GLsizei)grid.indices.size(), GL_UNSIGNED_INT, 0);
+			}
+			glFinish();
+		}
+		std::cout << "  separate buffers: " << numMeshes * 3 << " buffer objects, " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+		for (uint32_t i = 0; i < numMeshes; i++) {
+			delete vertexBuffers[i];
+			delete indexBuffers[i];
+		}
+	}
+
+	{
+		GeometryPool geometry;
+		Model model;
+		model.Init(filename, shader, ModelLoadMode::MemoryMapped, &geometry);
+		glFinish();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			model.render();
+			glFinish();
+		}
+		std::cout << "  geometry arena:   " << geometry.getNumBlocks() * 3 << " buffer objects, " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+	}
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// CPU time to submit a frame of 1 to 100k tiny meshes with one draw per mesh and with multi draw indirect
+static int benchmarkDrawCalls(Shader* shader) {
+	if (!Model::supportsIndirect()) {
+		std::cout << "Multi draw indirect is not supported" << std::endl;
+		return EXIT_FAILURE;
+	}
+	Shader indirectShader("basic_indirect.vert", "basic_indirect.frag");
+	const char* filename = "benchmark_draw_calls.bmf";
+	const uint64_t meshCounts[] = { 1, 10, 100, 1000, 10000, 100000 };
+	const uint32_t frames = 50;
+
+	for (uint64_t numMeshes : meshCounts) {
+		writeSyntheticModel(filename, numMeshes, 2, BMF_VERSION);
+		GeometryPool geometry;
+		Model model;
+		model.Init(filename, shader, ModelLoadMode::MemoryMapped, &geometry);
+		std::cout << numMeshes << " meshes" << std::endl;
+		for (Shader* active : { shader, &indirectShader }) {
+			active->bind();
+			if (active == &indirectShader) {
+				// Builds the indirect buffers outside of the measurement
+				model.renderIndirect(&indirectShader);
+			}
+			glFinish();
+			double submitTime = 0.0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				auto submitStart = std::chrono::high_resolution_clock::now();
+				if (active == &indirectShader) {
+					model.renderIndirect(&indirectShader);
+				}
+				else {
+					model.render();
+				}
+				submitTime += elapsedMilliseconds(submitStart);
+				glFinish();
+			}
+			std::cout << (active == shader ? "  draw per mesh:               " : "  glMultiDrawElementsIndirect: ")
+				<< submitTime / frames << " ms CPU submit, " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+		}
+	}
+	shader->bind();
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// Counts the GL calls the state cache lets through and drops while drawing many meshes
+static int benchmarkStateCache(Shader* shader) {
+	const char* filename = "benchmark_state_cache.bmf";
+	const uint32_t frames = 100;
+	writeSyntheticModel(filename, 1000, 16, BMF_VERSION);
+	{
+		Model model;
+		model.Init(filename, shader);
+		timeFrames(model, shader, 1, 1);
+		GLState::endFrame();
+		double frameTime = timeFrames(model, shader, frames, 1);
+		GLStateCounters counters = GLState::endFrame();
+		std::cout << "1000 meshes, " << frameTime << " ms per frame" << std::endl;
+#if GL_STATE_CACHE
+		std::cout << "  " << counters.issued / frames << " calls issued, " << counters.skipped / frames << " redundant calls skipped per frame" << std::endl;
+#else
+		std::cout << "  state cache is compiled out" << std::endl;
+#endif
+	}
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// State changes and frame time of a scene of many models drawn in submission order and sorted by the render queue
+static int benchmarkRenderQueue(Shader* shader) {
+	const char* filenames[] = { "benchmark_render_queue_float.bmf", "benchmark_render_queue_quantized.bmf" };
+	const uint32_t vertexFormats[] = { BMF_VERTEX_FORMAT_FLOAT, BMF_VERTEX_FORMAT_QUANTIZED };
+	const uint32_t numInstances = 2000;
+	const uint32_t frames = 100;
+	// Eight meshes with a material each, once per vertex format so the models live in different geometry blocks
+	std::vector<CpuMesh> meshes(8, gridCpuMesh(8));
+	for (size_t i = 0; i < meshes.size(); i++) {
+		meshes[i].material.diffuse[0] = (float)i / meshes.size();
+	}
+	for (int i = 0; i < 2; i++) {
+		writeConvertedModel(filenames[i], meshes, vertexFormats[i]);
+	}
+	{
+		Shader secondShader("basic.vert", "basic.frag");
+		Shader* shaders[] = { shader, &secondShader };
+		GeometryPool geometry;
+		MaterialRegistry materials;
+		Model models[2];
+		for (int i = 0; i < 2; i++) {
+			models[i].Init(filenames[i], shader, ModelLoadMode::MemoryMapped, &geometry, &materials);
+		}
+		glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 40.0f, 0.0f), glm::vec3(0.0f, 0.0f, -100.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		std::vector<glm::mat4> instances(numInstances);
+		for (uint32_t i = 0; i < numInstances; i++) {
+			instances[i] = glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 50) * 10.0f - 250.0f, 0.0f, -(float)(i / 50) * 10.0f));
+		}
+
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_CULL_FACE);
+		RenderQueue queue;
+		std::cout << numInstances << " models, " << numInstances * meshes.size() << " draws per frame" << std::endl;
+		for (bool sorted : { false, true }) {
+			RenderQueueStats stats;
+			double submitTime = 0.0;
+			glFinish();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				auto submitStart = std::chrono::high_resolution_clock::now();
+				queue.begin(view, projection);
+				// Interleaves models and shaders so consecutive draws never share state
+				for (uint32_t i = 0; i < numInstances; i++) {
+					queue.submit(models[i % 2], shaders[i / 2 % 2], instances[i]);
+				}
+				stats = queue.execute(sorted);
+				submitTime += elapsedMilliseconds(submitStart);
+				glFinish();
+			}
+			std::cout << (sorted ? "  sorted:    " : "  unsorted:  ") << stats.getStateChanges() << " state changes per frame ("
+				<< stats.programChanges << " program, " << stats.materialChanges << " material, " << stats.vertexArrayChanges << " VAO), "
+				<< submitTime / frames << " ms CPU submit, " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+		}
+	}
+	shader->bind();
+	for (const char* filename : filenames) {
+		std::remove(filename);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Frame time of many monkeys drawn one model at a time and with one instanced draw per mesh
+static int benchmarkInstancing(Shader* shader) {
+	const char* filename = "../models/monkey.bmf";
+	const uint32_t instanceCounts[] = { 1000, 10000, 100000, 200000 };
+	// One draw per copy is too slow to measure beyond this
+	const uint32_t maxCopies = 10000;
+	const uint32_t frames = 20;
+	Shader instancedShader("basic.vert", "basic.frag", false, { "INSTANCED" });
+	Model model;
+	model.Init(filename, shader);
+	if (model.getMeshes().empty()) {
+		std::cout << "Could not read " << filename << std::endl;
+		return EXIT_FAILURE;
+	}
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Uniform<glm::mat4> viewUniform(&instancedShader, SHADER_NAME("u_view"));
+	Uniform<glm::mat4> projectionUniform(&instancedShader, SHADER_NAME("u_projection"));
+
+	for (uint32_t numInstances : instanceCounts) {
+		std::cout << numInstances << " monkeys" << std::endl;
+		if (numInstances <= maxCopies) {
+			shader->bind();
+			std::cout << "  draw per copy: " << timeFrames(model, shader, frames, numInstances) << " ms per frame" << std::endl;
+		}
+
+		InstanceBuffer instances;
+		// Layers of 100 x 100 monkeys, rotated like the copies timeFrames draws
+		for (uint32_t i = 0; i < numInstances; i++) {
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 100) * 3.0f - 150.0f, (float)(i / 100 % 100) * 3.0f - 150.0f, -(float)(i / 10000) * 3.0f));
+			instances.add(glm::rotate(transform, (float)i * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+		instancedShader.bind();
+		viewUniform.set(view);
+		projectionUniform.set(projection);
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_CULL_FACE);
+		// Uploads the instances outside of the measurement
+		model.renderInstanced(&instancedShader, instances);
+		glFinish();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			model.renderInstanced(&instancedShader, instances);
+			glFinish();
+		}
+		std::cout << "  instanced:     " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Culling throughput of the scalar and SIMD kernels and of the SIMD kernel split across threads
+static int benchmarkCulling() {
+	const uint32_t numObjects = 1000000;
+	const uint32_t repetitions = 20;
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = Frustum::fromViewProj(projection * view);
+
+	// Unit boxes scattered around the camera, rotated and scaled, so some are inside and many are not
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	CullingBounds bounds;
+	for (uint32_t i = 0; i < numObjects; i++) {
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+		transform = glm::rotate(transform, unit(random) * 6.28f, glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + 0.01f));
+		transform = glm::scale(transform, glm::vec3(0.5f + unit(random) * 4.0f));
+		bounds.add(transform, glm::vec3(-1.0f), glm::vec3(1.0f), std::sqrt(3.0f));
+	}
+	std::vector<uint8_t> visible(bounds.radius.size());
+	uint32_t paddedCount = (uint32_t)bounds.radius.size();
+
+	std::cout << numObjects << " objects" << std::endl;
+	uint32_t numVisible = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < repetitions; i++) {
+		numVisible = cullBoundsScalar(frustum, bounds, 0, paddedCount, visible.data());
+	}
+	double time = elapsedMilliseconds(start) / repetitions;
+	std::cout << "  scalar:    " << numObjects / time << " objects/ms, " << numVisible << " visible, " << numObjects - numVisible << " culled" << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < repetitions; i++) {
+		numVisible = cullBounds(frustum, bounds, 0, paddedCount, visible.data());
+	}
+	time = elapsedMilliseconds(start) / repetitions;
+#if defined(CULLING_AVX)
+	std::cout << "  AVX:       ";
+#elif defined(CULLING_SSE)
+	std::cout << "  SSE:       ";
+#else
+	std::cout << "  no SIMD:   ";
+#endif
+	std::cout << numObjects / time << " objects/ms, " << numVisible << " visible, " << numObjects - numVisible << " culled" << std::endl;
+
+	uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+	for (uint32_t numThreads = 2; numThreads <= maxThreads; numThreads *= 2) {
+		FrustumCuller culler(numThreads);
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < repetitions; i++) {
+			numVisible = culler.cull(frustum, bounds, visible);
+		}
+		time = elapsedMilliseconds(start) / repetitions;
+		std::cout << "  " << numThreads << " threads: " << numObjects / time << " objects/ms, " << numVisible << " visible" << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Casts rays from random points around the bounds towards random points inside of them, returns rays per second
+static double timeRays(const MeshBvh& mesh, uint32_t numRays, uint32_t& numHits) {
+	glm::vec3 boundsMin = mesh.getBoundsMin();
+	glm::vec3 boundsMax = mesh.getBoundsMax();
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = glm::length(boundsMax - boundsMin);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Ray> rays(numRays);
+	for (Ray& ray : rays) {
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + 0.001f);
+		glm::vec3 target = boundsMin + (boundsMax - boundsMin) * glm::vec3(unit(random), unit(random), unit(random));
+		ray = Ray(center + direction * radius, target - (center + direction * radius));
+	}
+	numHits = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const Ray& ray : rays) {
+		MeshHit hit;
+		numHits += mesh.intersect(ray, hit);
+	}
+	return numRays / (elapsedMilliseconds(start) / 1000.0);
+}
+
+// BVH build times and ray throughput on Tree01.bmf and large synthetic grids
+static int benchmarkBvh() {
+	const uint32_t numRays = 200000;
+	uint32_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	struct Case {
+		const char* name;
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+	};
+	std::vector<Case> cases;
+	for (const CpuMesh& mesh : readCpuMeshes("../models/Tree01.bmf")) {
+		cases.push_back({ "Tree01.bmf mesh", {}, {} });
+		for (size_t v = 0; v < mesh.vertices.size(); v += 6) {
+			cases.back().positions.push_back(glm::vec3(mesh.vertices[v], mesh.vertices[v + 1], mesh.vertices[v + 2]));
+		}
+		cases.back().indices = mesh.indices;
+	}
+	for (uint32_t gridSize : { 256u, 1024u }) {
+		CpuMesh grid = gridCpuMesh(gridSize);
+		cases.push_back({ gridSize == 256 ? "256 x 256 grid" : "1024 x 1024 grid", {}, {} });
+		for (size_t v = 0; v < grid.vertices.size(); v += 6) {
+			cases.back().positions.push_back(glm::vec3(grid.vertices[v], grid.vertices[v + 1], grid.vertices[v + 2]));
+		}
+		cases.back().indices = grid.indices;
+	}
+
+	for (const Case& c : cases) {
+		std::cout << c.name << ", " << c.indices.size() / 3 << " triangles" << std::endl;
+		MeshBvh mesh;
+		for (uint32_t threads : { 1u, numThreads }) {
+			auto start = std::chrono::high_resolution_clock::now();
+			mesh.build(c.positions, c.indices, threads);
+			std::cout << "  build on " << threads << " threads: " << elapsedMilliseconds(start) << " ms, " << mesh.getNumNodes() << " nodes" << std::endl;
+			if (numThreads == 1) {
+				break;
+			}
+		}
+		uint32_t numHits;
+		double raysPerSecond = timeRays(mesh, numRays, numHits);
+		std::cout << "  " << raysPerSecond / 1000000.0 << " million rays per second, " << numHits << " of " << numRays << " hit" << std::endl;
+	}
+
+	// Top level over many instances of the grid
+	MeshBvh grid;
+	grid.build(cases.back().positions, cases.back().indices, numThreads);
+	SceneBvh scene;
+	for (uint32_t i = 0; i < 10000; i++) {
+		scene.add(&grid, glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 100) * 1100.0f, (float)(i / 100) * 10.0f, 0.0f)));
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	scene.build(numThreads);
+	std::cout << "Scene of 10000 grid instances" << std::endl;
+	std::cout << "  build: " << elapsedMilliseconds(start) << " ms" << std::endl;
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	uint32_t numHits = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < numRays; i++) {
+		glm::vec3 target(unit(random) * 110000.0f, unit(random) * 1000.0f, unit(random) * 1000.0f);
+		SceneHit hit;
+		numHits += scene.intersect(Ray(glm::vec3(55000.0f, 5000.0f, -5000.0f), target - glm::vec3(55000.0f, 5000.0f, -5000.0f)), hit);
+	}
+	std::cout << "  " << numRays / (elapsedMilliseconds(start) / 1000.0) / 1000000.0 << " million rays per second, " << numHits << " of " << numRays << " hit" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+// CPU and GPU time per frame of GPU culled instances against drawing all instances, with draw counts from
+// glMultiDrawElementsIndirectCount and from a readback of the counts
+static int benchmarkGpuCulling(Shader* shader) {
+	const char* filename = "../models/monkey.bmf";
+	const uint32_t instanceCounts[] = { 10000, 100000, 1000000 };
+	// Drawing every instance is too slow to measure beyond this
+	const uint32_t maxDrawAll = 100000;
+	const uint32_t frames = 10;
+	if (!GpuCuller::isSupported()) {
+		std::cout << "GPU culling needs OpenGL 4.3" << std::endl;
+		return EXIT_FAILURE;
+	}
+	Shader instancedShader("basic.vert", "basic.frag", false, { "INSTANCED" });
+	Shader culledShader("gpu_culled.vert", "basic_indirect.frag");
+	Model model;
+	model.Init(filename, shader);
+	if (model.getMeshes().empty()) {
+		std::cout << "Could not read " << filename << std::endl;
+		return EXIT_FAILURE;
+	}
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	GpuCuller culler;
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
+
+	for (uint32_t numInstances : instanceCounts) {
+		std::cout << numInstances << " monkeys" << std::endl;
+		InstanceBuffer instances;
+		// Layers of 100 x 100 monkeys like in the instancing benchmark, most of them outside of the view
+		for (uint32_t i = 0; i < numInstances; i++) {
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 100) * 3.0f - 150.0f, (float)(i / 100 % 100) * 3.0f - 150.0f, -(float)(i / 10000) * 3.0f));
+			instances.add(glm::rotate(transform, (float)i * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+
+		if (numInstances <= maxDrawAll) {
+			instancedShader.bind();
+			Uniform<glm::mat4>(&instancedShader, SHADER_NAME("u_view")).set(view);
+			Uniform<glm::mat4>(&instancedShader, SHADER_NAME("u_projection")).set(projection);
+			model.renderInstanced(&instancedShader, instances);
+			glFinish();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				model.renderInstanced(&instancedShader, instances);
+				glFinish();
+			}
+			std::cout << "  all instances:    " << elapsedMilliseconds(start) / frames << " ms per frame" << std::endl;
+		}
+
+		for (bool readback : { false, true }) {
+			culler.setCountReadback(readback);
+			if (!readback && culler.usesCountReadback()) {
+				std::cout << "  GL_ARB_indirect_parameters is not supported" << std::endl;
+				continue;
+			}
+			// The first frame uploads the instances and grows the command buffer
+			culler.render(model, instances, &culledShader, view, projection);
+			glFinish();
+			double cpuTime = 0.0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				auto frameStart = std::chrono::high_resolution_clock::now();
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				culler.render(model, instances, &culledShader, view, projection);
+				cpuTime += elapsedMilliseconds(frameStart);
+				glFinish();
+			}
+			double time = elapsedMilliseconds(start) / frames;
+			std::cout << (readback ? "  count readback:   " : "  indirect count:   ") << time << " ms per frame, " << cpuTime / frames
+				<< " ms on the CPU, " << culler.readStats().drawn << " visible" << std::endl;
+		}
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Frame time of a dense forest of Tree01.bmf with and without Hi-Z occlusion culling, on the GPU culling path and
+// in the render queue. Every frame is drawn from the same view, so the pyramid of the last frame matches exactly.
+static int benchmarkOcclusion(Shader* shader) {
+	const char* filename = "../models/Tree01.bmf";
+	const uint32_t gridSize = 40;
+	const uint32_t frames = 10;
+	if (!HiZBuffer::isSupported()) {
+		std::cout << "Hi-Z occlusion culling needs OpenGL 4.3" << std::endl;
+		return EXIT_FAILURE;
+	}
+	Shader culledShader("gpu_culled.vert", "basic_indirect.frag");
+	Model model;
+	model.Init(filename, shader);
+	if (model.getMeshes().empty()) {
+		std::cout << "Could not read " << filename << std::endl;
+		return EXIT_FAILURE;
+	}
+	glm::vec3 boundsMin(FLT_MAX);
+	glm::vec3 boundsMax(-FLT_MAX);
+	for (Mesh* mesh : model.getMeshes()) {
+		boundsMin = glm::min(boundsMin, mesh->getBoundsMin());
+		boundsMax = glm::max(boundsMax, mesh->getBoundsMax());
+	}
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	// Trees overlap a little so the rows in front hide most of the ones behind them
+	float spacing = std::max(boundsMax.x - boundsMin.x, boundsMax.z - boundsMin.z) * 0.8f;
+	InstanceBuffer instances;
+	std::vector<glm::mat4> transforms;
+	for (uint32_t i = 0; i < gridSize * gridSize; i++) {
+		glm::vec3 position(((float)(i / gridSize) - (float)(gridSize / 2)) * spacing, 0.0f, -(float)(i % gridSize) * spacing);
+		transforms.push_back(glm::translate(glm::mat4(1.0f), position - center));
+		instances.add(transforms.back());
+	}
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)viewport[2] / (float)viewport[3], 0.1f, spacing * gridSize * 2.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, spacing * 2.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	HiZBuffer hiZ;
+	hiZ.resize(viewport[2], viewport[3]);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
+	std::cout << gridSize * gridSize << " trees, " << gridSize * gridSize * model.getMeshes().size() << " meshes" << std::endl;
+
+	if (GpuCuller::isSupported()) {
+		GpuCuller culler;
+		for (bool occlusion : { false, true }) {
+			HiZBuffer* occluder = occlusion ? &hiZ : nullptr;
+			// The first frame uploads the instances and builds the pyramid the next one is culled against
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			culler.render(model, instances, &culledShader, view, projection, occluder);
+			glFinish();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				culler.render(model, instances, &culledShader, view, projection, occluder);
+				glFinish();
+			}
+			double time = elapsedMilliseconds(start) / frames;
+			GpuCullStats stats = culler.readStats();
+			std::cout << (occlusion ? "  GPU culling, Hi-Z:    " : "  GPU culling:          ") << time << " ms per frame, " << stats.drawn << " drawn, "
+				<< stats.occluded << " occluded, " << stats.retested - stats.occluded << " visible again after the re-test" << std::endl;
+		}
+	}
+
+	RenderQueue queue;
+	for (bool occlusion : { false, true }) {
+		queue.setOcclusion(occlusion ? &hiZ : nullptr);
+		RenderQueueStats stats;
+		auto start = std::chrono::high_resolution_clock::now();
+		// Like above the first frame is not timed
+		for (uint32_t frame = 0; frame <= frames; frame++) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			queue.begin(view, projection);
+			for (const glm::mat4& transform : transforms) {
+				queue.submit(model, shader, transform);
+			}
+			stats = queue.execute();
+			glFinish();
+			if (frame == 0) {
+				start = std::chrono::high_resolution_clock::now();
+			}
+		}
+		double time = elapsedMilliseconds(start) / frames;
+		std::cout << (occlusion ? "  render queue, Hi-Z:   " : "  render queue:         ") << time << " ms per frame, " << stats.draws << " drawn, "
+			<< stats.occluded << " occluded, " << stats.retested - stats.occluded << " visible again after the re-test" << std::endl;
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Triangles and frame time of a field of monkeys with and without levels of detail, generated like the exporter does.
+// The camera sways back and forth, which shows how many level switches the hysteresis saves.
+static int benchmarkLod(Shader* shader) {
+	const char* filename = "../models/monkey.bmf";
+	const char* lodFilename = "benchmark_lod.bmf";
+	const uint32_t gridSize = 50;
+	const uint32_t frames = 40;
+	std::vector<CpuMesh> meshes = readCpuMeshes(filename);
+	if (meshes.empty()) {
+		std::cout << "Could not read " << filename << std::endl;
+		return EXIT_FAILURE;
+	}
+	for (CpuMesh& mesh : meshes) {
+		std::vector<float> positions;
+		std::vector<float> normals;
+		for (size_t v = 0; v < mesh.vertices.size(); v += 6) {
+			positions.insert(positions.end(), mesh.vertices.begin() + v, mesh.vertices.begin() + v + 3);
+			normals.insert(normals.end(), mesh.vertices.begin() + v + 3, mesh.vertices.begin() + v + 6);
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		buildLodChain(mesh.indices, positions.data(), normals.data(), positions.size() / 3, BMF_MAX_LODS, 0.1f, mesh.lods, mesh.lodErrors);
+		std::cout << "Mesh with " << mesh.indices.size() / 3 << " triangles simplified in " << elapsedMilliseconds(start) << " ms" << std::endl;
+		for (size_t i = 0; i < mesh.lods.size(); i++) {
+			std::cout << "  lod " << i + 1 << ": " << mesh.lods[i].size() / 3 << " triangles, error " << mesh.lodErrors[i] << std::endl;
+		}
+	}
+	writeConvertedModel(lodFilename, meshes, BMF_VERTEX_FORMAT_FLOAT);
+	Model model;
+	model.Init(lodFilename, shader);
+	std::remove(lodFilename);
+	if (model.getMeshes().empty()) {
+		std::cout << "Could not read " << lodFilename << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<glm::mat4> transforms;
+	for (uint32_t i = 0; i < gridSize * gridSize; i++) {
+		transforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(((float)(i % gridSize) - (float)(gridSize / 2)) * 4.0f, 0.0f, -(float)(i / gridSize) * 4.0f)));
+	}
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)viewport[2] / (float)viewport[3], 0.1f, 1000.0f);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
+	RenderQueue queue;
+	std::cout << gridSize * gridSize << " monkeys" << std::endl;
+
+	struct Case {
+		const char* name;
+		bool lod;
+		float hysteresis;
+	};
+	for (const Case& c : { Case{ "full detail:        ", false, 0.0f }, Case{ "lod, no hysteresis: ", true, 0.0f }, Case{ "lod:                ", true, 0.25f } }) {
+		LodSelector selector(1.0f, c.hysteresis);
+		selector.setProjection(projection, viewport[3]);
+		queue.setLodSelector(c.lod ? &selector : nullptr);
+		std::vector<LodState> states(transforms.size());
+		uint64_t triangles = 0;
+		uint32_t switches = 0;
+		glFinish();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			glm::vec3 eye(0.0f, 6.0f, 12.0f + std::sin((float)frame) * 0.5f);
+			glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0f, -0.3f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			queue.begin(view, projection);
+			for (size_t i = 0; i < transforms.size(); i++) {
+				std::vector<uint8_t> previous = states[i].levels;
+				queue.submit(model, shader, transforms[i], RenderPass::Opaque, &states[i]);
+				for (size_t m = 0; frame > 0 && m < previous.size(); m++) {
+					switches += previous[m] != states[i].levels[m];
+				}
+			}
+			triangles += queue.execute().triangles;
+			glFinish();
+		}
+		std::cout << "  " << c.name << triangles / frames << " triangles, " << elapsedMilliseconds(start) / frames << " ms per frame, "
+			<< switches << " level switches" << std::endl;
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Frame time and drawn triangles of a large sphere culled as a whole mesh, by meshlets against the frustum and by
+// meshlets against the frustum and their normal cones. Seen from close by only a small part of it is in view.
+static int benchmarkMeshlets(Shader* shader) {
+	const char* meshFilename = "benchmark_sphere.bmf";
+	const char* meshletFilename = "benchmark_meshlets.bmf";
+	const uint32_t frames = 10;
+	if (!MeshletCuller::isSupported()) {
+		std::cout << "Meshlet culling needs OpenGL 4.3" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::vector<CpuMesh> meshes = { sphereCpuMesh(512, 1024, 50.0f) };
+	writeConvertedModel(meshFilename, meshes, BMF_VERTEX_FORMAT_FLOAT);
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<float> positions;
+	for (size_t v = 0; v < meshes[0].vertices.size(); v += 6) {
+		positions.insert(positions.end(), meshes[0].vertices.begin() + v, meshes[0].vertices.begin() + v + 3);
+	}
+	meshes[0].meshlets = buildMeshlets(meshes[0].indices, positions.data(), positions.size() / 3);
+	std::cout << "Sphere with " << meshes[0].indices.size() / 3 << " triangles split into " << meshes[0].meshlets.size() << " meshlets in "
+		<< elapsedMilliseconds(start) << " ms" << std::endl;
+	writeConvertedModel(meshletFilename, meshes, BMF_VERTEX_FORMAT_FLOAT);
+
+	Shader culledShader("gpu_culled.vert", "basic_indirect.frag");
+	Model meshModel;
+	meshModel.Init(meshFilename, shader);
+	Model meshletModel;
+	meshletModel.Init(meshletFilename, shader);
+	std::remove(meshFilename);
+	std::remove(meshletFilename);
+	if (meshModel.getMeshes().empty() || meshletModel.getMeshes().empty()) {
+		std::cout << "Could not read the sphere" << std::endl;
+		return EXIT_FAILURE;
+	}
+	InstanceBuffer instances;
+	instances.add(glm::mat4(1.0f));
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)viewport[2] / (float)viewport[3], 0.1f, 1000.0f);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
+	MeshletCuller culler;
+
+	struct View {
+		const char* name;
+		glm::vec3 eye;
+		glm::vec3 target;
+	};
+	struct Case {
+		const char* name;
+		Model* model;
+		bool coneCulling;
+	};
+	for (const View& v : { View{ "whole sphere", glm::vec3(0.0f, 0.0f, 150.0f), glm::vec3(0.0f) }, View{ "close to the surface", glm::vec3(0.0f, 0.0f, 53.0f), glm::vec3(20.0f, 0.0f, 45.0f) } }) {
+		glm::mat4 view = glm::lookAt(v.eye, v.target, glm::vec3(0.0f, 1.0f, 0.0f));
+		std::cout << v.name << std::endl;
+		for (const Case& c : { Case{ "whole mesh:        ", &meshModel, false }, Case{ "meshlets, frustum: ", &meshletModel, false }, Case{ "meshlets, cones:   ", &meshletModel, true } }) {
+			culler.setConeCulling(c.coneCulling);
+			// The first frame uploads the meshlets and grows the command buffer
+			culler.render(*c.model, instances, &culledShader, view, projection);
+			glFinish();
+			start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				culler.render(*c.model, instances, &culledShader, view, projection);
+				glFinish();
+			}
+			double time = elapsedMilliseconds(start) / frames;
+			MeshletCullStats stats = culler.readStats();
+			std::cout << "  " << c.name << time << " ms per frame, " << stats.drawn << " of " << culler.getNumMeshlets() << " meshlets, "
+				<< stats.triangles << " triangles, " << stats.coneCulled << " cone culled" << std::endl;
+		}
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Every program the renderer creates at startup, compute programs have no second stage. The third entry is a define.
+static const char* startupPrograms[][3] = {
+	{ "basic.vert", "basic.frag", nullptr },
+	{ "basic_indirect.vert", "basic_indirect.frag", nullptr },
+	{ "basic.vert", "basic.frag", "INSTANCED" },
+	{ "gpu_culled.vert", "basic_indirect.frag", nullptr },
+	{ "cull_instances.comp", nullptr, nullptr },
+	{ "compact_draws.comp", nullptr, nullptr },
+	{ "hiz_downsample.comp", nullptr, nullptr },
+	{ "cull_meshlets.comp", nullptr, nullptr },
+};
+static const uint32_t numStartupPrograms = sizeof(startupPrograms) / sizeof(startupPrograms[0]);
+
+static Shader* createStartupProgram(const char* const program[3], bool deferred) {
+	if (program[1] == nullptr) {
+		return new Shader(program[0], deferred);
+	}
+	if (program[2] == nullptr) {
+		return new Shader(program[0], program[1], deferred);
+	}
+	return new Shader(program[0], program[1], deferred, { program[2] });
+}
+
+static std::vector<Shader*> createStartupPrograms(bool deferred) {
+	std::vector<Shader*> shaders;
+	for (const auto& program : startupPrograms) {
+		shaders.push_back(createStartupProgram(program, deferred));
+	}
+	return shaders;
+}
+
+static int benchmarkShaderCache(Shader* shader) {
+	if (!ProgramCache::isEnabled()) {
+		std::cout << "Error program binaries are not supported by the driver" << std::endl;
+		return EXIT_FAILURE;
+	}
+	for (const auto& program : startupPrograms) {
+		std::string name = program[1] ? std::string(program[0]) + "+" + program[1] : std::string(program[0]);
+		ProgramCache::evict(program[2] ? name + "@" + program[2] : name);
+	}
+	for (const char* name : { "cold cache: ", "warm cache: " }) {
+		ProgramCacheStats before = ProgramCache::getStats();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (Shader* s : createStartupPrograms(false)) {
+			delete s;
+		}
+		double time = elapsedMilliseconds(start);
+		ProgramCacheStats after = ProgramCache::getStats();
+		std::cout << name << time << " ms for " << numStartupPrograms << " programs, "
+			<< after.hits - before.hits << " hits, " << after.misses - before.misses << " misses, "
+			<< after.rejected - before.rejected << " rejected" << std::endl;
+	}
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+static int benchmarkParallelCompile(Shader* shader) {
+	bool parallel = Shader::enableParallelCompile();
+	std::cout << "Parallel shader compile " << (parallel ? "supported" : "not supported, deferred programs are built when waited for") << std::endl;
+	// Every program has to be compiled from source
+	ProgramCache::setEnabled(false);
+	const uint32_t runs = 5;
+
+	double serialTime = 0.0;
+	double slowestTime = 0.0;
+	for (uint32_t run = 0; run < runs; run++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (const auto& program : startupPrograms) {
+			auto programStart = std::chrono::high_resolution_clock::now();
+			Shader* s = createStartupProgram(program, false);
+			slowestTime = std::max(slowestTime, elapsedMilliseconds(programStart));
+			delete s;
+		}
+		serialTime += elapsedMilliseconds(start);
+	}
+	std::cout << "serial:   " << serialTime / runs << " ms for " << numStartupPrograms << " programs, slowest program " << slowestTime << " ms" << std::endl;
+
+	double deferredTime = 0.0;
+	double submitTime = 0.0;
+	for (uint32_t run = 0; run < runs; run++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<Shader*> shaders = createStartupPrograms(true);
+		submitTime += elapsedMilliseconds(start);
+		// Poll like a loading screen would between frames, then wait for the rest
+		uint32_t numReady = 0;
+		for (uint32_t poll = 0; poll < 1000 && numReady < shaders.size(); poll++) {
+			numReady = 0;
+			for (Shader* s : shaders) {
+				numReady += s->isReady() ? 1 : 0;
+			}
+		}
+		for (Shader* s : shaders) {
+			s->wait();
+		}
+		deferredTime += elapsedMilliseconds(start);
+		for (Shader* s : shaders) {
+			delete s;
+		}
+	}
+	std::cout << "deferred: " << deferredTime / runs << " ms for " << numStartupPrograms << " programs, " << submitTime / runs << " ms to submit" << std::endl;
+
+	ProgramCache::setEnabled(true);
+	shader->bind();
+	return EXIT_SUCCESS;
+}
+
+// Uniform lookups by string against the reflection table, and the glUniform calls the typed handles skip
+static int benchmarkUniforms(Shader* shader) {
+	const uint32_t lookups = 100000;
+	const char* names[] = { "u_modelViewProj", "u_modelView", "u_invModelView", "u_materialIndex", "u_positionScale", "u_positionOffset" };
+	const uint32_t hashes[] = { SHADER_NAME("u_modelViewProj"), SHADER_NAME("u_modelView"), SHADER_NAME("u_invModelView"),
+		SHADER_NAME("u_materialIndex"), SHADER_NAME("u_positionScale"), SHADER_NAME("u_positionOffset") };
+	GLint sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < lookups; i++) {
+		sum += glGetUniformLocation(shader->getShaderId(), names[i % 6]);
+	}
+	double stringTime = elapsedMilliseconds(start);
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < lookups; i++) {
+		sum -= shader->getUniformLocation(hashes[i % 6]);
+	}
+	double hashTime = elapsedMilliseconds(start);
+	std::cout << lookups << " lookups: glGetUniformLocation " << stringTime << " ms, reflection " << hashTime << " ms" << (sum ? " mismatch" : "") << std::endl;
+
+	const char* filename = "benchmark_uniforms.bmf";
+	const uint32_t frames = 100;
+	writeSyntheticModel(filename, 1000, 16, BMF_VERSION);
+	{
+		Model model;
+		model.Init(filename, shader);
+		timeFrames(model, shader, 1, 1);
+		UniformCounters::endFrame();
+		double frameTime = timeFrames(model, shader, frames, 1);
+		GLStateCounters counters = UniformCounters::endFrame();
+		std::cout << "1000 meshes, " << frameTime << " ms per frame" << std::endl;
+		std::cout << "  " << counters.issued / frames << " glUniform calls issued, " << counters.skipped / frames << " redundant calls skipped per frame" << std::endl;
+	}
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+// Frame time of a scene whose materials mostly need neither specular nor emissive, drawn with the shader that has
+// every feature and with the cheapest variant per mesh
+static int benchmarkShaderVariants(Shader* shader) {
+	const char* filename = "benchmark_variants.bmf";
+	const uint32_t numInstances = 400;
+	const uint32_t frames = 20;
+	// One in four meshes is shiny and glowing, the others only diffuse
+	std::vector<CpuMesh> meshes(8, gridCpuMesh(16));
+	for (size_t i = 0; i < meshes.size(); i++) {
+		meshes[i].material.diffuse[0] = (float)i / meshes.size();
+		for (int c = 0; c < 3; c++) {
+			meshes[i].material.specular[c] = i % 4 == 0 ? 0.5f : 0.0f;
+			meshes[i].material.emissive[c] = i % 4 == 0 ? 0.1f : 0.0f;
+		}
+	}
+	writeConvertedModel(filename, meshes, BMF_VERTEX_FORMAT_QUANTIZED);
+	{
+		ShaderVariants variants("basic.vert", "basic.frag");
+		if (!variants.precompile("basic_variants.txt")) {
+			return EXIT_FAILURE;
+		}
+		Model model;
+		model.Init(filename, shader);
+		glm::mat4 projection = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+		// Close enough above the grids that they cover the whole screen, several layers deep
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 6.0f, 0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		std::vector<glm::mat4> instances(numInstances);
+		for (uint32_t i = 0; i < numInstances; i++) {
+			instances[i] = glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 20) * 4.0f - 40.0f, (float)(i / 100) * -0.5f, -(float)(i / 20 % 5) * 4.0f));
+		}
+
+		GLState::disable(GL_DEPTH_TEST);
+		GLState::disable(GL_CULL_FACE);
+		RenderQueue queue;
+		std::cout << numInstances << " models, " << numInstances * meshes.size() << " draws per frame, overdraw without depth test" << std::endl;
+		for (bool useVariants : { false, true, false, true }) {
+			RenderQueueStats stats;
+			glFinish();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frames; frame++) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				queue.begin(view, projection);
+				for (uint32_t i = 0; i < numInstances; i++) {
+					if (useVariants) {
+						queue.submit(model, &variants, instances[i]);
+					}
+					else {
+						queue.submit(model, shader, instances[i]);
+					}
+				}
+				stats = queue.execute();
+				glFinish();
+			}
+			std::cout << (useVariants ? "  cheapest variants: " : "  all features:      ") << elapsedMilliseconds(start) / frames << " ms per frame, "
+				<< stats.programChanges << " program changes" << std::endl;
+		}
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_CULL_FACE);
+	}
+	shader->bind();
+	std::remove(filename);
+	return EXIT_SUCCESS;
+}
+
+int runBenchmark(const char* name, Shader* shader) {
+	if (strcmp(name, "load") == 0) {
+		return benchmarkModelLoading(shader);
+	}
+	if (strcmp(name, "quantized") == 0) {
+		return benchmarkQuantizedVertices(shader);
+	}
+	if (strcmp(name, "compression") == 0) {
+		return benchmarkCompression(shader);
+	}
+	if (strcmp(name, "async") == 0) {
+		return benchmarkAsyncLoading(shader);
+	}
+	if (strcmp(name, "staging") == 0) {
+		return benchmarkStaging(shader);
+	}
+	if (strcmp(name, "arena") == 0) {
+		return benchmarkGeometryArena(shader);
+	}
+	if (strcmp(name, "drawcalls") == 0) {
+		return benchmarkDrawCalls(shader);
+	}
+	if (strcmp(name, "statecache") == 0) {
+		return benchmarkStateCache(shader);
+	}
+	if (strcmp(name, "renderqueue") == 0) {
+		return benchmarkRenderQueue(shader);
+	}
+	if (strcmp(name, "instancing") == 0) {
+		return benchmarkInstancing(shader);
+	}
+	if (strcmp(name, "culling") == 0) {
+		return benchmarkCulling();
+	}
+	if (strcmp(name, "bvh") == 0) {
+		return benchmarkBvh();
+	}
+	if (strcmp(name, "gpuculling") == 0) {
+		return benchmarkGpuCulling(shader);
+	}
+	if (strcmp(name, "occlusion") == 0) {
+		return benchmarkOcclusion(shader);
+	}
+	if (strcmp(name, "lod") == 0) {
+		return benchmarkLod(shader);
+	}
+	if (strcmp(name, "meshlets") == 0) {
+		return benchmarkMeshlets(shader);
+	}
+	if (strcmp(name, "shadercache") == 0) {
+		return benchmarkShaderCache(shader);
+	}
+	if (strcmp(name, "parallelcompile") == 0) {
+		return benchmarkParallelCompile(shader);
+	}
+	if (strcmp(name, "uniforms") == 0) {
+		return benchmarkUniforms(shader);
+	}
+	if (strcmp(name, "variants") == 0) {
+		return benchmarkShaderVariants(shader);
+	}
+	std::cout << "Unknown benchmark " << name << std::endl;
+	std::cout << "Available benchmarks: load, quantized, compression, async, staging, arena, drawcalls, statecache, renderqueue, instancing, culling, bvh, gpuculling, occlusion, lod, meshlets, shadercache, parallelcompile, uniforms, variants" << std::endl;
+	return EXIT_FAILURE;
+}
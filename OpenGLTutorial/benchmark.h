@@ -0,0 +1,6 @@
+#pragma once
+#include "shader.h"
+
+// Benchmarks are started with "--benchmark <name>" and need a current OpenGL context.
+// Returns the process exit code.
+int runBenchmark(const char* name, Shader* shader);
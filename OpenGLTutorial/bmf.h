@@ -0,0 +1,408 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "bmf_codec.h"
+
+// Binary model format (bmf) shared by the ModelExporter and the loader.
+//
+// Version 1 files have no header: a uint64_t mesh count followed by each mesh as
+// material, uint64_t vertex count, uint64_t index count, interleaved vertices and uint32_t indices.
+//
+// Version 2 files start with a BmfHeader followed by a table of BmfMeshEntry structs.
+// Vertex and index data of every mesh are stored in separate blobs aligned to BMF_ALIGNMENT,
+// so a single mesh can be fetched with one read and meshes that are not needed can be skipped.
+// A mesh's vertex and index blobs are stored back to back.
+// Indices are 16 bit when the mesh has less than 65536 vertices and 32 bit otherwise.
+// Blobs of compressed meshes hold the encoding described in bmf_codec.h, vertexSize and indexSize are
+// then the encoded sizes. LZ4 compressed index blobs start with the uint64_t size of the varint stream.
+// Meshes can have up to BMF_MAX_LODS simplified levels of detail. They reuse the vertices of the mesh, their indices
+// follow the numIndices indices of the full mesh in the index blob, coarsest level last.
+// Files with BMF_FLAG_MESHLETS have a table of numMeshes BmfMeshletRange structs right after the mesh table.
+// Each range points at the uncompressed BmfMeshlet array of one mesh, stored after its index blob. The meshlets
+// partition the triangles of the full mesh, its indices are ordered so every meshlet is a contiguous range.
+
+#define BMF_MAGIC 0x32464D42 // "BMF2"
+#define BMF_VERSION 2
+#define BMF_ALIGNMENT 64
+#define BMF_MAX_LODS 3
+#define BMF_MESHLET_MAX_VERTICES 64
+#define BMF_MESHLET_MAX_TRIANGLES 124
+
+enum BmfFlags : uint32_t {
+	BMF_FLAG_MESHLETS = 1,
+};
+
+enum BmfVertexFormat : uint32_t {
+	// vec3 position, vec3 normal (24 bytes)
+	BMF_VERTEX_FORMAT_FLOAT = 0,
+	// Position as normalized uint16_t relative to the mesh bounds, normal as GL_INT_2_10_10_10_REV (12 bytes)
+	BMF_VERTEX_FORMAT_QUANTIZED = 1,
+};
+
+enum BmfCompression : uint32_t {
+	BMF_COMPRESSION_NONE = 0,
+	// Byte transposed delta encoded vertices and zigzag varint indices
+	BMF_COMPRESSION_DELTA = 1,
+	// LZ4 on top of the delta encoding
+	BMF_COMPRESSION_LZ4 = 2,
+};
+
+struct BmfQuantizedVertex {
+	// w is padding so the normal stays 4 byte aligned
+	uint16_t position[4];
+	uint32_t normal;
+};
+
+static_assert(sizeof(BmfQuantizedVertex) == 12, "BmfQuantizedVertex layout changed");
+
+struct BmfMaterial {
+	float diffuse[3];
+	float specular[3];
+	float emissive[3];
+	float shininess;
+};
+
+struct BmfHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numMeshes;
+	uint32_t flags;
+	uint64_t meshTableOffset;
+	uint64_t fileSize;
+};
+
+struct BmfMeshEntry {
+	BmfMaterial material;
+	uint32_t vertexFormat;
+	uint32_t vertexStride;
+	uint64_t numVertices;
+	uint64_t numIndices;
+	uint64_t vertexOffset;
+	uint64_t vertexSize;
+	uint64_t indexOffset;
+	uint64_t indexSize;
+	float boundsMin[3];
+	float boundsMax[3];
+	// Size of one index in bytes, 2 or 4
+	uint32_t indexElementSize;
+	// Combination of BmfCompression flags
+	uint32_t compression;
+	// Simplified levels after the full mesh, 0 for files written without them
+	uint32_t numLods;
+	uint32_t lodNumIndices[BMF_MAX_LODS];
+	// Largest distance of a simplified level from the full mesh in model space
+	float lodErrors[BMF_MAX_LODS];
+	uint32_t reserved[1];
+};
+
+// Cluster of at most BMF_MESHLET_MAX_TRIANGLES triangles using at most BMF_MESHLET_MAX_VERTICES vertices
+struct BmfMeshlet {
+	// In indices from the first index of the mesh
+	uint32_t firstIndex;
+	uint32_t numTriangles;
+	uint32_t numVertices;
+	// Bounding sphere in model space
+	float center[3];
+	float radius;
+	// Every triangle faces away from a view position p with dot(normalize(coneApex - p), coneAxis) >= coneCutoff,
+	// cutoffs above 1 mark meshlets whose normals spread too far for the test
+	float coneApex[3];
+	float coneAxis[3];
+	float coneCutoff;
+};
+
+struct BmfMeshletRange {
+	uint64_t offset;
+	uint32_t numMeshlets;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(BmfHeader) == 32, "BmfHeader layout changed");
+static_assert(sizeof(BmfMeshEntry) == 160, "BmfMeshEntry layout changed");
+static_assert(sizeof(BmfMeshlet) == 56, "BmfMeshlet layout changed");
+static_assert(sizeof(BmfMeshletRange) == 16, "BmfMeshletRange layout changed");
+
+// Indices of the full mesh and all of its simplified levels
+inline uint64_t bmfTotalIndices(const BmfMeshEntry& entry) {
+	uint64_t numIndices = entry.numIndices;
+	for (uint32_t i = 0; i < entry.numLods && i < BMF_MAX_LODS; i++) {
+		numIndices += entry.lodNumIndices[i];
+	}
+	return numIndices;
+}
+
+inline uint32_t bmfVertexStride(uint32_t vertexFormat) {
+	switch (vertexFormat) {
+	case BMF_VERTEX_FORMAT_FLOAT:
+		return 6 * sizeof(float);
+	case BMF_VERTEX_FORMAT_QUANTIZED:
+		return sizeof(BmfQuantizedVertex);
+	default:
+		return 0;
+	}
+}
+
+// Packs a unit vector into the x, y and z components of a GL_INT_2_10_10_10_REV value
+inline uint32_t bmfPackSnorm10(float x, float y, float z) {
+	auto pack = [](float v) {
+		v = std::min(std::max(v, -1.0f), 1.0f);
+		return (uint32_t)(int32_t)std::round(v * 511.0f) & 0x3FF;
+	};
+	return pack(x) | pack(y) << 10 | pack(z) << 20;
+}
+
+// Converts interleaved float position/normal vertices to BMF_VERTEX_FORMAT_QUANTIZED.
+// The renderer maps the positions back with boundsMin + position * (boundsMax - boundsMin).
+inline void bmfQuantizeVertices(const float* vertices, uint64_t numVertices, const float boundsMin[3], const float boundsMax[3], BmfQuantizedVertex* quantized) {
+	float scale[3];
+	for (int i = 0; i < 3; i++) {
+		float extent = boundsMax[i] - boundsMin[i];
+		scale[i] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+	}
+	for (uint64_t i = 0; i < numVertices; i++) {
+		const float* vertex = vertices + i * 6;
+		for (int j = 0; j < 3; j++) {
+			float q = std::round((vertex[j] - boundsMin[j]) * scale[j]);
+			quantized[i].position[j] = (uint16_t)std::min(std::max(q, 0.0f), 65535.0f);
+		}
+		quantized[i].position[3] = 0;
+		quantized[i].normal = bmfPackSnorm10(vertex[3], vertex[4], vertex[5]);
+	}
+}
+
+// Narrows 32 bit indices to 16 bit, only valid for meshes with less than 65536 vertices
+inline std::vector<uint16_t> bmfNarrowIndices(const uint32_t* indices, uint64_t numIndices) {
+	std::vector<uint16_t> narrowed(numIndices);
+	for (uint64_t i = 0; i < numIndices; i++) {
+		narrowed[i] = (uint16_t)indices[i];
+	}
+	return narrowed;
+}
+
+inline uint64_t bmfAlign(uint64_t offset) {
+	return (offset + BMF_ALIGNMENT - 1) & ~(uint64_t)(BMF_ALIGNMENT - 1);
+}
+
+inline bool bmfIsVersion2(const void* data, uint64_t size) {
+	uint32_t magic;
+	if (size < sizeof(BmfHeader)) {
+		return false;
+	}
+	memcpy(&magic, data, sizeof(uint32_t));
+	return magic == BMF_MAGIC;
+}
+
+// Checks that the header is a supported version and its mesh table lies inside a file of the given size
+inline bool bmfValidateHeader(const BmfHeader& header, uint64_t fileSize) {
+	return header.magic == BMF_MAGIC && header.version == BMF_VERSION && header.fileSize <= fileSize
+		&& header.meshTableOffset <= fileSize
+		&& header.numMeshes <= (fileSize - header.meshTableOffset) / (sizeof(BmfMeshEntry) + (header.flags & BMF_FLAG_MESHLETS ? sizeof(BmfMeshletRange) : 0));
+}
+
+// Offset of the meshlet range table, only valid for files with BMF_FLAG_MESHLETS
+inline uint64_t bmfMeshletTableOffset(const BmfHeader& header) {
+	return header.meshTableOffset + (uint64_t)header.numMeshes * sizeof(BmfMeshEntry);
+}
+
+// Checks that both blobs of a mesh lie inside a file of the given size
+inline bool bmfValidateMeshEntry(const BmfMeshEntry& entry, uint64_t fileSize) {
+	bool blobsValid = entry.vertexOffset <= fileSize && entry.vertexSize <= fileSize - entry.vertexOffset
+		&& entry.indexOffset <= fileSize && entry.indexSize <= fileSize - entry.indexOffset
+		&& entry.indexOffset >= entry.vertexOffset + entry.vertexSize
+		&& entry.vertexStride != 0 && (entry.indexElementSize == 2 || entry.indexElementSize == 4)
+		&& entry.numLods <= BMF_MAX_LODS && entry.numIndices <= UINT64_MAX - (uint64_t)BMF_MAX_LODS * UINT32_MAX;
+	if (!blobsValid) {
+		return false;
+	}
+	uint64_t totalIndices = bmfTotalIndices(entry);
+	if (entry.compression == BMF_COMPRESSION_NONE) {
+		return entry.numVertices <= entry.vertexSize / entry.vertexStride
+			&& totalIndices <= entry.indexSize / entry.indexElementSize;
+	}
+	// Decoded sizes are not bounded by the blobs, so keep them in a range that can be allocated
+	return (entry.compression & ~(uint32_t)(BMF_COMPRESSION_DELTA | BMF_COMPRESSION_LZ4)) == 0
+		&& (entry.compression & BMF_COMPRESSION_DELTA) != 0
+		&& entry.numVertices <= UINT32_MAX && totalIndices <= UINT32_MAX;
+}
+
+inline bool bmfValidateMeshletRange(const BmfMeshletRange& range, uint64_t fileSize) {
+	return range.offset <= fileSize && range.numMeshlets <= (fileSize - range.offset) / sizeof(BmfMeshlet);
+}
+
+// Checks that every meshlet lies inside the indices of the full mesh
+inline bool bmfValidateMeshlets(const BmfMeshlet* meshlets, uint32_t numMeshlets, const BmfMeshEntry& entry) {
+	for (uint32_t i = 0; i < numMeshlets; i++) {
+		if (meshlets[i].numTriangles > BMF_MESHLET_MAX_TRIANGLES || meshlets[i].firstIndex > entry.numIndices
+			|| meshlets[i].numTriangles * 3 > entry.numIndices - meshlets[i].firstIndex) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Decodes the blobs of a compressed mesh into plain vertex and index data
+inline bool bmfDecodeMesh(const BmfMeshEntry& entry, const uint8_t* vertexBlob, const uint8_t* indexBlob, std::vector<uint8_t>& vertices, std::vector<uint8_t>& indices, std::vector<uint8_t>& scratch) {
+	uint64_t totalIndices = bmfTotalIndices(entry);
+	vertices.resize(entry.numVertices * entry.vertexStride);
+	indices.resize(totalIndices * entry.indexElementSize);
+	const uint8_t* encodedVertices = vertexBlob;
+	const uint8_t* encodedIndices = indexBlob;
+	uint64_t encodedIndicesSize = entry.indexSize;
+	if (entry.compression & BMF_COMPRESSION_LZ4) {
+		if (entry.indexSize < sizeof(uint64_t)) {
+			return false;
+		}
+		memcpy(&encodedIndicesSize, indexBlob, sizeof(uint64_t));
+		if (encodedIndicesSize > totalIndices * 5) {
+			return false;
+		}
+		scratch.resize(vertices.size() + encodedIndicesSize);
+		if (!lz4Decompress(vertexBlob, entry.vertexSize, scratch.data(), vertices.size())
+			|| !lz4Decompress(indexBlob + sizeof(uint64_t), entry.indexSize - sizeof(uint64_t), scratch.data() + vertices.size(), encodedIndicesSize)) {
+			return false;
+		}
+		encodedVertices = scratch.data();
+		encodedIndices = scratch.data() + vertices.size();
+	}
+	else if (entry.vertexSize != vertices.size()) {
+		return false;
+	}
+	bmfDecodeVertices(encodedVertices, entry.numVertices, entry.vertexStride, vertices.data());
+	return bmfDecodeIndices(encodedIndices, encodedIndicesSize, totalIndices, entry.indexElementSize, indices.data());
+}
+
+// Everything the writer needs to know about one mesh
+struct BmfMeshData {
+	BmfMaterial material;
+	uint32_t vertexFormat;
+	uint32_t vertexStride;
+	const void* vertices;
+	uint64_t numVertices;
+	// Indices of the full mesh followed by those of its simplified levels
+	const void* indices;
+	uint64_t numIndices;
+	uint32_t indexElementSize;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint32_t compression;
+	uint32_t numLods;
+	uint32_t lodNumIndices[BMF_MAX_LODS];
+	float lodErrors[BMF_MAX_LODS];
+	// Optional, the file gets BMF_FLAG_MESHLETS when any mesh has meshlets
+	const BmfMeshlet* meshlets;
+	uint32_t numMeshlets;
+};
+
+// totalIndices counts the indices of the simplified levels too
+inline void bmfEncodeMesh(const BmfMeshData& mesh, uint64_t totalIndices, std::vector<uint8_t>& vertexBlob, std::vector<uint8_t>& indexBlob) {
+	std::vector<uint8_t> encodedVertices;
+	std::vector<uint8_t> encodedIndices;
+	bmfEncodeVertices((const uint8_t*)mesh.vertices, mesh.numVertices, mesh.vertexStride, encodedVertices);
+	bmfEncodeIndices((const uint8_t*)mesh.indices, totalIndices, mesh.indexElementSize, encodedIndices);
+	if (!(mesh.compression & BMF_COMPRESSION_LZ4)) {
+		vertexBlob.swap(encodedVertices);
+		indexBlob.swap(encodedIndices);
+		return;
+	}
+	lz4Compress(encodedVertices.data(), encodedVertices.size(), vertexBlob);
+	std::vector<uint8_t> compressedIndices;
+	lz4Compress(encodedIndices.data(), encodedIndices.size(), compressedIndices);
+	uint64_t encodedIndicesSize = encodedIndices.size();
+	indexBlob.resize(sizeof(uint64_t));
+	memcpy(indexBlob.data(), &encodedIndicesSize, sizeof(uint64_t));
+	indexBlob.insert(indexBlob.end(), compressedIndices.begin(), compressedIndices.end());
+}
+
+inline void bmfWritePadding(std::ofstream& output, uint64_t& offset) {
+	static const char zeros[BMF_ALIGNMENT] = {};
+	uint64_t aligned = bmfAlign(offset);
+	output.write(zeros, aligned - offset);
+	offset = aligned;
+}
+
+inline bool bmfWriteVersion2(const char* filename, const std::vector<BmfMeshData>& meshes) {
+	std::ofstream output(filename, std::ios::out | std::ios::binary);
+	if (!output.is_open()) {
+		return false;
+	}
+
+	BmfHeader header = {};
+	header.magic = BMF_MAGIC;
+	header.version = BMF_VERSION;
+	header.numMeshes = (uint32_t)meshes.size();
+	header.meshTableOffset = sizeof(BmfHeader);
+	for (const BmfMeshData& mesh : meshes) {
+		if (mesh.numMeshlets) {
+			header.flags |= BMF_FLAG_MESHLETS;
+		}
+	}
+
+	std::vector<BmfMeshEntry> entries(meshes.size());
+	std::vector<BmfMeshletRange> meshletRanges(header.flags & BMF_FLAG_MESHLETS ? meshes.size() : 0);
+	std::vector<const void*> vertexBlobs(meshes.size());
+	std::vector<const void*> indexBlobs(meshes.size());
+	std::vector<std::vector<uint8_t>> encodedVertices(meshes.size());
+	std::vector<std::vector<uint8_t>> encodedIndices(meshes.size());
+	uint64_t offset = bmfAlign(header.meshTableOffset + entries.size() * sizeof(BmfMeshEntry) + meshletRanges.size() * sizeof(BmfMeshletRange));
+	for (size_t i = 0; i < meshes.size(); i++) {
+		const BmfMeshData& mesh = meshes[i];
+		BmfMeshEntry& entry = entries[i];
+		entry.material = mesh.material;
+		entry.vertexFormat = mesh.vertexFormat;
+		entry.vertexStride = mesh.vertexStride;
+		entry.numVertices = mesh.numVertices;
+		entry.numIndices = mesh.numIndices;
+		entry.indexElementSize = mesh.indexElementSize;
+		entry.compression = mesh.compression;
+		entry.numLods = std::min(mesh.numLods, (uint32_t)BMF_MAX_LODS);
+		memcpy(entry.lodNumIndices, mesh.lodNumIndices, sizeof(entry.lodNumIndices));
+		memcpy(entry.lodErrors, mesh.lodErrors, sizeof(entry.lodErrors));
+		vertexBlobs[i] = mesh.vertices;
+		indexBlobs[i] = mesh.indices;
+		entry.vertexSize = mesh.numVertices * mesh.vertexStride;
+		entry.indexSize = bmfTotalIndices(entry) * mesh.indexElementSize;
+		if (mesh.compression != BMF_COMPRESSION_NONE) {
+			bmfEncodeMesh(mesh, bmfTotalIndices(entry), encodedVertices[i], encodedIndices[i]);
+			vertexBlobs[i] = encodedVertices[i].data();
+			indexBlobs[i] = encodedIndices[i].data();
+			entry.vertexSize = encodedVertices[i].size();
+			entry.indexSize = encodedIndices[i].size();
+		}
+		entry.vertexOffset = offset;
+		entry.indexOffset = bmfAlign(entry.vertexOffset + entry.vertexSize);
+		memcpy(entry.boundsMin, mesh.boundsMin, sizeof(entry.boundsMin));
+		memcpy(entry.boundsMax, mesh.boundsMax, sizeof(entry.boundsMax));
+		offset = bmfAlign(entry.indexOffset + entry.indexSize);
+		if (!meshletRanges.empty()) {
+			meshletRanges[i].offset = offset;
+			meshletRanges[i].numMeshlets = mesh.numMeshlets;
+			offset = bmfAlign(offset + (uint64_t)mesh.numMeshlets * sizeof(BmfMeshlet));
+		}
+	}
+	header.fileSize = offset;
+
+	offset = 0;
+	output.write((char*)&header, sizeof(BmfHeader));
+	output.write((char*)entries.data(), entries.size() * sizeof(BmfMeshEntry));
+	output.write((char*)meshletRanges.data(), meshletRanges.size() * sizeof(BmfMeshletRange));
+	offset += sizeof(BmfHeader) + entries.size() * sizeof(BmfMeshEntry) + meshletRanges.size() * sizeof(BmfMeshletRange);
+	for (size_t i = 0; i < meshes.size(); i++) {
+		bmfWritePadding(output, offset);
+		output.write((char*)vertexBlobs[i], entries[i].vertexSize);
+		offset += entries[i].vertexSize;
+		bmfWritePadding(output, offset);
+		output.write((char*)indexBlobs[i], entries[i].indexSize);
+		offset += entries[i].indexSize;
+		if (!meshletRanges.empty()) {
+			bmfWritePadding(output, offset);
+			output.write((char*)meshes[i].meshlets, meshletRanges[i].numMeshlets * sizeof(BmfMeshlet));
+			offset += meshletRanges[i].numMeshlets * sizeof(BmfMeshlet);
+		}
+	}
+	bmfWritePadding(output, offset);
+	return output.good();
+}
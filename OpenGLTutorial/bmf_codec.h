@@ -0,0 +1,278 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BMF_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+// Geometry compression used by bmf files.
+//
+// Vertices are byte transposed: byte k of every vertex is stored in stream k, and each stream stores the
+// difference to the previous vertex's byte. Neighbouring vertices are similar after the exporter's
+// vertex fetch optimisation, so most of the streams end up as runs of small values.
+// Indices are stored as zigzag encoded differences to the previous index in LEB128 varints.
+// Both can additionally be compressed with LZ4 (block format, compatible with the reference decoder).
+
+inline uint32_t bmfRead32(const uint8_t* data) {
+	uint32_t value;
+	memcpy(&value, data, sizeof(uint32_t));
+	return value;
+}
+
+inline void lz4WriteLength(std::vector<uint8_t>& output, size_t length) {
+	while (length >= 255) {
+		output.push_back(255);
+		length -= 255;
+	}
+	output.push_back((uint8_t)length);
+}
+
+inline void lz4WriteSequence(std::vector<uint8_t>& output, const uint8_t* literals, size_t numLiterals, size_t offset, size_t matchLength) {
+	size_t matchCode = matchLength ? matchLength - 4 : 0;
+	output.push_back((uint8_t)(std::min(numLiterals, (size_t)15) << 4 | std::min(matchCode, (size_t)15)));
+	if (numLiterals >= 15) {
+		lz4WriteLength(output, numLiterals - 15);
+	}
+	output.insert(output.end(), literals, literals + numLiterals);
+	if (matchLength == 0) {
+		return;
+	}
+	output.push_back((uint8_t)(offset & 0xFF));
+	output.push_back((uint8_t)(offset >> 8));
+	if (matchCode >= 15) {
+		lz4WriteLength(output, matchCode - 15);
+	}
+}
+
+// Greedy single hash LZ4 compressor, fast enough for the exporter and good on delta encoded geometry
+inline void lz4Compress(const uint8_t* input, size_t size, std::vector<uint8_t>& output) {
+	const int hashBits = 16;
+	// The format requires the last match to start 12 bytes and end 5 bytes before the end of the input
+	const size_t matchLimit = 12;
+	const size_t lastLiterals = 5;
+
+	output.clear();
+	output.reserve(size + size / 255 + 16);
+	std::vector<uint32_t> table((size_t)1 << hashBits, 0);
+	size_t anchor = 0;
+	size_t position = 0;
+	size_t misses = 0;
+	while (size > matchLimit && position < size - matchLimit) {
+		uint32_t sequence = bmfRead32(input + position);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t)position;
+		if (candidate >= position || position - candidate > 0xFFFF || bmfRead32(input + candidate) != sequence) {
+			// Skip faster through data that does not compress
+			position += 1 + (misses++ >> 6);
+			continue;
+		}
+		misses = 0;
+		size_t matchLength = 4;
+		size_t maxMatchLength = size - lastLiterals - position;
+		while (matchLength < maxMatchLength && input[candidate + matchLength] == input[position + matchLength]) {
+			matchLength++;
+		}
+		lz4WriteSequence(output, input + anchor, position - anchor, position - candidate, matchLength);
+		position += matchLength;
+		anchor = position;
+	}
+	lz4WriteSequence(output, input + anchor, size - anchor, 0, 0);
+}
+
+inline bool lz4ReadLength(const uint8_t*& input, const uint8_t* end, size_t& length) {
+	uint8_t value;
+	do {
+		if (input == end) {
+			return false;
+		}
+		value = *input++;
+		length += value;
+	} while (value == 255);
+	return true;
+}
+
+// Decompresses exactly outputSize bytes, returns false for malformed input
+inline bool lz4Decompress(const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize) {
+	const uint8_t* end = input + inputSize;
+	uint8_t* out = output;
+	uint8_t* outEnd = output + outputSize;
+	while (input < end) {
+		uint8_t token = *input++;
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !lz4ReadLength(input, end, numLiterals)) {
+			return false;
+		}
+		if (numLiterals > (size_t)(end - input) || numLiterals > (size_t)(outEnd - out)) {
+			return false;
+		}
+		memcpy(out, input, numLiterals);
+		out += numLiterals;
+		input += numLiterals;
+		if (input == end) {
+			break;
+		}
+
+		if (end - input < 2) {
+			return false;
+		}
+		size_t offset = input[0] | (size_t)input[1] << 8;
+		input += 2;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !lz4ReadLength(input, end, matchLength)) {
+			return false;
+		}
+		matchLength += 4;
+		if (offset == 0 || offset > (size_t)(out - output) || matchLength > (size_t)(outEnd - out)) {
+			return false;
+		}
+		const uint8_t* match = out - offset;
+		if (offset >= matchLength) {
+			memcpy(out, match, matchLength);
+			out += matchLength;
+			continue;
+		}
+		// Overlapping match repeats the last offset bytes, copy in chunks that double every step
+		size_t copied = 0;
+		size_t chunk = offset;
+		while (copied < matchLength) {
+			size_t count = std::min(chunk, matchLength - copied);
+			memcpy(out + copied, match, count);
+			copied += count;
+			chunk *= 2;
+		}
+		out += matchLength;
+	}
+	return out == outEnd;
+}
+
+inline void bmfEncodeVertices(const uint8_t* vertices, size_t numVertices, size_t stride, std::vector<uint8_t>& encoded) {
+	encoded.resize(numVertices * stride);
+	for (size_t k = 0; k < stride; k++) {
+		uint8_t* stream = encoded.data() + k * numVertices;
+		uint8_t previous = 0;
+		for (size_t v = 0; v < numVertices; v++) {
+			uint8_t value = vertices[v * stride + k];
+			stream[v] = (uint8_t)(value - previous);
+			previous = value;
+		}
+	}
+}
+
+#ifdef BMF_CODEC_SSE2
+// Prefix sum over the 16 bytes plus the carry of the previous block
+inline __m128i bmfPrefixSum16(__m128i value, __m128i carry) {
+	value = _mm_add_epi8(value, _mm_slli_si128(value, 1));
+	value = _mm_add_epi8(value, _mm_slli_si128(value, 2));
+	value = _mm_add_epi8(value, _mm_slli_si128(value, 4));
+	value = _mm_add_epi8(value, _mm_slli_si128(value, 8));
+	return _mm_add_epi8(value, carry);
+}
+
+// Broadcasts byte 15 to all bytes
+inline __m128i bmfBroadcastLastByte(__m128i value) {
+	__m128i high = _mm_unpackhi_epi8(value, value);
+	return _mm_shuffle_epi32(_mm_shufflehi_epi16(high, 0xFF), 0xFF);
+}
+#endif
+
+inline void bmfDecodeVertices(const uint8_t* encoded, size_t numVertices, size_t stride, uint8_t* vertices) {
+	size_t v = 0;
+#ifdef BMF_CODEC_SSE2
+	if (stride % 4 == 0 && stride <= 64) {
+		// Four streams at a time are summed up and interleaved back into one 32 bit word per vertex.
+		// Blocks of 16 vertices are finished completely before moving on so the output is written only once.
+		size_t blockEnd = numVertices & ~(size_t)15;
+		__m128i carries[64];
+		for (size_t k = 0; k < stride; k++) {
+			carries[k] = _mm_setzero_si128();
+		}
+		for (size_t block = 0; block < blockEnd; block += 16) {
+			uint8_t* destination = vertices + block * stride;
+			for (size_t k = 0; k < stride; k += 4) {
+				const uint8_t* streams = encoded + k * numVertices + block;
+				__m128i s0 = bmfPrefixSum16(_mm_loadu_si128((const __m128i*)(streams)), carries[k]);
+				__m128i s1 = bmfPrefixSum16(_mm_loadu_si128((const __m128i*)(streams + numVertices)), carries[k + 1]);
+				__m128i s2 = bmfPrefixSum16(_mm_loadu_si128((const __m128i*)(streams + 2 * numVertices)), carries[k + 2]);
+				__m128i s3 = bmfPrefixSum16(_mm_loadu_si128((const __m128i*)(streams + 3 * numVertices)), carries[k + 3]);
+				carries[k] = bmfBroadcastLastByte(s0);
+				carries[k + 1] = bmfBroadcastLastByte(s1);
+				carries[k + 2] = bmfBroadcastLastByte(s2);
+				carries[k + 3] = bmfBroadcastLastByte(s3);
+
+				__m128i s01Low = _mm_unpacklo_epi8(s0, s1);
+				__m128i s01High = _mm_unpackhi_epi8(s0, s1);
+				__m128i s23Low = _mm_unpacklo_epi8(s2, s3);
+				__m128i s23High = _mm_unpackhi_epi8(s2, s3);
+				uint32_t words[16];
+				_mm_storeu_si128((__m128i*)(words + 0), _mm_unpacklo_epi16(s01Low, s23Low));
+				_mm_storeu_si128((__m128i*)(words + 4), _mm_unpackhi_epi16(s01Low, s23Low));
+				_mm_storeu_si128((__m128i*)(words + 8), _mm_unpacklo_epi16(s01High, s23High));
+				_mm_storeu_si128((__m128i*)(words + 12), _mm_unpackhi_epi16(s01High, s23High));
+				for (int i = 0; i < 16; i++) {
+					memcpy(destination + i * stride + k, &words[i], sizeof(uint32_t));
+				}
+			}
+		}
+		v = blockEnd;
+	}
+#endif
+	for (size_t k = 0; k < stride; k++) {
+		const uint8_t* stream = encoded + k * numVertices;
+		uint8_t value = v ? vertices[(v - 1) * stride + k] : 0;
+		for (size_t i = v; i < numVertices; i++) {
+			value = (uint8_t)(value + stream[i]);
+			vertices[i * stride + k] = value;
+		}
+	}
+}
+
+inline void bmfEncodeIndices(const uint8_t* indices, size_t numIndices, uint32_t elementSize, std::vector<uint8_t>& encoded) {
+	encoded.clear();
+	encoded.reserve(numIndices * 2);
+	uint32_t previous = 0;
+	for (size_t i = 0; i < numIndices; i++) {
+		uint32_t index = 0;
+		memcpy(&index, indices + i * elementSize, elementSize);
+		int32_t delta = (int32_t)(index - previous);
+		uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		while (zigzag >= 0x80) {
+			encoded.push_back((uint8_t)(zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		encoded.push_back((uint8_t)zigzag);
+		previous = index;
+	}
+}
+
+inline bool bmfDecodeIndices(const uint8_t* encoded, size_t encodedSize, size_t numIndices, uint32_t elementSize, uint8_t* indices) {
+	const uint8_t* end = encoded + encodedSize;
+	uint32_t previous = 0;
+	for (size_t i = 0; i < numIndices; i++) {
+		uint32_t zigzag = 0;
+		uint32_t shift = 0;
+		uint8_t byte;
+		do {
+			if (encoded == end || shift > 28) {
+				return false;
+			}
+			byte = *encoded++;
+			zigzag |= (uint32_t)(byte & 0x7F) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		uint32_t index = previous + ((zigzag >> 1) ^ (0u - (zigzag & 1)));
+		if (elementSize == sizeof(uint16_t)) {
+			uint16_t narrow = (uint16_t)index;
+			memcpy(indices + i * sizeof(uint16_t), &narrow, sizeof(uint16_t));
+		}
+		else {
+			memcpy(indices + i * sizeof(uint32_t), &index, sizeof(uint32_t));
+		}
+		previous = index;
+	}
+	return true;
+}
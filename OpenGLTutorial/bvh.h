@@ -0,0 +1,587 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "mesh.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+// Bins per axis the SAH builder evaluates split positions at
+#define BVH_BINS 16
+// Largest leaf the builder creates unless the primitives cannot be split
+#define BVH_MAX_LEAF_SIZE 4
+// Subtrees with fewer primitives than this are built on the thread that reached them
+#define BVH_PARALLEL_THRESHOLD 16384
+// Nodes at this depth become leaves, bounds the traversal stack
+#define BVH_MAX_DEPTH 64
+
+struct Ray {
+	Ray() {
+	}
+	Ray(const glm::vec3& origin, const glm::vec3& direction, float tMax = FLT_MAX) {
+		this->origin = origin;
+		this->direction = direction;
+		this->tMax = tMax;
+	}
+
+	glm::vec3 origin = glm::vec3(0.0f);
+	// Not necessarily normalized, hit distances are in multiples of it
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	float tMax = FLT_MAX;
+};
+
+// The ray through a pixel, from the near to the far plane of the camera whose projection * view matrix is given
+inline Ray rayFromScreen(const glm::mat4& viewProj, float x, float y, float width, float height) {
+	glm::mat4 inverse = glm::inverse(viewProj);
+	float ndcX = x / width * 2.0f - 1.0f;
+	float ndcY = 1.0f - y / height * 2.0f;
+	glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	return Ray(origin, glm::vec3(farPoint) / farPoint.w - origin, 1.0f);
+}
+
+// 32 bytes, two nodes share a cache line. Children of a node are always stored next to each other.
+struct BvhNode {
+	float boundsMin[3];
+	// First child for inner nodes, first primitive for leaves
+	uint32_t leftOrFirst;
+	float boundsMax[3];
+	// Number of primitives, 0 for inner nodes
+	uint32_t count;
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay 32 bytes");
+
+// Ray with precomputed reciprocal direction for slab tests
+struct BvhRay {
+	BvhRay(const Ray& ray) {
+		origin = ray.origin;
+		direction = ray.direction;
+		invDirection = 1.0f / ray.direction;
+#ifdef BVH_SSE
+		origin4 = _mm_set_ps(0.0f, origin.z, origin.y, origin.x);
+		invDirection4 = _mm_set_ps(0.0f, invDirection.z, invDirection.y, invDirection.x);
+#endif
+	}
+
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 invDirection;
+#ifdef BVH_SSE
+	__m128 origin4;
+	__m128 invDirection4;
+#endif
+};
+
+// Entry distance of the ray into the node's box, FLT_MAX if it misses or enters behind tMax
+inline float bvhIntersectNode(const BvhNode& node, const BvhRay& ray, float tMax) {
+#ifdef BVH_SSE
+	// The fourth lane holds leftOrFirst and count, it is never read back
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin), ray.origin4), ray.invDirection4);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax), ray.origin4), ray.invDirection4);
+	__m128 entry3 = _mm_min_ps(t1, t2);
+	__m128 exit3 = _mm_max_ps(t1, t2);
+	__m128 entry = _mm_max_ss(_mm_max_ss(entry3, _mm_shuffle_ps(entry3, entry3, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(entry3, entry3, _MM_SHUFFLE(2, 2, 2, 2)));
+	__m128 exit = _mm_min_ss(_mm_min_ss(exit3, _mm_shuffle_ps(exit3, exit3, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(exit3, exit3, _MM_SHUFFLE(2, 2, 2, 2)));
+	entry = _mm_max_ss(entry, _mm_setzero_ps());
+	exit = _mm_min_ss(exit, _mm_set_ss(tMax));
+	float tEntry = _mm_cvtss_f32(entry);
+	return tEntry <= _mm_cvtss_f32(exit) ? tEntry : FLT_MAX;
+#else
+	glm::vec3 t1 = (glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]) - ray.origin) * ray.invDirection;
+	glm::vec3 t2 = (glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]) - ray.origin) * ray.invDirection;
+	glm::vec3 entry3 = glm::min(t1, t2);
+	glm::vec3 exit3 = glm::max(t1, t2);
+	float tEntry = std::max(std::max(std::max(entry3.x, entry3.y), entry3.z), 0.0f);
+	float tExit = std::min(std::min(std::min(exit3.x, exit3.y), exit3.z), tMax);
+	return tEntry <= tExit ? tEntry : FLT_MAX;
+#endif
+}
+
+// Bounding volume hierarchy over axis aligned boxes, built with the binned surface area heuristic.
+// Knows nothing about the primitives, callers map leaf ranges back through getIndex().
+class Bvh {
+public:
+	// Builds over the given boxes, subtrees are built in parallel on up to numThreads threads
+	void build(const std::vector<glm::vec3>& boxesMin, const std::vector<glm::vec3>& boxesMax, uint32_t numThreads = 1) {
+		uint32_t count = (uint32_t)boxesMin.size();
+		this->boxesMin = &boxesMin;
+		this->boxesMax = &boxesMax;
+		centroids.resize(count);
+		indices.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			centroids[i] = (boxesMin[i] + boxesMax[i]) * 0.5f;
+			indices[i] = i;
+		}
+		nodes.assign(std::max(2 * count, 1u), BvhNode());
+		std::atomic<uint32_t> nodeCount(1);
+		buildNode(0, 0, count, 1, std::max(numThreads, 1u), nodeCount);
+		nodes.resize(nodeCount);
+		std::vector<glm::vec3>().swap(centroids);
+		this->boxesMin = nullptr;
+		this->boxesMax = nullptr;
+	}
+
+	// Calls intersectLeaf(position, tMax) for the primitives of every leaf the ray reaches, nearest leaves first.
+	// position is the primitive's place in the leaf order, getIndex() maps it back to the primitive.
+	// intersectLeaf returns the distance of a closer hit or tMax, leaves behind the closest hit so far are skipped.
+	// Returns the distance of the closest hit or the ray's tMax.
+	template<typename IntersectLeaf>
+	float traverse(const Ray& ray, IntersectLeaf intersectLeaf) const {
+		float tMax = ray.tMax;
+		// Built over nothing, the root is an empty leaf
+		if (nodes.empty() || (nodes[0].count == 0 && nodes[0].leftOrFirst == 0)) {
+			return tMax;
+		}
+		BvhRay bvhRay(ray);
+		if (bvhIntersectNode(nodes[0], bvhRay, tMax) == FLT_MAX) {
+			return tMax;
+		}
+		// Every level pushes at most one node and the builder stops at BVH_MAX_DEPTH
+		uint32_t stack[BVH_MAX_DEPTH];
+		uint32_t stackSize = 0;
+		uint32_t nodeIndex = 0;
+		while (true) {
+			const BvhNode& node = nodes[nodeIndex];
+			if (node.count) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					tMax = intersectLeaf(node.leftOrFirst + i, tMax);
+				}
+			}
+			else {
+				uint32_t first = node.leftOrFirst;
+				uint32_t second = first + 1;
+				float tFirst = bvhIntersectNode(nodes[first], bvhRay, tMax);
+				float tSecond = bvhIntersectNode(nodes[second], bvhRay, tMax);
+				if (tSecond < tFirst) {
+					std::swap(first, second);
+					std::swap(tFirst, tSecond);
+				}
+				if (tFirst != FLT_MAX) {
+					if (tSecond != FLT_MAX) {
+						stack[stackSize++] = second;
+					}
+					nodeIndex = first;
+					continue;
+				}
+			}
+			// Pops until a node that is still in front of the closest hit
+			bool found = false;
+			while (stackSize && !found) {
+				nodeIndex = stack[--stackSize];
+				found = bvhIntersectNode(nodes[nodeIndex], bvhRay, tMax) != FLT_MAX;
+			}
+			if (!found) {
+				return tMax;
+			}
+		}
+	}
+
+	// Calls callback(primitive) for the primitives of every leaf whose box overlaps [boxMin, boxMax]
+	template<typename Callback>
+	void overlap(const glm::vec3& boxMin, const glm::vec3& boxMax, Callback callback) const {
+		if (nodes.empty()) {
+			return;
+		}
+		std::vector<uint32_t> stack(1, 0);
+		while (!stack.empty()) {
+			const BvhNode& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.boundsMin[0] > boxMax.x || node.boundsMin[1] > boxMax.y || node.boundsMin[2] > boxMax.z
+				|| node.boundsMax[0] < boxMin.x || node.boundsMax[1] < boxMin.y || node.boundsMax[2] < boxMin.z) {
+				continue;
+			}
+			if (node.count) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					callback(indices[node.leftOrFirst + i]);
+				}
+			}
+			else {
+				stack.push_back(node.leftOrFirst);
+				stack.push_back(node.leftOrFirst + 1);
+			}
+		}
+	}
+
+	// Primitive at position i of the leaf order
+	uint32_t getIndex(uint32_t i) const {
+		return indices[i];
+	}
+
+	const std::vector<BvhNode>& getNodes() const {
+		return nodes;
+	}
+
+	const std::vector<uint32_t>& getIndices() const {
+		return indices;
+	}
+private:
+	struct Bin {
+		glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+		glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+		uint32_t count = 0;
+	};
+
+	static float area(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+		glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	// Builds the subtree of [first, first + count) into nodes[nodeIndex], numThreads threads may work on it.
+	// Child pairs are allocated from nodeCount.
+	void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth, uint32_t numThreads, std::atomic<uint32_t>& nodeCount) {
+		BvhNode& node = nodes[nodeIndex];
+		glm::vec3 boundsMin(FLT_MAX);
+		glm::vec3 boundsMax(-FLT_MAX);
+		glm::vec3 centroidMin(FLT_MAX);
+		glm::vec3 centroidMax(-FLT_MAX);
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t index = indices[i];
+			boundsMin = glm::min(boundsMin, (*boxesMin)[index]);
+			boundsMax = glm::max(boundsMax, (*boxesMax)[index]);
+			centroidMin = glm::min(centroidMin, centroids[index]);
+			centroidMax = glm::max(centroidMax, centroids[index]);
+		}
+		if (count == 0) {
+			boundsMin = boundsMax = glm::vec3(0.0f);
+		}
+		memcpy(node.boundsMin, &boundsMin, sizeof(node.boundsMin));
+		memcpy(node.boundsMax, &boundsMax, sizeof(node.boundsMax));
+		node.leftOrFirst = first;
+		node.count = count;
+		if (count <= 1 || depth >= BVH_MAX_DEPTH) {
+			return;
+		}
+
+		// Cost of a split relative to the node area, the leaf costs count
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+		float bestCost = FLT_MAX;
+		glm::vec3 extent = centroidMax - centroidMin;
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] <= 0.0f) {
+				continue;
+			}
+			Bin bins[BVH_BINS];
+			float scale = BVH_BINS / extent[axis];
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t index = indices[i];
+				Bin& bin = bins[std::min((uint32_t)((centroids[index][axis] - centroidMin[axis]) * scale), (uint32_t)BVH_BINS - 1)];
+				bin.boundsMin = glm::min(bin.boundsMin, (*boxesMin)[index]);
+				bin.boundsMax = glm::max(bin.boundsMax, (*boxesMax)[index]);
+				bin.count++;
+			}
+			// Sweeps from the right to get the cost of everything right of every split, then from the left
+			float rightCosts[BVH_BINS];
+			Bin right;
+			for (int i = BVH_BINS - 1; i > 0; i--) {
+				right.boundsMin = glm::min(right.boundsMin, bins[i].boundsMin);
+				right.boundsMax = glm::max(right.boundsMax, bins[i].boundsMax);
+				right.count += bins[i].count;
+				rightCosts[i] = right.count ? right.count * area(right.boundsMin, right.boundsMax) : 0.0f;
+			}
+			Bin left;
+			for (int i = 0; i < BVH_BINS - 1; i++) {
+				left.boundsMin = glm::min(left.boundsMin, bins[i].boundsMin);
+				left.boundsMax = glm::max(left.boundsMax, bins[i].boundsMax);
+				left.count += bins[i].count;
+				float cost = (left.count ? left.count * area(left.boundsMin, left.boundsMax) : 0.0f) + rightCosts[i + 1];
+				if (left.count && left.count < count && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i + 1;
+				}
+			}
+		}
+		float nodeArea = area(boundsMin, boundsMax);
+		if (bestAxis < 0 || (count <= BVH_MAX_LEAF_SIZE && bestCost >= count * nodeArea)) {
+			// All centroids are in one place or splitting does not pay off
+			return;
+		}
+
+		float scale = BVH_BINS / extent[bestAxis];
+		uint32_t* middle = std::partition(indices.data() + first, indices.data() + first + count, [&](uint32_t index) {
+			return std::min((uint32_t)((centroids[index][bestAxis] - centroidMin[bestAxis]) * scale), (uint32_t)BVH_BINS - 1) < bestSplit;
+		});
+		uint32_t leftCount = (uint32_t)(middle - (indices.data() + first));
+		uint32_t left = nodeCount.fetch_add(2);
+		node.leftOrFirst = left;
+		node.count = 0;
+		if (numThreads > 1 && count >= BVH_PARALLEL_THRESHOLD) {
+			uint32_t leftThreads = numThreads / 2;
+			std::thread worker(&Bvh::buildNode, this, left, first, leftCount, depth + 1, leftThreads, std::ref(nodeCount));
+			buildNode(left + 1, first + leftCount, count - leftCount, depth + 1, numThreads - leftThreads, nodeCount);
+			worker.join();
+		}
+		else {
+			buildNode(left, first, leftCount, depth + 1, 1, nodeCount);
+			buildNode(left + 1, first + leftCount, count - leftCount, depth + 1, 1, nodeCount);
+		}
+	}
+
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> indices;
+	// Only set during build()
+	const std::vector<glm::vec3>* boxesMin = nullptr;
+	const std::vector<glm::vec3>* boxesMax = nullptr;
+	std::vector<glm::vec3> centroids;
+};
+
+struct MeshHit {
+	// In multiples of the ray direction, tMax of the ray if nothing was hit
+	float t;
+	// Index of the triangle in the mesh's index list, UINT32_MAX if nothing was hit
+	uint32_t triangle = UINT32_MAX;
+	// Barycentric coordinates of the hit on the triangle
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+// Triangles of one mesh with a BVH over them, in model space
+class MeshBvh {
+public:
+	// Builds over the triangles of indices, which index into positions
+	void build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, uint32_t numThreads = 1) {
+		uint32_t numTriangles = (uint32_t)(indices.size() / 3);
+		std::vector<glm::vec3> boxesMin(numTriangles);
+		std::vector<glm::vec3> boxesMax(numTriangles);
+		for (uint32_t i = 0; i < numTriangles; i++) {
+			const glm::vec3& a = positions[indices[i * 3]];
+			const glm::vec3& b = positions[indices[i * 3 + 1]];
+			const glm::vec3& c = positions[indices[i * 3 + 2]];
+			boxesMin[i] = glm::min(glm::min(a, b), c);
+			boxesMax[i] = glm::max(glm::max(a, b), c);
+		}
+		bvh.build(boxesMin, boxesMax, numThreads);
+		// Triangles are stored in leaf order so a leaf reads one contiguous range
+		triangles.resize(numTriangles);
+		for (uint32_t i = 0; i < numTriangles; i++) {
+			uint32_t triangle = bvh.getIndex(i);
+			const glm::vec3& a = positions[indices[triangle * 3]];
+			triangles[i].vertex = a;
+			triangles[i].edge1 = positions[indices[triangle * 3 + 1]] - a;
+			triangles[i].edge2 = positions[indices[triangle * 3 + 2]] - a;
+		}
+	}
+
+	// Closest hit along the ray
+	bool intersect(const Ray& ray, MeshHit& hit) const {
+		hit = MeshHit();
+		hit.t = ray.tMax;
+		bvh.traverse(ray, [&](uint32_t position, float tMax) {
+			float t;
+			float u;
+			float v;
+			if (intersectTriangle(triangles[position], ray, t, u, v) && t < tMax) {
+				hit.t = t;
+				hit.triangle = bvh.getIndex(position);
+				hit.u = u;
+				hit.v = v;
+				return t;
+			}
+			return tMax;
+		});
+		return hit.triangle != UINT32_MAX;
+	}
+
+	// Triangles whose bounds overlap the box, conservative
+	void overlap(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& result) const {
+		bvh.overlap(boxMin, boxMax, [&](uint32_t triangle) {
+			result.push_back(triangle);
+		});
+	}
+
+	// Model space bounds of all triangles
+	glm::vec3 getBoundsMin() const {
+		const BvhNode& root = bvh.getNodes()[0];
+		return glm::vec3(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]);
+	}
+	glm::vec3 getBoundsMax() const {
+		const BvhNode& root = bvh.getNodes()[0];
+		return glm::vec3(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]);
+	}
+
+	uint32_t getNumTriangles() const {
+		return (uint32_t)triangles.size();
+	}
+
+	uint32_t getNumNodes() const {
+		return (uint32_t)bvh.getNodes().size();
+	}
+private:
+	struct Triangle {
+		glm::vec3 vertex;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	// Moeller-Trumbore, both sides of the triangle count as hits
+	static bool intersectTriangle(const Triangle& triangle, const Ray& ray, float& t, float& u, float& v) {
+		glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+		float determinant = glm::dot(triangle.edge1, p);
+		if (std::abs(determinant) < 1e-12f) {
+			return false;
+		}
+		float invDeterminant = 1.0f / determinant;
+		glm::vec3 s = ray.origin - triangle.vertex;
+		u = glm::dot(s, p) * invDeterminant;
+		if (u < 0.0f || u > 1.0f) {
+			return false;
+		}
+		glm::vec3 q = glm::cross(s, triangle.edge1);
+		v = glm::dot(ray.direction, q) * invDeterminant;
+		if (v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+		t = glm::dot(triangle.edge2, q) * invDeterminant;
+		return t >= 0.0f;
+	}
+
+	Bvh bvh;
+	// In leaf order
+	std::vector<Triangle> triangles;
+};
+
+struct SceneHit {
+	float t;
+	// Index the instance was added with, UINT32_MAX if nothing was hit
+	uint32_t instance = UINT32_MAX;
+	uint32_t triangle = UINT32_MAX;
+	glm::vec3 position = glm::vec3(0.0f);
+};
+
+// Top level BVH over placed instances of MeshBvhs, which have to outlive it.
+// Instances move with setTransform() and another build(), which only touches the instances and not their triangles.
+class SceneBvh {
+public:
+	void clear() {
+		instances.clear();
+	}
+
+	// Returns the index the instance is reported with
+	uint32_t add(const MeshBvh* mesh, const glm::mat4& transform) {
+		Instance instance;
+		instance.mesh = mesh;
+		instance.transform = transform;
+		instance.invTransform = glm::inverse(transform);
+		instances.push_back(instance);
+		return (uint32_t)instances.size() - 1;
+	}
+
+	// Takes effect with the next build()
+	void setTransform(uint32_t index, const glm::mat4& transform) {
+		instances[index].transform = transform;
+		instances[index].invTransform = glm::inverse(transform);
+	}
+
+	void build(uint32_t numThreads = 1) {
+		boxesMin.resize(instances.size());
+		boxesMax.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++) {
+			const Instance& instance = instances[i];
+			glm::vec3 localMin = instance.mesh->getBoundsMin();
+			glm::vec3 localMax = instance.mesh->getBoundsMax();
+			glm::vec3 center = glm::vec3(instance.transform * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+			glm::vec3 halfExtents = (localMax - localMin) * 0.5f;
+			glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(instance.transform[0])), glm::abs(glm::vec3(instance.transform[1])), glm::abs(glm::vec3(instance.transform[2])));
+			glm::vec3 extents = absolute * halfExtents;
+			boxesMin[i] = center - extents;
+			boxesMax[i] = center + extents;
+		}
+		bvh.build(boxesMin, boxesMax, numThreads);
+	}
+
+	// Closest hit of the ray with any instance, the ray is in world space
+	bool intersect(const Ray& ray, SceneHit& hit) const {
+		hit = SceneHit();
+		hit.t = ray.tMax;
+		bvh.traverse(ray, [&](uint32_t position, float tMax) {
+			uint32_t index = bvh.getIndex(position);
+			const Instance& instance = instances[index];
+			// The direction is transformed without normalizing, so t stays the same in both spaces
+			Ray localRay(glm::vec3(instance.invTransform * glm::vec4(ray.origin, 1.0f)), glm::vec3(instance.invTransform * glm::vec4(ray.direction, 0.0f)), tMax);
+			MeshHit meshHit;
+			if (instance.mesh->intersect(localRay, meshHit) && meshHit.t < tMax) {
+				hit.t = meshHit.t;
+				hit.instance = index;
+				hit.triangle = meshHit.triangle;
+				return meshHit.t;
+			}
+			return tMax;
+		});
+		if (hit.instance == UINT32_MAX) {
+			return false;
+		}
+		hit.position = ray.origin + ray.direction * hit.t;
+		return true;
+	}
+
+	// Instances whose world space bounds overlap the box
+	void overlap(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& result) const {
+		bvh.overlap(boxMin, boxMax, [&](uint32_t index) {
+			if (boxesMin[index].x <= boxMax.x && boxesMin[index].y <= boxMax.y && boxesMin[index].z <= boxMax.z
+				&& boxesMax[index].x >= boxMin.x && boxesMax[index].y >= boxMin.y && boxesMax[index].z >= boxMin.z) {
+				result.push_back(index);
+			}
+		});
+	}
+
+	uint32_t getNumInstances() const {
+		return (uint32_t)instances.size();
+	}
+private:
+	struct Instance {
+		const MeshBvh* mesh;
+		glm::mat4 transform;
+		glm::mat4 invTransform;
+	};
+
+	Bvh bvh;
+	std::vector<Instance> instances;
+	std::vector<glm::vec3> boxesMin;
+	std::vector<glm::vec3> boxesMax;
+};
+
+// Builds the MeshBvh of one uncompressed bmf mesh, the way ModelLoader stages it. Returns false if an index is out of range.
+inline bool buildMeshBvh(const BmfMeshEntry& entry, const uint8_t* vertices, const uint8_t* indexData, MeshBvh& mesh, uint32_t numThreads = 1) {
+	uint32_t stride = bmfVertexStride(entry.vertexFormat);
+	std::vector<glm::vec3> positions(entry.numVertices);
+	glm::vec3 offset(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+	glm::vec3 scale = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]) - offset;
+	for (uint64_t i = 0; i < entry.numVertices; i++) {
+		if (entry.vertexFormat == BMF_VERTEX_FORMAT_QUANTIZED) {
+			BmfQuantizedVertex vertex;
+			memcpy(&vertex, vertices + i * stride, sizeof(BmfQuantizedVertex));
+			positions[i] = offset + glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) / 65535.0f * scale;
+		}
+		else {
+			memcpy(&positions[i], vertices + i * stride, sizeof(glm::vec3));
+		}
+	}
+	std::vector<uint32_t> indices(entry.numIndices);
+	for (uint64_t i = 0; i < entry.numIndices; i++) {
+		if (entry.indexElementSize == sizeof(uint16_t)) {
+			uint16_t index;
+			memcpy(&index, indexData + i * sizeof(uint16_t), sizeof(uint16_t));
+			indices[i] = index;
+		}
+		else {
+			memcpy(&indices[i], indexData + i * sizeof(uint32_t), sizeof(uint32_t));
+		}
+		if (indices[i] >= entry.numVertices) {
+			return false;
+		}
+	}
+	mesh.build(positions, indices, numThreads);
+	return true;
+}
@@ -21,6 +21,10 @@ public:
 		return view;
 	}
 
+	glm::mat4 getProjection() {
+		return projection;
+	}
+
 	virtual void update() {
 		viewProj = projection * view;
 	}
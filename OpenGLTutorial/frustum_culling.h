@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+
+#if defined(__AVX__)
+#define CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE
+#include <emmintrin.h>
+#endif
+
+// Objects are processed in groups of this many, the widest SIMD width
+#define CULLING_GROUP_SIZE 8
+
+// The six planes of a view frustum, normals point inwards and are normalized
+struct Frustum {
+	// Extracts the planes from a projection * view (* model) matrix, the bounds tested against them are then in the
+	// space the matrix transforms from
+	static Frustum fromViewProj(const glm::mat4& viewProj) {
+		Frustum frustum;
+		glm::vec4 rowX = glm::vec4(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+		glm::vec4 rowY = glm::vec4(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+		glm::vec4 rowZ = glm::vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+		glm::vec4 rowW = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+		frustum.planes[0] = rowW + rowX;
+		frustum.planes[1] = rowW - rowX;
+		frustum.planes[2] = rowW + rowY;
+		frustum.planes[3] = rowW - rowY;
+		frustum.planes[4] = rowW + rowZ;
+		frustum.planes[5] = rowW - rowZ;
+		for (glm::vec4& plane : frustum.planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+
+	glm::vec4 planes[6];
+};
+
+// Bounding boxes and spheres of many objects in structure of arrays layout, so SIMD code loads the same
+// component of several objects at once. Boxes are stored as center and half extents, spheres share the center.
+// The arrays are padded to whole groups, padding objects are empty and never visible.
+struct CullingBounds {
+	void clear() {
+		count = 0;
+		for (std::vector<float>* component : components()) {
+			component->clear();
+		}
+	}
+
+	// Transforms a model space box and sphere radius around the box center to the space of transform and adds them
+	uint32_t add(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float sphereRadius) {
+		glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+		glm::vec3 halfExtents = (boundsMax - boundsMin) * 0.5f;
+		// Extents of the rotated box along every axis, see Arvo, "Transforming Axis-Aligned Bounding Boxes"
+		glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+		glm::vec3 extents = absolute * halfExtents;
+		float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+		if (count % CULLING_GROUP_SIZE == 0) {
+			// Starts a new group, filled with padding objects that are replaced one by one
+			for (std::vector<float>* component : components()) {
+				component->resize(count + CULLING_GROUP_SIZE, 0.0f);
+			}
+			std::fill(radius.begin() + count, radius.end(), -1.0f);
+		}
+		centerX[count] = center.x;
+		centerY[count] = center.y;
+		centerZ[count] = center.z;
+		extentX[count] = extents.x;
+		extentY[count] = extents.y;
+		extentZ[count] = extents.z;
+		radius[count] = sphereRadius * scale;
+		return count++;
+	}
+
+	uint32_t getCount() const {
+		return count;
+	}
+
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> extentX;
+	std::vector<float> extentY;
+	std::vector<float> extentZ;
+	// Negative for padding
+	std::vector<float> radius;
+private:
+	std::vector<std::vector<float>*> components() {
+		return { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius };
+	}
+
+	uint32_t count = 0;
+};
+
+// An object is outside if its box or its sphere is completely behind one of the planes.
+// Both are conservative, so testing against the smaller of the two per plane culls more than either alone.
+// Writes 1 or 0 to visible for every object in [begin, end), both multiples of CULLING_GROUP_SIZE, and returns the number of visible objects.
+inline uint32_t cullBoundsScalar(const Frustum& frustum, const CullingBounds& bounds, uint32_t begin, uint32_t end, uint8_t* visible) {
+	uint32_t numVisible = 0;
+	for (uint32_t i = begin; i < end; i++) {
+		bool inside = bounds.radius[i] >= 0.0f;
+		for (int p = 0; p < 6 && inside; p++) {
+			const glm::vec4& plane = frustum.planes[p];
+			float distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+			float boxRadius = std::abs(plane.x) * bounds.extentX[i] + std::abs(plane.y) * bounds.extentY[i] + std::abs(plane.z) * bounds.extentZ[i];
+			inside = distance + std::min(boxRadius, bounds.radius[i]) >= 0.0f;
+		}
+		visible[i] = inside;
+		numVisible += inside;
+	}
+	return numVisible;
+}
+
+// Same as cullBoundsScalar with 8 objects at a time with AVX or 4 with SSE
+inline uint32_t cullBounds(const Frustum& frustum, const CullingBounds& bounds, uint32_t begin, uint32_t end, uint8_t* visible) {
+#if defined(CULLING_AVX)
+	uint32_t numVisible = 0;
+	__m256 zero = _mm256_setzero_ps();
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	for (uint32_t i = begin; i < end; i += 8) {
+		__m256 centerX = _mm256_loadu_ps(&bounds.centerX[i]);
+		__m256 centerY = _mm256_loadu_ps(&bounds.centerY[i]);
+		__m256 centerZ = _mm256_loadu_ps(&bounds.centerZ[i]);
+		__m256 extentX = _mm256_loadu_ps(&bounds.extentX[i]);
+		__m256 extentY = _mm256_loadu_ps(&bounds.extentY[i]);
+		__m256 extentZ = _mm256_loadu_ps(&bounds.extentZ[i]);
+		__m256 radius = _mm256_loadu_ps(&bounds.radius[i]);
+		__m256 inside = _mm256_cmp_ps(radius, zero, _CMP_GE_OQ);
+		for (int p = 0; p < 6; p++) {
+			__m256 planeX = _mm256_set1_ps(frustum.planes[p].x);
+			__m256 planeY = _mm256_set1_ps(frustum.planes[p].y);
+			__m256 planeZ = _mm256_set1_ps(frustum.planes[p].z);
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX, centerX), _mm256_mul_ps(planeY, centerY)),
+				_mm256_add_ps(_mm256_mul_ps(planeZ, centerZ), _mm256_set1_ps(frustum.planes[p].w)));
+			__m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, planeX), extentX),
+				_mm256_mul_ps(_mm256_andnot_ps(signMask, planeY), extentY)), _mm256_mul_ps(_mm256_andnot_ps(signMask, planeZ), extentZ));
+			__m256 reach = _mm256_add_ps(distance, _mm256_min_ps(boxRadius, radius));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(reach, zero, _CMP_GE_OQ));
+		}
+		int mask = _mm256_movemask_ps(inside);
+		for (int j = 0; j < 8; j++) {
+			visible[i + j] = (uint8_t)(mask >> j & 1);
+			numVisible += mask >> j & 1;
+		}
+	}
+	return numVisible;
+#elif defined(CULLING_SSE)
+	uint32_t numVisible = 0;
+	__m128 zero = _mm_setzero_ps();
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	for (uint32_t i = begin; i < end; i += 4) {
+		__m128 centerX = _mm_loadu_ps(&bounds.centerX[i]);
+		__m128 centerY = _mm_loadu_ps(&bounds.centerY[i]);
+		__m128 centerZ = _mm_loadu_ps(&bounds.centerZ[i]);
+		__m128 extentX = _mm_loadu_ps(&bounds.extentX[i]);
+		__m128 extentY = _mm_loadu_ps(&bounds.extentY[i]);
+		__m128 extentZ = _mm_loadu_ps(&bounds.extentZ[i]);
+		__m128 radius = _mm_loadu_ps(&bounds.radius[i]);
+		__m128 inside = _mm_cmpge_ps(radius, zero);
+		for (int p = 0; p < 6; p++) {
+			__m128 planeX = _mm_set1_ps(frustum.planes[p].x);
+			__m128 planeY = _mm_set1_ps(frustum.planes[p].y);
+			__m128 planeZ = _mm_set1_ps(frustum.planes[p].z);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, centerX), _mm_mul_ps(planeY, centerY)),
+				_mm_add_ps(_mm_mul_ps(planeZ, centerZ), _mm_set1_ps(frustum.planes[p].w)));
+			__m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, planeX), extentX),
+				_mm_mul_ps(_mm_andnot_ps(signMask, planeY), extentY)), _mm_mul_ps(_mm_andnot_ps(signMask, planeZ), extentZ));
+			__m128 reach = _mm_add_ps(distance, _mm_min_ps(boxRadius, radius));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(reach, zero));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int j = 0; j < 4; j++) {
+			visible[i + j] = (uint8_t)(mask >> j & 1);
+			numVisible += mask >> j & 1;
+		}
+	}
+	return numVisible;
+#else
+	return cullBoundsScalar(frustum, bounds, begin, end, visible);
+#endif
+}
+
+// Culls CullingBounds against a frustum, splitting large sets across worker threads.
+// The calling thread takes part in the work, so numThreads = 1 starts no workers.
+class FrustumCuller {
+public:
+	FrustumCuller(uint32_t numThreads = 1, uint32_t minObjectsPerThread = 8192) {
+		this->minObjectsPerThread = std::max(minObjectsPerThread, (uint32_t)CULLING_GROUP_SIZE);
+		for (uint32_t i = 1; i < std::max(numThreads, 1u); i++) {
+			workers.emplace_back(&FrustumCuller::work, this, i);
+		}
+	}
+	virtual ~FrustumCuller() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+	FrustumCuller(const FrustumCuller&) = delete;
+	FrustumCuller& operator=(const FrustumCuller&) = delete;
+
+	// Resizes visible to the number of objects, sets it to 1 for the visible ones and returns how many there are
+	uint32_t cull(const Frustum& frustum, const CullingBounds& bounds, std::vector<uint8_t>& visible) {
+		uint32_t paddedCount = (uint32_t)bounds.radius.size();
+		visible.resize(paddedCount);
+		uint32_t numGroups = paddedCount / CULLING_GROUP_SIZE;
+		uint32_t numThreads = std::min((uint32_t)workers.size() + 1, std::max(paddedCount / minObjectsPerThread, 1u));
+		uint32_t numVisible;
+		if (numThreads == 1) {
+			numVisible = cullBounds(frustum, bounds, 0, paddedCount, visible.data());
+		}
+		else {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job.frustum = &frustum;
+				job.bounds = &bounds;
+				job.visible = visible.data();
+				job.numGroups = numGroups;
+				job.numThreads = numThreads;
+				job.numVisible = 0;
+				job.remaining = numThreads - 1;
+				generation++;
+			}
+			jobAvailable.notify_all();
+			numVisible = cullRange(0);
+			std::unique_lock<std::mutex> lock(mutex);
+			jobDone.wait(lock, [this]() { return job.remaining == 0; });
+			numVisible += job.numVisible;
+		}
+		visible.resize(bounds.getCount());
+		return numVisible;
+	}
+private:
+	struct Job {
+		const Frustum* frustum = nullptr;
+		const CullingBounds* bounds = nullptr;
+		uint8_t* visible = nullptr;
+		uint32_t numGroups = 0;
+		uint32_t numThreads = 0;
+		uint32_t numVisible = 0;
+		// Workers that have not finished their part yet
+		uint32_t remaining = 0;
+	};
+
+	// Culls the part of the current job that belongs to thread index
+	uint32_t cullRange(uint32_t index) {
+		uint32_t beginGroup = (uint32_t)((uint64_t)job.numGroups * index / job.numThreads);
+		uint32_t endGroup = (uint32_t)((uint64_t)job.numGroups * (index + 1) / job.numThreads);
+		return cullBounds(*job.frustum, *job.bounds, beginGroup * CULLING_GROUP_SIZE, endGroup * CULLING_GROUP_SIZE, job.visible);
+	}
+
+	void work(uint32_t index) {
+		uint64_t seenGeneration = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobAvailable.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+				if (stopping) {
+					return;
+				}
+				seenGeneration = generation;
+				if (index >= job.numThreads) {
+					// Not needed for this job
+					continue;
+				}
+			}
+			uint32_t numVisible = cullRange(index);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job.numVisible += numVisible;
+				job.remaining--;
+			}
+			jobDone.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobDone;
+	Job job;
+	uint64_t generation = 0;
+	bool stopping = false;
+	uint32_t minObjectsPerThread;
+};
@@ -0,0 +1,209 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+#include "bmf.h"
+#include "gl_state.h"
+#include "staging_ring.h"
+#include "vertex_buffer.h"
+
+// First fit allocator over [0, capacity) in arbitrary units, neighbouring free ranges are merged again
+struct ArenaFreeList {
+	ArenaFreeList(uint64_t capacity) {
+		ranges[0] = capacity;
+	}
+
+	bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+		size = std::max(size, (uint64_t)1);
+		for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+			uint64_t rangeStart = it->first;
+			uint64_t rangeEnd = it->first + it->second;
+			uint64_t start = (rangeStart + alignment - 1) / alignment * alignment;
+			if (start + size > rangeEnd) {
+				continue;
+			}
+			ranges.erase(it);
+			if (start > rangeStart) {
+				ranges[rangeStart] = start - rangeStart;
+			}
+			if (start + size < rangeEnd) {
+				ranges[start + size] = rangeEnd - start - size;
+			}
+			offset = start;
+			return true;
+		}
+		return false;
+	}
+
+	void free(uint64_t offset, uint64_t size) {
+		size = std::max(size, (uint64_t)1);
+		auto next = ranges.lower_bound(offset);
+		if (next != ranges.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				size += previous->second;
+				ranges.erase(previous);
+			}
+		}
+		if (next != ranges.end() && offset + size == next->first) {
+			size += next->second;
+			ranges.erase(next);
+		}
+		ranges[offset] = size;
+	}
+private:
+	// Offset to size of every free range
+	std::map<uint64_t, uint64_t> ranges;
+};
+
+// One vertex buffer, index buffer and VAO shared by many meshes of the same vertex format
+struct GeometryBlock {
+	GeometryBlock(uint32_t vertexFormat, uint64_t vertexCapacity, uint64_t indexCapacity)
+		: vertexSpace(vertexCapacity), indexSpace(indexCapacity) {
+		this->vertexFormat = vertexFormat;
+		uint64_t vertexBytes = vertexCapacity * bmfVertexStride(vertexFormat);
+
+		glGenVertexArrays(1, &vao);
+		GLState::bindVertexArray(vao);
+		glGenBuffers(1, &vertexBufferId);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+		glGenBuffers(1, &indexBufferId);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferId);
+		if (GLEW_ARB_buffer_storage) {
+			// Dynamic storage keeps glBufferSubData working for uploads without a staging ring
+			glBufferStorage(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+			glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indexCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		else {
+			glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity, nullptr, GL_STATIC_DRAW);
+		}
+		setVertexAttributes(vertexFormat);
+		GLState::bindVertexArray(0);
+	}
+	virtual ~GeometryBlock() {
+		GLState::deleteBuffers(1, &vertexBufferId);
+		GLState::deleteBuffers(1, &indexBufferId);
+		GLState::deleteVertexArrays(1, &vao);
+	}
+	GeometryBlock(const GeometryBlock&) = delete;
+	GeometryBlock& operator=(const GeometryBlock&) = delete;
+
+	void bind() {
+		GLState::bindVertexArray(vao);
+	}
+
+	uint32_t vertexFormat;
+	GLuint vao;
+	GLuint vertexBufferId;
+	GLuint indexBufferId;
+	// In vertices
+	ArenaFreeList vertexSpace;
+	// In bytes
+	ArenaFreeList indexSpace;
+};
+
+// Where a mesh lives inside a GeometryBlock
+struct GeometryAllocation {
+	GeometryBlock* block = nullptr;
+	uint64_t firstVertex = 0;
+	uint64_t numVertices = 0;
+	// Byte offset into the index buffer, as passed to glDrawElementsBaseVertex
+	uint64_t indexOffset = 0;
+	uint64_t indexSize = 0;
+};
+
+// Sub-allocates the geometry of all meshes from a few large blocks per vertex format.
+// Meshes of the same format share a VAO and draw with glDrawElementsBaseVertex, freed space is reused by later loads.
+// Must outlive every mesh allocated from it.
+class GeometryPool {
+public:
+	// Uploads go through staging when given. Meshes larger than a block get a block of their own.
+	GeometryPool(StagingRing* staging = nullptr, uint64_t blockVertexBytes = 32 * 1024 * 1024, uint64_t blockIndexBytes = 16 * 1024 * 1024) {
+		this->staging = staging;
+		this->blockVertexBytes = blockVertexBytes;
+		this->blockIndexBytes = blockIndexBytes;
+	}
+	virtual ~GeometryPool() {
+		for (GeometryBlock* block : blocks) {
+			delete block;
+		}
+	}
+	GeometryPool(const GeometryPool&) = delete;
+	GeometryPool& operator=(const GeometryPool&) = delete;
+
+	// Finds space for the mesh and uploads its uncompressed vertices and the indices of all its levels of detail
+	GeometryAllocation allocate(const BmfMeshEntry& entry, const void* vertices, const void* indices) {
+		GeometryAllocation allocation;
+		uint32_t stride = bmfVertexStride(entry.vertexFormat);
+		uint64_t indexSize = bmfTotalIndices(entry) * entry.indexElementSize;
+		allocation.numVertices = entry.numVertices;
+		allocation.indexSize = indexSize;
+		for (GeometryBlock* block : blocks) {
+			if (block->vertexFormat == entry.vertexFormat && place(block, allocation)) {
+				break;
+			}
+		}
+		if (!allocation.block) {
+			uint64_t vertexCapacity = std::max(blockVertexBytes / stride, entry.numVertices);
+			uint64_t indexCapacity = std::max(blockIndexBytes, indexSize);
+			GeometryBlock* block = new GeometryBlock(entry.vertexFormat, vertexCapacity, indexCapacity);
+			blocks.push_back(block);
+			place(block, allocation);
+		}
+
+		upload(allocation.block->vertexBufferId, allocation.firstVertex * stride, vertices, entry.numVertices * stride);
+		upload(allocation.block->indexBufferId, allocation.indexOffset, indices, indexSize);
+		return allocation;
+	}
+
+	void free(const GeometryAllocation& allocation) {
+		if (!allocation.block) {
+			return;
+		}
+		allocation.block->vertexSpace.free(allocation.firstVertex, allocation.numVertices);
+		allocation.block->indexSpace.free(allocation.indexOffset, allocation.indexSize);
+	}
+
+	uint32_t getNumBlocks() {
+		return (uint32_t)blocks.size();
+	}
+private:
+	bool place(GeometryBlock* block, GeometryAllocation& allocation) {
+		uint64_t firstVertex;
+		uint64_t indexOffset;
+		if (!block->vertexSpace.allocate(allocation.numVertices, 1, firstVertex)) {
+			return false;
+		}
+		// 4 byte alignment is valid for 16 and 32 bit indices
+		if (!block->indexSpace.allocate(allocation.indexSize, sizeof(uint32_t), indexOffset)) {
+			block->vertexSpace.free(firstVertex, allocation.numVertices);
+			return false;
+		}
+		allocation.block = block;
+		allocation.firstVertex = firstVertex;
+		allocation.indexOffset = indexOffset;
+		return true;
+	}
+
+	void upload(GLuint buffer, uint64_t offset, const void* data, uint64_t size) {
+		if (size == 0) {
+			return;
+		}
+		if (staging) {
+			staging->upload(buffer, offset, data, size);
+			return;
+		}
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	std::vector<GeometryBlock*> blocks;
+	StagingRing* staging;
+	uint64_t blockVertexBytes;
+	uint64_t blockIndexBytes;
+};
@@ -0,0 +1,302 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+
+// Set to 0 to compile the cache out, every call then goes straight to GL
+#ifndef GL_STATE_CACHE
+#define GL_STATE_CACHE 1
+#endif
+
+struct GLStateCounters {
+	// Calls that reached the driver
+	uint32_t issued = 0;
+	// Calls dropped because the state was already set
+	uint32_t skipped = 0;
+};
+
+// Shadow copy of the bindings and capabilities the renderer changes, so redundant calls never reach the driver.
+// All binds and deletes of the objects it tracks have to go through it, after foreign GL code call invalidate().
+// Only used on the thread that owns the OpenGL context.
+class GLState {
+public:
+	static void bindVertexArray(GLuint vao) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (state.vertexArray == vao) {
+			state.counters.skipped++;
+			return;
+		}
+		state.vertexArray = vao;
+		// The element array binding belongs to the VAO
+		state.buffers[ELEMENT_ARRAY_SLOT] = UNKNOWN;
+		state.counters.issued++;
+#endif
+		glBindVertexArray(vao);
+	}
+
+	static void useProgram(GLuint program) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (state.program == program) {
+			state.counters.skipped++;
+			return;
+		}
+		state.program = program;
+		state.counters.issued++;
+#endif
+		glUseProgram(program);
+	}
+
+	static void bindBuffer(GLenum target, GLuint buffer) {
+#if GL_STATE_CACHE
+		State& state = get();
+		int slot = bufferSlot(target);
+		if (slot >= 0) {
+			if (state.buffers[slot] == buffer) {
+				state.counters.skipped++;
+				return;
+			}
+			state.buffers[slot] = buffer;
+		}
+		state.counters.issued++;
+#endif
+		glBindBuffer(target, buffer);
+	}
+
+	// Only the first uniform buffer binding points are tracked, other targets and indices are passed through.
+	// Every user of a tracked binding point has to bind through here, the binding is shared by all of them.
+	static void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS) {
+			IndexedBinding& binding = state.uniformBindings[index];
+			if (binding.buffer == buffer && binding.offset == offset && binding.size == size) {
+				state.counters.skipped++;
+				return;
+			}
+			binding.buffer = buffer;
+			binding.offset = offset;
+			binding.size = size;
+		}
+		state.counters.issued++;
+#endif
+		glBindBufferRange(target, index, buffer, offset, size);
+	}
+
+	static void activeTexture(GLenum unit) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (state.activeUnit == unit - GL_TEXTURE0) {
+			state.counters.skipped++;
+			return;
+		}
+		state.activeUnit = unit - GL_TEXTURE0;
+		state.counters.issued++;
+#endif
+		glActiveTexture(unit);
+	}
+
+	// Only GL_TEXTURE_2D is tracked, other targets are passed through
+	static void bindTexture(GLenum target, GLuint texture) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (target == GL_TEXTURE_2D && state.activeUnit < MAX_TEXTURE_UNITS) {
+			if (state.textures[state.activeUnit] == texture) {
+				state.counters.skipped++;
+				return;
+			}
+			state.textures[state.activeUnit] = texture;
+		}
+		state.counters.issued++;
+#endif
+		glBindTexture(target, texture);
+	}
+
+	static void enable(GLenum capability) {
+		setCapability(capability, true);
+	}
+
+	static void disable(GLenum capability) {
+		setCapability(capability, false);
+	}
+
+	// Deleting an object unbinds it, the cache has to forget it or a new object with the same name would be skipped
+	static void deleteBuffers(GLsizei count, const GLuint* buffers) {
+#if GL_STATE_CACHE
+		State& state = get();
+		for (GLsizei i = 0; i < count; i++) {
+			for (GLuint& bound : state.buffers) {
+				if (bound == buffers[i]) {
+					bound = UNKNOWN;
+				}
+			}
+			for (IndexedBinding& binding : state.uniformBindings) {
+				if (binding.buffer == buffers[i]) {
+					binding.buffer = UNKNOWN;
+				}
+			}
+		}
+#endif
+		glDeleteBuffers(count, buffers);
+	}
+
+	static void deleteVertexArrays(GLsizei count, const GLuint* vaos) {
+#if GL_STATE_CACHE
+		State& state = get();
+		for (GLsizei i = 0; i < count; i++) {
+			if (state.vertexArray == vaos[i]) {
+				state.vertexArray = UNKNOWN;
+				state.buffers[ELEMENT_ARRAY_SLOT] = UNKNOWN;
+			}
+		}
+#endif
+		glDeleteVertexArrays(count, vaos);
+	}
+
+	static void deleteProgram(GLuint program) {
+#if GL_STATE_CACHE
+		State& state = get();
+		if (state.program == program) {
+			state.program = UNKNOWN;
+		}
+#endif
+		glDeleteProgram(program);
+	}
+
+	static void deleteTextures(GLsizei count, const GLuint* textures) {
+#if GL_STATE_CACHE
+		State& state = get();
+		for (GLsizei i = 0; i < count; i++) {
+			for (GLuint& bound : state.textures) {
+				if (bound == textures[i]) {
+					bound = UNKNOWN;
+				}
+			}
+		}
+#endif
+		glDeleteTextures(count, textures);
+	}
+
+	// Forgets everything, the next call of every kind reaches the driver
+	static void invalidate() {
+#if GL_STATE_CACHE
+		GLStateCounters counters = get().counters;
+		get() = State();
+		get().counters = counters;
+#endif
+	}
+
+	// Returns the counters of the frame and starts counting the next one, always zero when the cache is compiled out
+	static GLStateCounters endFrame() {
+#if GL_STATE_CACHE
+		GLStateCounters counters = get().counters;
+		get().counters = GLStateCounters();
+		return counters;
+#else
+		return GLStateCounters();
+#endif
+	}
+private:
+#if GL_STATE_CACHE
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+	static const uint32_t MAX_TEXTURE_UNITS = 16;
+	static const uint32_t MAX_UNIFORM_BINDINGS = 8;
+	static const int ELEMENT_ARRAY_SLOT = 1;
+	static const int NUM_BUFFER_SLOTS = 6;
+	static const int NUM_CAPABILITIES = 6;
+
+	struct IndexedBinding {
+		GLuint buffer = UNKNOWN;
+		GLintptr offset = 0;
+		GLsizeiptr size = 0;
+	};
+
+	struct State {
+		State() {
+			for (GLuint& buffer : buffers) {
+				buffer = UNKNOWN;
+			}
+			for (GLuint& texture : textures) {
+				texture = UNKNOWN;
+			}
+			for (int& capability : capabilities) {
+				capability = -1;
+			}
+		}
+		GLuint vertexArray = UNKNOWN;
+		GLuint program = UNKNOWN;
+		GLuint buffers[NUM_BUFFER_SLOTS];
+		uint32_t activeUnit = UNKNOWN;
+		GLuint textures[MAX_TEXTURE_UNITS];
+		IndexedBinding uniformBindings[MAX_UNIFORM_BINDINGS];
+		// -1 unknown, 0 disabled, 1 enabled
+		int capabilities[NUM_CAPABILITIES];
+		GLStateCounters counters;
+	};
+
+	static State& get() {
+		static State state;
+		return state;
+	}
+
+	// The generic binding of indexed targets like GL_UNIFORM_BUFFER also changes with glBindBufferBase/Range and is therefore not tracked
+	static int bufferSlot(GLenum target) {
+		switch (target) {
+		case GL_ARRAY_BUFFER:
+			return 0;
+		case GL_ELEMENT_ARRAY_BUFFER:
+			return ELEMENT_ARRAY_SLOT;
+		case GL_COPY_READ_BUFFER:
+			return 2;
+		case GL_COPY_WRITE_BUFFER:
+			return 3;
+		case GL_DRAW_INDIRECT_BUFFER:
+			return 4;
+		case GL_DISPATCH_INDIRECT_BUFFER:
+			return 5;
+		default:
+			return -1;
+		}
+	}
+
+	static int capabilitySlot(GLenum capability) {
+		switch (capability) {
+		case GL_DEPTH_TEST:
+			return 0;
+		case GL_CULL_FACE:
+			return 1;
+		case GL_BLEND:
+			return 2;
+		case GL_SCISSOR_TEST:
+			return 3;
+		case GL_STENCIL_TEST:
+			return 4;
+		case GL_POLYGON_OFFSET_FILL:
+			return 5;
+		default:
+			return -1;
+		}
+	}
+#endif
+
+	static void setCapability(GLenum capability, bool enabled) {
+#if GL_STATE_CACHE
+		State& state = get();
+		int slot = capabilitySlot(capability);
+		if (slot >= 0) {
+			if (state.capabilities[slot] == (int)enabled) {
+				state.counters.skipped++;
+				return;
+			}
+			state.capabilities[slot] = (int)enabled;
+		}
+		state.counters.issued++;
+#endif
+		if (enabled) {
+			glEnable(capability);
+		}
+		else {
+			glDisable(capability);
+		}
+	}
+};
@@ -0,0 +1,49 @@
+#version 430 core
+
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec3 a_normal;
+// Instance and mesh, the base instance of the command points at the records of its mesh
+layout(location = 2) in uvec2 a_drawRecord;
+
+out vec3 v_normal; 
+out vec3 v_positon;
+flat out int v_drawIndex;
+
+// One entry per mesh of the model, see IndirectDrawData
+struct DrawData {
+	vec4 diffuse;
+	vec4 specular;
+	// w holds the shininess
+	vec4 emissive;
+	vec4 positionScale;
+	vec4 positionOffset;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+	DrawData u_draws[];
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+	mat4 u_instances[];
+};
+
+// Inverse transpose of the model matrix of every instance, see InstanceBuffer. Bindings 2 to 8 belong to the
+// culling passes, which run again after a draw.
+layout(std430, binding = 9) readonly buffer NormalMatrixBuffer {
+	mat3 u_normalMatrices[];
+};
+
+uniform mat4 u_view;
+uniform mat4 u_projection;
+
+void main()
+{
+	v_drawIndex = int(a_drawRecord.y);
+	DrawData draw = u_draws[v_drawIndex];
+	mat4 modelView = u_view * u_instances[a_drawRecord.x];
+	vec4 position = modelView * vec4(a_position * draw.positionScale.xyz + draw.positionOffset.xyz, 1.0f);
+	gl_Position = u_projection * position;
+	// The view matrix is a rotation and translation, it is its own inverse transpose
+	v_normal = mat3(u_view) * (u_normalMatrices[a_drawRecord.x] * a_normal);
+	v_positon = vec3(position);
+}
\ No newline at end of file
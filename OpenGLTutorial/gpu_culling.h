@@ -0,0 +1,395 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "shader.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "frustum_culling.h"
+#include "hiz_buffer.h"
+
+// Vertex attribute location of the draw record in gpu_culled.vert, the same location the instance matrix uses
+#define GPU_CULL_RECORD_LOCATION 2
+// Work group size of cull_instances.comp and compact_draws.comp
+#define GPU_CULL_GROUP_SIZE 64
+// Groups per row of a dispatch, a dimension holds at most 65535
+#define GPU_CULL_MAX_GROUPS_X 65535
+
+// Per mesh entry of cull_instances.comp and compact_draws.comp, std430 layout
+struct GpuCullMesh {
+	// xyz center of the model space box, w radius of the bounding sphere around it
+	glm::vec4 centerRadius;
+	glm::vec4 halfExtents;
+	uint32_t count;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t batch;
+	uint32_t batchFirstMesh;
+	uint32_t pad[3];
+};
+
+static_assert(sizeof(GpuCullMesh) == 64, "GpuCullMesh must match the std430 layout of cull_instances.comp");
+
+// Header of the retest buffer of cull_instances.comp, the work group counts double as glDispatchComputeIndirect arguments
+struct GpuCullRetestHeader {
+	uint32_t numGroupsX;
+	uint32_t numGroupsY;
+	uint32_t numGroupsZ;
+	uint32_t numRetests;
+	uint32_t numRecovered;
+	uint32_t pad[3];
+};
+
+// Counts of the last GpuCuller::render(), summed over all meshes of all instances
+struct GpuCullStats {
+	uint32_t drawn = 0;
+	// Rejected by the Hi-Z test against the previous frame and tested again
+	uint32_t retested = 0;
+	// Also rejected by the test against this frame, not drawn
+	uint32_t occluded = 0;
+};
+
+// Frustum culling of all instances of a model on the GPU. cull_instances.comp tests every mesh of every instance
+// and appends the visible instances to a list per mesh, compact_draws.comp then writes one instanced command per
+// mesh with visible instances. The CPU issues two dispatches and one multi draw per geometry block and index type
+// no matter how many instances there are.
+// The commands are consumed with glMultiDrawElementsIndirectCount where GL_ARB_indirect_parameters is available,
+// otherwise the command counts are read back, which waits for the dispatches to finish.
+// Instances are read from the InstanceBuffer, only changed instances cost an upload.
+//
+// With a HiZBuffer the meshes that pass the frustum test are also tested against the pyramid of the previous frame.
+// After the visible ones are drawn the pyramid is rebuilt from this frame's depth and the rejected meshes are tested
+// again, the ones that are visible now are drawn in a second pass. Objects that come into view are therefore
+// drawn in the frame they appear instead of popping in one frame late.
+class GpuCuller {
+public:
+	GpuCuller() : cullShader("cull_instances.comp"), compactShader("compact_draws.comp") {
+		numInstancesLocation = cullShader.getUniformLocation(SHADER_NAME("u_numInstances"));
+		numMeshesLocation = cullShader.getUniformLocation(SHADER_NAME("u_numMeshes"));
+		frustumPlanesLocation = cullShader.getUniformLocation(SHADER_NAME("u_frustumPlanes"));
+		compactNumInstancesLocation = compactShader.getUniformLocation(SHADER_NAME("u_numInstances"));
+		compactNumMeshesLocation = compactShader.getUniformLocation(SHADER_NAME("u_numMeshes"));
+		occlusionLocation = cullShader.getUniformLocation(SHADER_NAME("u_occlusion"));
+		retestLocation = cullShader.getUniformLocation(SHADER_NAME("u_retest"));
+		hiZLocation = cullShader.getUniformLocation(SHADER_NAME("u_hiZ"));
+		hiZViewProjLocation = cullShader.getUniformLocation(SHADER_NAME("u_hiZViewProj"));
+		hiZLevelsLocation = cullShader.getUniformLocation(SHADER_NAME("u_hiZLevels"));
+		firstCommandLocation = compactShader.getUniformLocation(SHADER_NAME("u_firstCommand"));
+		firstCounterLocation = compactShader.getUniformLocation(SHADER_NAME("u_firstCounter"));
+		glGenBuffers(1, &meshBufferId);
+		glGenBuffers(1, &drawDataBufferId);
+		glGenBuffers(1, &commandBufferId);
+		glGenBuffers(1, &drawRecordBufferId);
+		glGenBuffers(1, &counterBufferId);
+		glGenBuffers(1, &instanceCountBufferId);
+		glGenBuffers(1, &drawnCountBufferId);
+		glGenBuffers(1, &retestBufferId);
+		useCountReadback = !GLEW_ARB_indirect_parameters;
+	}
+	virtual ~GpuCuller() {
+		GLState::deleteBuffers(1, &meshBufferId);
+		GLState::deleteBuffers(1, &drawDataBufferId);
+		GLState::deleteBuffers(1, &commandBufferId);
+		GLState::deleteBuffers(1, &drawRecordBufferId);
+		GLState::deleteBuffers(1, &counterBufferId);
+		GLState::deleteBuffers(1, &instanceCountBufferId);
+		GLState::deleteBuffers(1, &drawnCountBufferId);
+		GLState::deleteBuffers(1, &retestBufferId);
+	}
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller& operator=(const GpuCuller&) = delete;
+
+	// Compute shaders, shader storage buffers and base instances are core in OpenGL 4.3
+	static bool isSupported() {
+		return GLEW_VERSION_4_3 != 0;
+	}
+
+	// Reads the command counts back even where glMultiDrawElementsIndirectCount is available
+	void setCountReadback(bool enabled) {
+		useCountReadback = enabled || !GLEW_ARB_indirect_parameters;
+	}
+
+	bool usesCountReadback() {
+		return useCountReadback;
+	}
+
+	// Culls every instance of model and draws the visible ones.
+	// shader has to be gpu_culled.vert with basic_indirect.frag, view and projection are set as its uniforms.
+	// hiZ enables occlusion culling, it is rebuilt from the depth of the bound framebuffer after the first pass.
+	void render(Model& model, InstanceBuffer& instances, Shader* shader, const glm::mat4& view, const glm::mat4& projection, HiZBuffer* hiZ = nullptr) {
+		const std::vector<Mesh*>& meshes = model.getMeshes();
+		uint32_t numInstances = instances.getNumInstances();
+		if (meshes.empty() || numInstances == 0) {
+			return;
+		}
+		if (&model != builtModel || meshes.size() != builtMeshCount || meshes[0]->getMaterials()->getGeneration() != builtMaterialGeneration) {
+			buildMeshes(model);
+		}
+		reserveRecords(numInstances * (uint32_t)meshes.size());
+		instances.upload();
+		bool occlusion = hiZ && hiZ->isValid();
+		cull(instances, numInstances, view, projection, occlusion ? hiZ : nullptr);
+		compact(numInstances, 0);
+		draw(instances, shader, view, projection, 0);
+		if (hiZ) {
+			hiZ->build(projection * view);
+			if (occlusion) {
+				retest(hiZ);
+				compact(numInstances, 1);
+				draw(instances, shader, view, projection, 1);
+			}
+		}
+	}
+
+	// Waits for the GPU
+	GpuCullStats readStats() {
+		GpuCullStats stats;
+		std::vector<uint32_t> instanceCounts(builtMeshCount);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, instanceCountBufferId);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, instanceCounts.size() * sizeof(uint32_t), instanceCounts.data());
+		GpuCullRetestHeader header;
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, retestBufferId);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GpuCullRetestHeader), &header);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+		for (uint32_t count : instanceCounts) {
+			stats.drawn += count;
+		}
+		// Rejections beyond what the retest dispatch can hold are drawn in the first pass
+		stats.retested = std::min(header.numRetests, (uint32_t)GPU_CULL_MAX_GROUPS_X * GPU_CULL_GROUP_SIZE);
+		stats.occluded = stats.retested - header.numRecovered;
+		return stats;
+	}
+private:
+	// Meshes of one geometry block with one index type, their commands go into one multi draw
+	struct Batch {
+		GeometryBlock* block;
+		GLenum indexType;
+		uint32_t firstMesh;
+		uint32_t numMeshes;
+	};
+
+	// Uploads the bounds, draw templates and materials of the meshes, grouped into batches like Model::renderIndirect
+	void buildMeshes(Model& model) {
+		std::vector<Mesh*> sorted = model.getMeshes();
+		std::stable_sort(sorted.begin(), sorted.end(), [](Mesh* a, Mesh* b) {
+			return a->getBlock() != b->getBlock() ? a->getBlock() < b->getBlock() : a->getIndexType() < b->getIndexType();
+		});
+		std::vector<GpuCullMesh> cullMeshes(sorted.size());
+		std::vector<IndirectDrawData> drawData(sorted.size());
+		batches.clear();
+		for (uint32_t i = 0; i < sorted.size(); i++) {
+			Mesh* mesh = sorted[i];
+			if (batches.empty() || batches.back().block != mesh->getBlock() || batches.back().indexType != mesh->getIndexType()) {
+				batches.push_back({ mesh->getBlock(), mesh->getIndexType(), i, 0 });
+			}
+			batches.back().numMeshes++;
+
+			DrawElementsIndirectCommand command;
+			mesh->getIndirect(command, drawData[i]);
+			GpuCullMesh& cullMesh = cullMeshes[i];
+			cullMesh.centerRadius = glm::vec4((mesh->getBoundsMin() + mesh->getBoundsMax()) * 0.5f, mesh->getBoundingRadius());
+			cullMesh.halfExtents = glm::vec4((mesh->getBoundsMax() - mesh->getBoundsMin()) * 0.5f, 0.0f);
+			cullMesh.count = command.count;
+			cullMesh.firstIndex = command.firstIndex;
+			cullMesh.baseVertex = command.baseVertex;
+			cullMesh.batch = (uint32_t)batches.size() - 1;
+			cullMesh.batchFirstMesh = batches.back().firstMesh;
+		}
+
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, meshBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, cullMeshes.size() * sizeof(GpuCullMesh), cullMeshes.data(), GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(IndirectDrawData), drawData.data(), GL_STATIC_DRAW);
+		// Commands and counters for both passes
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * batches.size() * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, instanceCountBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sorted.size() * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, drawnCountBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sorted.size() * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferId);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, 2 * sorted.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		counters.resize(batches.size());
+		builtModel = &model;
+		builtMeshCount = sorted.size();
+		builtMaterialGeneration = sorted[0]->getMaterials()->getGeneration();
+	}
+
+	// Grows the draw record and retest buffers to hold an entry for every mesh of every instance
+	void reserveRecords(uint32_t numRecords) {
+		if (numRecords <= recordCapacity) {
+			return;
+		}
+		recordCapacity = std::max(numRecords, recordCapacity * 2);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawRecordBufferId);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)recordCapacity * 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, retestBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuCullRetestHeader) + (GLsizeiptr)recordCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void bindHiZ(HiZBuffer* hiZ) {
+		GLState::activeTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		GLState::bindTexture(GL_TEXTURE_2D, hiZ->getTextureId());
+		GLState::activeTexture(GL_TEXTURE0);
+		glUniform1i(hiZLocation, HIZ_TEXTURE_UNIT);
+		glUniformMatrix4fv(hiZViewProjLocation, 1, GL_FALSE, &hiZ->getViewProj()[0][0]);
+		glUniform1i(hiZLevelsLocation, (GLint)hiZ->getNumLevels());
+	}
+
+	// Frustum test of all meshes of all instances, with hiZ also the occlusion test against it
+	void cull(InstanceBuffer& instances, uint32_t numInstances, const glm::mat4& view, const glm::mat4& projection, HiZBuffer* hiZ) {
+		Frustum frustum = Frustum::fromViewProj(projection * view);
+		cullShader.bind();
+		glUniform1ui(numInstancesLocation, numInstances);
+		glUniform1ui(numMeshesLocation, (GLuint)builtMeshCount);
+		glUniform4fv(frustumPlanesLocation, 6, (const float*)frustum.planes);
+		glUniform1i(occlusionLocation, hiZ != nullptr);
+		glUniform1i(retestLocation, GL_FALSE);
+		if (hiZ) {
+			bindHiZ(hiZ);
+		}
+
+		// Zeroed on the GPU, nothing is uploaded per frame
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBufferId);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, instanceCountBufferId);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, drawnCountBufferId);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		// The retest dispatch starts with no groups in x and one in y and z
+		const uint32_t one = 1;
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, retestBufferId);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GpuCullRetestHeader), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, sizeof(uint32_t), 2 * sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, &one);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instances.getBufferId());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawRecordBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, counterBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, instanceCountBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, drawnCountBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, retestBufferId);
+
+		uint32_t numGroups = (numInstances * (uint32_t)builtMeshCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE;
+		uint32_t groupsX = std::min(numGroups, (uint32_t)GPU_CULL_MAX_GROUPS_X);
+		glDispatchCompute(groupsX, (numGroups + groupsX - 1) / groupsX, 1);
+		// The instance counts are read by the compaction, the retest list by the retest dispatch
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+
+	// Occlusion test of the meshes the first pass rejected against the pyramid of this frame
+	void retest(HiZBuffer* hiZ) {
+		cullShader.bind();
+		glUniform1i(retestLocation, GL_TRUE);
+		bindHiZ(hiZ);
+		GLState::bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, retestBufferId);
+		glDispatchComputeIndirect(0);
+		GLState::bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Writes the commands of the instances the culling added since the last compaction into the range of pass
+	void compact(uint32_t numInstances, uint32_t pass) {
+		compactShader.bind();
+		glUniform1ui(compactNumInstancesLocation, numInstances);
+		glUniform1ui(compactNumMeshesLocation, (GLuint)builtMeshCount);
+		glUniform1ui(firstCommandLocation, pass * (GLuint)builtMeshCount);
+		glUniform1ui(firstCounterLocation, pass * (GLuint)batches.size());
+		glDispatchCompute(((uint32_t)builtMeshCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+		// Commands, draw records and counts are read by the draw, the counts also by the readback
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+
+	void draw(InstanceBuffer& instances, Shader* shader, const glm::mat4& view, const glm::mat4& projection, uint32_t pass) {
+		if (viewUniform.getShader() != shader) {
+			viewUniform = Uniform<glm::mat4>(shader, SHADER_NAME("u_view"));
+			projectionUniform = Uniform<glm::mat4>(shader, SHADER_NAME("u_projection"));
+		}
+		if (useCountReadback) {
+			readCounters(pass);
+		}
+		shader->bind();
+		viewUniform.set(view);
+		projectionUniform.set(projection);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instances.getBufferId());
+		// The retest and compaction of the second pass still read their buffers at bindings 2 to 8
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, instances.getNormalBufferId());
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferId);
+		if (!useCountReadback) {
+			GLState::bindBuffer(GL_PARAMETER_BUFFER_ARB, counterBufferId);
+		}
+		for (uint32_t i = 0; i < batches.size(); i++) {
+			const Batch& batch = batches[i];
+			if (useCountReadback && counters[i] == 0) {
+				continue;
+			}
+			batch.block->bind();
+			// Instance i of a command reads the record at its base instance + i
+			GLState::bindBuffer(GL_ARRAY_BUFFER, drawRecordBufferId);
+			glEnableVertexAttribArray(GPU_CULL_RECORD_LOCATION);
+			glVertexAttribIPointer(GPU_CULL_RECORD_LOCATION, 2, GL_UNSIGNED_INT, 2 * sizeof(uint32_t), nullptr);
+			glVertexAttribDivisor(GPU_CULL_RECORD_LOCATION, 1);
+			void* firstCommand = (void*)((pass * builtMeshCount + batch.firstMesh) * sizeof(DrawElementsIndirectCommand));
+			if (useCountReadback) {
+				glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, firstCommand, (GLsizei)counters[i], 0);
+			}
+			else {
+				glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, batch.indexType, firstCommand, (GLintptr)((pass * batches.size() + i) * sizeof(uint32_t)), (GLsizei)batch.numMeshes, 0);
+			}
+			// Draws without records must not read the attribute
+			glDisableVertexAttribArray(GPU_CULL_RECORD_LOCATION);
+		}
+		if (!useCountReadback) {
+			GLState::bindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+		}
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	void readCounters(uint32_t pass) {
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, counterBufferId);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, pass * counters.size() * sizeof(uint32_t), counters.size() * sizeof(uint32_t), counters.data());
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	Shader cullShader;
+	Shader compactShader;
+	int numInstancesLocation = -1;
+	int numMeshesLocation = -1;
+	int frustumPlanesLocation = -1;
+	int compactNumInstancesLocation = -1;
+	int compactNumMeshesLocation = -1;
+	int occlusionLocation = -1;
+	int retestLocation = -1;
+	int hiZLocation = -1;
+	int hiZViewProjLocation = -1;
+	int hiZLevelsLocation = -1;
+	int firstCommandLocation = -1;
+	int firstCounterLocation = -1;
+	Uniform<glm::mat4> viewUniform;
+	Uniform<glm::mat4> projectionUniform;
+	bool useCountReadback = false;
+
+	GLuint meshBufferId = 0;
+	GLuint drawDataBufferId = 0;
+	GLuint commandBufferId = 0;
+	GLuint drawRecordBufferId = 0;
+	GLuint counterBufferId = 0;
+	GLuint instanceCountBufferId = 0;
+	GLuint drawnCountBufferId = 0;
+	GLuint retestBufferId = 0;
+	uint32_t recordCapacity = 0;
+
+	std::vector<Batch> batches;
+	std::vector<uint32_t> counters;
+	Model* builtModel = nullptr;
+	size_t builtMeshCount = 0;
+	uint32_t builtMaterialGeneration = 0;
+};
@@ -0,0 +1,322 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "shader.h"
+#include "gl_state.h"
+
+// Texture unit the depth copy and the pyramid are bound to, unit 0 is left to the material textures
+#define HIZ_TEXTURE_UNIT 1
+// Levels larger than this in either dimension are not read back, objects covering few texels are tested at the
+// first level that is
+#define HIZ_CPU_MAX_SIZE 128
+// Work group size of hiz_downsample.comp in each dimension
+#define HIZ_GROUP_SIZE 8
+
+// Screen rectangle and nearest depth of a box projected with the matrix of a Hi-Z pyramid
+struct HiZFootprint {
+	// Inclusive pixel range on level 0
+	glm::ivec2 min;
+	glm::ivec2 max;
+	// Window space depth of the nearest corner
+	float depth;
+};
+
+// Projects a world space box. Returns false when it can not be tested: it crosses the near plane or is off screen.
+inline bool projectHiZFootprint(const glm::mat4& viewProj, const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t width, uint32_t height, HiZFootprint& footprint) {
+	glm::vec3 ndcMin(FLT_MAX);
+	glm::vec3 ndcMax(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec4 clip = viewProj * glm::vec4(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z, 1.0f);
+		if (clip.w <= 1e-5f) {
+			return false;
+		}
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		ndcMin = glm::min(ndcMin, ndc);
+		ndcMax = glm::max(ndcMax, ndc);
+	}
+	if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f) {
+		return false;
+	}
+	glm::vec2 screenMin = (glm::clamp(glm::vec2(ndcMin), -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2((float)width, (float)height);
+	glm::vec2 screenMax = (glm::clamp(glm::vec2(ndcMax), -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2((float)width, (float)height);
+	footprint.min = glm::ivec2(screenMin);
+	footprint.max = glm::min(glm::ivec2(screenMax), glm::ivec2((int)width - 1, (int)height - 1));
+	footprint.depth = ndcMin.z * 0.5f + 0.5f;
+	return true;
+}
+
+// Smallest level on which the footprint spans at most two texels per axis, the same choice cull_instances.comp makes
+inline uint32_t hiZFootprintLevel(const HiZFootprint& footprint) {
+	int size = std::max(footprint.max.x - footprint.min.x, footprint.max.y - footprint.min.y) + 1;
+	uint32_t level = 0;
+	while ((1 << level) < size) {
+		level++;
+	}
+	return level;
+}
+
+// Hierarchical depth buffer. Every texel of a level holds the farthest depth of the texels it covers on the level
+// above, so an object whose nearest depth lies behind the texels under its screen rectangle is hidden.
+// build() copies the depth buffer of the bound read framebuffer and reduces it with hiz_downsample.comp.
+// The pyramid keeps the view projection it was built with, objects are projected with that one, so a pyramid of
+// the previous frame can cull the current one. The CPU copy is read back through a pixel buffer without waiting
+// for the GPU, so it is usually a frame or two older than the pyramid. Needs OpenGL 4.3.
+class HiZBuffer {
+public:
+	HiZBuffer() : downsampleShader("hiz_downsample.comp") {
+		sourceSizeLocation = downsampleShader.getUniformLocation(SHADER_NAME("u_sourceSize"));
+		copyDepthLocation = downsampleShader.getUniformLocation(SHADER_NAME("u_copyDepth"));
+		depthLocation = downsampleShader.getUniformLocation(SHADER_NAME("u_depth"));
+	}
+	virtual ~HiZBuffer() {
+		GLState::deleteTextures(1, &depthTextureId);
+		GLState::deleteTextures(1, &pyramidTextureId);
+		if (readBackBufferId) {
+			GLState::deleteBuffers(1, &readBackBufferId);
+		}
+		if (readBackFence) {
+			glDeleteSync(readBackFence);
+		}
+	}
+	HiZBuffer(const HiZBuffer&) = delete;
+	HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+	static bool isSupported() {
+		return GLEW_VERSION_4_3 != 0;
+	}
+
+	// Size of the depth buffer the pyramid is built from, a new size drops the current pyramid
+	void resize(uint32_t width, uint32_t height) {
+		if (width == this->width && height == this->height) {
+			return;
+		}
+		this->width = width;
+		this->height = height;
+		valid = false;
+		cpuLevels.clear();
+		if (readBackFence) {
+			// The pending copy has the old size
+			glDeleteSync(readBackFence);
+			readBackFence = nullptr;
+		}
+		GLState::deleteTextures(1, &depthTextureId);
+		GLState::deleteTextures(1, &pyramidTextureId);
+		numLevels = 1;
+		while ((std::max(width, height) >> numLevels) > 0) {
+			numLevels++;
+		}
+
+		GLState::activeTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		glGenTextures(1, &depthTextureId);
+		GLState::bindTexture(GL_TEXTURE_2D, depthTextureId);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		glGenTextures(1, &pyramidTextureId);
+		GLState::bindTexture(GL_TEXTURE_2D, pyramidTextureId);
+		glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_R32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLState::activeTexture(GL_TEXTURE0);
+	}
+
+	// Builds the pyramid from the depth the read framebuffer holds now, viewProj is the matrix it was drawn with
+	void build(const glm::mat4& viewProj) {
+		if (!pyramidTextureId) {
+			return;
+		}
+		GLState::activeTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		GLState::bindTexture(GL_TEXTURE_2D, depthTextureId);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+		GLState::activeTexture(GL_TEXTURE0);
+
+		downsampleShader.bind();
+		glUniform1i(depthLocation, HIZ_TEXTURE_UNIT);
+		for (uint32_t level = 0; level < numLevels; level++) {
+			// Level 0 is a copy of the depth buffer, every other level reduces the one above it
+			glm::ivec2 size = getLevelSize(level);
+			glm::ivec2 sourceSize = level == 0 ? size : getLevelSize(level - 1);
+			glUniform1i(copyDepthLocation, level == 0);
+			glUniform2i(sourceSizeLocation, sourceSize.x, sourceSize.y);
+			glBindImageTexture(0, pyramidTextureId, level == 0 ? 0 : level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, pyramidTextureId, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((size.x + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (size.y + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		}
+		// The culling samples the pyramid and the CPU reads it back
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		this->viewProj = viewProj;
+		valid = true;
+		numBuilds++;
+	}
+
+	// Starts copying the levels the CPU test uses of the last build() into the pixel buffer. Does nothing while
+	// the previous copy has not arrived yet, so the GPU never waits for the CPU and the CPU never waits for the GPU.
+	void requestReadBack() {
+		if (!valid || readBackFence) {
+			return;
+		}
+		cpuFirstLevel = 0;
+		while (cpuFirstLevel + 1 < numLevels && (getLevelSize(cpuFirstLevel).x > HIZ_CPU_MAX_SIZE || getLevelSize(cpuFirstLevel).y > HIZ_CPU_MAX_SIZE)) {
+			cpuFirstLevel++;
+		}
+		size_t readBackSize = 0;
+		for (uint32_t level = cpuFirstLevel; level < numLevels; level++) {
+			glm::ivec2 size = getLevelSize(level);
+			readBackSize += size.x * size.y * sizeof(float);
+		}
+		if (!readBackBufferId) {
+			glGenBuffers(1, &readBackBufferId);
+		}
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, readBackBufferId);
+		if (readBackSize != readBackBufferSize) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, readBackSize, nullptr, GL_STREAM_READ);
+			readBackBufferSize = readBackSize;
+		}
+		GLState::activeTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		GLState::bindTexture(GL_TEXTURE_2D, pyramidTextureId);
+		size_t offset = 0;
+		for (uint32_t level = cpuFirstLevel; level < numLevels; level++) {
+			glm::ivec2 size = getLevelSize(level);
+			glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, (void*)offset);
+			offset += size.x * size.y * sizeof(float);
+		}
+		GLState::activeTexture(GL_TEXTURE0);
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readBackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readBackViewProj = viewProj;
+		readBackBuild = numBuilds;
+	}
+
+	// Takes over the copy of requestReadBack once the GPU has written it, returns true if it did.
+	// Call once per frame before testing, it never waits.
+	bool updateReadBack() {
+		if (!readBackFence) {
+			return false;
+		}
+		GLenum status = glClientWaitSync(readBackFence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			return false;
+		}
+		glDeleteSync(readBackFence);
+		readBackFence = nullptr;
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, readBackBufferId);
+		const uint8_t* data = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readBackBufferSize, GL_MAP_READ_BIT);
+		if (data) {
+			cpuLevels.resize(numLevels - cpuFirstLevel);
+			for (uint32_t level = cpuFirstLevel; level < numLevels; level++) {
+				glm::ivec2 size = getLevelSize(level);
+				std::vector<float>& texels = cpuLevels[level - cpuFirstLevel];
+				texels.assign((const float*)data, (const float*)data + size.x * size.y);
+				data += size.x * size.y * sizeof(float);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			cpuViewProj = readBackViewProj;
+			cpuBuild = readBackBuild;
+		}
+		GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return data != nullptr;
+	}
+
+	// Tests a world space box against the read back levels, boxes that can not be tested count as visible.
+	// Boxes are projected with the matrix the read back levels were built with, not the one of the last build().
+	bool isOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+		HiZFootprint footprint;
+		if (cpuLevels.empty() || !projectHiZFootprint(cpuViewProj, boundsMin, boundsMax, width, height, footprint)) {
+			return false;
+		}
+		uint32_t level = std::min(std::max(hiZFootprintLevel(footprint), cpuFirstLevel), numLevels - 1);
+		glm::ivec2 size = getLevelSize(level);
+		const std::vector<float>& texels = cpuLevels[level - cpuFirstLevel];
+		// The last texel of a level also covers the odd texel left over on the level above
+		glm::ivec2 texelMin = glm::min(footprint.min >> (int)level, size - 1);
+		glm::ivec2 texelMax = glm::min(footprint.max >> (int)level, size - 1);
+		for (int y = texelMin.y; y <= texelMax.y; y++) {
+			for (int x = texelMin.x; x <= texelMax.x; x++) {
+				if (footprint.depth <= texels[y * size.x + x]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	glm::ivec2 getLevelSize(uint32_t level) {
+		return glm::ivec2(std::max(width >> level, 1u), std::max(height >> level, 1u));
+	}
+
+	// False until the first build() after a resize
+	bool isValid() {
+		return valid;
+	}
+
+	bool hasReadBack() {
+		return !cpuLevels.empty();
+	}
+
+	GLuint getTextureId() {
+		return pyramidTextureId;
+	}
+
+	uint32_t getNumLevels() {
+		return numLevels;
+	}
+
+	uint32_t getWidth() {
+		return width;
+	}
+
+	uint32_t getHeight() {
+		return height;
+	}
+
+	const glm::mat4& getViewProj() {
+		return viewProj;
+	}
+
+	// Counts every build(), the first one is number 1
+	uint32_t getNumBuilds() {
+		return numBuilds;
+	}
+
+	// Number of the build the read back levels come from, 0 before the first read back arrived
+	uint32_t getReadBackBuild() {
+		return cpuLevels.empty() ? 0 : cpuBuild;
+	}
+
+	// The matrix the read back levels were built with
+	const glm::mat4& getReadBackViewProj() {
+		return cpuViewProj;
+	}
+private:
+	Shader downsampleShader;
+	int sourceSizeLocation = -1;
+	int copyDepthLocation = -1;
+	int depthLocation = -1;
+
+	GLuint depthTextureId = 0;
+	GLuint pyramidTextureId = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t numLevels = 0;
+	glm::mat4 viewProj = glm::mat4(1.0f);
+	bool valid = false;
+	uint32_t numBuilds = 0;
+
+	// Read back levels, starting at cpuFirstLevel
+	std::vector<std::vector<float>> cpuLevels;
+	uint32_t cpuFirstLevel = 0;
+	glm::mat4 cpuViewProj = glm::mat4(1.0f);
+	uint32_t cpuBuild = 0;
+	// Copy in flight, the fence is signaled once it arrived in the pixel buffer
+	GLuint readBackBufferId = 0;
+	size_t readBackBufferSize = 0;
+	GLsync readBackFence = nullptr;
+	glm::mat4 readBackViewProj = glm::mat4(1.0f);
+	uint32_t readBackBuild = 0;
+};
@@ -1,22 +1,31 @@
 #pragma once
 #include <GL/glew.h>
 #include <cstdint>
+#include "staging_ring.h"
+#include "gl_state.h"
 
 struct IndexBuffer {
-	IndexBuffer(void* data, uint32_t numIndices, uint8_t elementSize) {
+	IndexBuffer(const void* data, uint32_t numIndices, uint8_t elementSize, StagingRing* staging = nullptr) {
 
 		glGenBuffers(1, &bufferId);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferId);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * elementSize, data, GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferId);
+		uint64_t size = (uint64_t)numIndices * elementSize;
+		if (staging && staging->isSupported()) {
+			glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, size, nullptr, 0);
+			staging->upload(bufferId, 0, data, size);
+		}
+		else {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+		}
 	}
 	virtual ~IndexBuffer() {
-		glDeleteBuffers(1, &bufferId);
+		GLState::deleteBuffers(1, &bufferId);
 	}
 	void bind() {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferId);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferId);
 	}
 	void unbind() {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 private:
 	GLuint bufferId;
@@ -0,0 +1,117 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "gl_state.h"
+
+// First attribute location of the instance model matrix in basic.vert with INSTANCED, a mat4 takes four locations
+#define INSTANCE_ATTRIBUTE_LOCATION 2
+// First attribute location of the instance normal matrix, a mat3 takes three locations
+#define INSTANCE_NORMAL_ATTRIBUTE_LOCATION 6
+
+// Model matrices of the instances of a model, read by basic.vert with INSTANCED as instanced vertex attributes.
+// Next to them every instance has the inverse transpose of its model matrix for the normals, computed once when
+// the instance is added or changed instead of for every vertex.
+// Changes are uploaded once before the next draw, an unchanged set of instances is never uploaded again.
+class InstanceBuffer {
+public:
+	InstanceBuffer() {
+		glGenBuffers(1, &bufferId);
+		glGenBuffers(1, &normalBufferId);
+	}
+	virtual ~InstanceBuffer() {
+		GLState::deleteBuffers(1, &bufferId);
+		GLState::deleteBuffers(1, &normalBufferId);
+	}
+	InstanceBuffer(const InstanceBuffer&) = delete;
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+	void clear() {
+		transforms.clear();
+		normalMatrices.clear();
+		dirty = true;
+	}
+
+	uint32_t add(const glm::mat4& model) {
+		transforms.push_back(model);
+		normalMatrices.push_back(normalMatrix(model));
+		dirty = true;
+		return (uint32_t)transforms.size() - 1;
+	}
+
+	void set(uint32_t index, const glm::mat4& model) {
+		transforms[index] = model;
+		normalMatrices[index] = normalMatrix(model);
+		dirty = true;
+	}
+
+	uint32_t getNumInstances() {
+		return (uint32_t)transforms.size();
+	}
+
+	// The transforms are tightly packed mat4s, the buffer can also be bound as a shader storage buffer
+	GLuint getBufferId() {
+		return bufferId;
+	}
+
+	// The normal matrices are mat3s with the std430 layout, every column padded to a vec4
+	GLuint getNormalBufferId() {
+		return normalBufferId;
+	}
+
+	// Uploads the transforms if they changed since the last upload
+	void upload() {
+		if (!dirty) {
+			return;
+		}
+		GLsizeiptr size = transforms.size() * sizeof(glm::mat4);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, bufferId);
+		// Orphaning the old storage lets the driver keep it for draws that are still in flight instead of waiting for them
+		glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, transforms.data());
+		GLsizeiptr normalSize = normalMatrices.size() * sizeof(glm::mat3x4);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, normalBufferId);
+		glBufferData(GL_ARRAY_BUFFER, normalSize, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, normalSize, normalMatrices.data());
+		dirty = false;
+	}
+
+	// Points the instance attributes of the bound VAO at this buffer
+	void bindAttributes() {
+		GLState::bindBuffer(GL_ARRAY_BUFFER, bufferId);
+		for (GLuint column = 0; column < 4; column++) {
+			GLuint location = INSTANCE_ATTRIBUTE_LOCATION + column;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(location, 1);
+		}
+		GLState::bindBuffer(GL_ARRAY_BUFFER, normalBufferId);
+		for (GLuint column = 0; column < 3; column++) {
+			GLuint location = INSTANCE_NORMAL_ATTRIBUTE_LOCATION + column;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3x4), (void*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(location, 1);
+		}
+	}
+
+	// Disables the instance attributes of the bound VAO again, so draws without instances do not read them
+	static void unbindAttributes() {
+		for (GLuint column = 0; column < 4; column++) {
+			glDisableVertexAttribArray(INSTANCE_ATTRIBUTE_LOCATION + column);
+		}
+		for (GLuint column = 0; column < 3; column++) {
+			glDisableVertexAttribArray(INSTANCE_NORMAL_ATTRIBUTE_LOCATION + column);
+		}
+	}
+private:
+	static glm::mat3x4 normalMatrix(const glm::mat4& model) {
+		return glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(model))));
+	}
+
+	GLuint bufferId = 0;
+	GLuint normalBufferId = 0;
+	std::vector<glm::mat4> transforms;
+	std::vector<glm::mat3x4> normalMatrices;
+	bool dirty = false;
+};
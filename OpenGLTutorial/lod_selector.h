@@ -0,0 +1,59 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "mesh.h"
+
+// Levels the meshes of one model instance were drawn with last frame, so levels only change once the projected
+// error leaves the hysteresis band
+struct LodState {
+	std::vector<uint8_t> levels;
+};
+
+// Picks levels of detail by projecting their geometric error onto the screen. The coarsest level whose error covers
+// at most thresholdPixels is used. A level only becomes coarser once its error drops below
+// (1 - hysteresis) * thresholdPixels, so objects near the switching distance do not flip between levels every frame.
+class LodSelector {
+public:
+	LodSelector(float thresholdPixels = 1.0f, float hysteresis = 0.25f) : thresholdPixels(thresholdPixels), hysteresis(hysteresis) {
+	}
+
+	// Has to be called whenever the projection or the viewport height changes
+	void setProjection(const glm::mat4& projection, uint32_t viewportHeight) {
+		pixelsPerUnit = projection[1][1] * (float)viewportHeight * 0.5f;
+		perspective = projection[2][3] != 0.0f;
+	}
+
+	void setThreshold(float thresholdPixels) {
+		this->thresholdPixels = thresholdPixels;
+	}
+
+	// Pixels an error of the given size in world units covers at the given view distance
+	float getProjectedError(float error, float distance) {
+		if (!perspective) {
+			return error * pixelsPerUnit;
+		}
+		return distance > 0.0f ? error * pixelsPerUnit / distance : FLT_MAX;
+	}
+
+	// distance is from the camera to the nearest point of the mesh's bounding sphere, scale the largest scale of
+	// its model matrix and current the level it was drawn with last frame
+	uint32_t select(Mesh* mesh, float distance, float scale = 1.0f, uint32_t current = 0) {
+		uint32_t numLods = mesh->getNumLods();
+		uint32_t level = std::min(current, numLods - 1);
+		while (level > 0 && getProjectedError(mesh->getLod(level).error * scale, distance) > thresholdPixels) {
+			level--;
+		}
+		while (level + 1 < numLods && getProjectedError(mesh->getLod(level + 1).error * scale, distance) <= thresholdPixels * (1.0f - hysteresis)) {
+			level++;
+		}
+		return level;
+	}
+private:
+	float thresholdPixels;
+	float hysteresis;
+	float pixelsPerUnit = 1.0f;
+	bool perspective = true;
+};
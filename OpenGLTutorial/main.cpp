@@ -19,8 +19,16 @@
 #include "vertex_buffer.h"
 #include "index_buffer.h"
 #include "shader.h"
+#include "shader_watcher.h"
+#include "shader_variants.h"
+#include "uniform.h"
+#include "gl_state.h"
 #include "mesh.h"
+#include "model_loader.h"
+#include "render_queue.h"
+#include "bvh.h"
 #include "floating_camera.h"
+#include "benchmark.h"
 
 #define MONKEY_FILE "C:\\Users\\Lukas\\source\\repos\\OpenGLTutorial\\models\\monkey.bmf"
 #define TREE_FILE "C:\\Users\\Lukas\\source\\repos\\OpenGLTutorial\\models\\tree01.bmf"
@@ -76,10 +84,17 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 	std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
 
 #ifdef _DEBUG
-	glEnable(GL_DEBUG_OUTPUT);
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	GLState::enable(GL_DEBUG_OUTPUT);
+	GLState::enable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
 	glDebugMessageCallback(openGLDebugCallback, nullptr);
 #endif // _DEBUG
+
+	// Programs are only submitted here and compile in the background while the texture and the model load
+	Shader::enableParallelCompile();
+	Shader shader("basic.vert", "basic.frag", true);
+	// The render queue draws every mesh with the cheapest permutation of basic.vert/frag its material allows
+	ShaderVariants basicVariants("basic.vert", "basic.frag");
+	basicVariants.precompile("basic_variants.txt");
 	
 	int32_t textureWidth = 0;
 	int32_t textureHeight = 0;
@@ -89,24 +104,57 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 	
 	GLuint textureId;
 	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	GLState::bindTexture(GL_TEXTURE_2D, textureId);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, textureWidth, textureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureBuffer);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bindTexture(GL_TEXTURE_2D, 0);
 
 	if (textureBuffer) {
 		stbi_image_free(textureBuffer);
 	}
 
-	Shader shader("basic.vert", "basic.frag");
 	shader.bind();
 
+#ifdef _DEBUG
+	if (argc > 2 && strcmp(argv[1], "--benchmark") == 0) {
+		return runBenchmark(argv[2], &shader);
+	}
+#endif // _DEBUG
+
+	StagingRing stagingRing;
+	GeometryPool geometry(&stagingRing);
+	ModelLoader modelLoader(2, 4 * 1024 * 1024, 64 * 1024 * 1024, &geometry);
+
+	// Draw everything with multi draw indirect where the driver supports it
+	Shader* indirectShader = nullptr;
+	Shader* activeShader = &shader;
+	if (Model::supportsIndirect()) {
+		indirectShader = new Shader("basic_indirect.vert", "basic_indirect.frag", true);
+		activeShader = indirectShader;
+	}
 	Model monkey;
-	monkey.Init(MONKEY_FILE, &shader);
+	// System memory copy of the monkey's triangles for picking, built by the loader from what it decoded
+	std::vector<MeshBvh> monkeyBvhs;
+	modelLoader.load(&monkey, MONKEY_FILE, &shader, &monkeyBvhs);
+	RenderQueue renderQueue;
+	RenderQueueStats queueStats;
+	LodSelector lodSelector;
+	LodState monkeyLods;
+	renderQueue.setLodSelector(&lodSelector);
+	// Occlusion culling of the queue against the depth of the previous frame
+	HiZBuffer* hiZ = nullptr;
+	if (HiZBuffer::isSupported()) {
+		hiZ = new HiZBuffer();
+		renderQueue.setOcclusion(hiZ);
+	}
+	// Built once the monkey is loaded, its transform is only updated when something is picked
+	SceneBvh scene;
+	bool sceneBuilt = false;
+	glm::mat4 sceneTransform;
 	
 	uint64_t perfCounterFrequency = SDL_GetPerformanceFrequency();
 	uint64_t lastCounter = SDL_GetPerformanceCounter() ;
@@ -120,9 +168,17 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 	camera.update();
 
 	glm::mat4 modelViewProj = camera.getViewProj() * model;
-	int modelViewProjMatrixLocation = glGetUniformLocation(shader.getShaderId(), "u_modelViewProj");
-	int modelViewLocation = glGetUniformLocation(shader.getShaderId(), "u_modelView");
-	int invModelViewLocation = glGetUniformLocation(shader.getShaderId(), "u_invModelView");
+	activeShader->bind();
+	Uniform<glm::mat4> modelViewProjUniform(activeShader, SHADER_NAME("u_modelViewProj"));
+	Uniform<glm::mat4> modelViewUniform(activeShader, SHADER_NAME("u_modelView"));
+	Uniform<glm::mat4> invModelViewUniform(activeShader, SHADER_NAME("u_invModelView"));
+	// Rebuilds the programs when their files are saved
+	ShaderWatcher shaderWatcher;
+	shaderWatcher.watch(&shader);
+	if (indirectShader) {
+		shaderWatcher.watch(indirectShader);
+	}
+	basicVariants.setWatcher(&shaderWatcher);
 
 	float time = 0;
 	float cameraSpeed = 6.0f;
@@ -133,8 +189,9 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 	bool buttonD = false;
 	bool buttonSpace = false;
 	bool buttonShift = false;
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
+	bool printFrameStats = false;
+	GLState::enable(GL_CULL_FACE);
+	GLState::enable(GL_DEPTH_TEST);
 	while (!close)
 	{
 		SDL_Event event;
@@ -170,6 +227,9 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 				case SDLK_TAB:
 					SDL_SetRelativeMouseMode(SDL_FALSE);
 					break;
+				case SDLK_F1:
+					printFrameStats = true;
+					break;
 				default:
 					break;
 				}
@@ -206,6 +266,24 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 			}
 			else if (event.type == SDL_MOUSEBUTTONDOWN) {
 				if (event.button.button == SDL_BUTTON_LEFT) {
+					// Picks under the cursor, or in the middle of the screen while the mouse controls the camera
+					int windowWidth;
+					int windowHeight;
+					SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+					float x = SDL_GetRelativeMouseMode() ? windowWidth * 0.5f : (float)event.button.x;
+					float y = SDL_GetRelativeMouseMode() ? windowHeight * 0.5f : (float)event.button.y;
+					if (sceneBuilt && sceneTransform != model) {
+						for (uint32_t i = 0; i < scene.getNumInstances(); i++) {
+							scene.setTransform(i, model);
+						}
+						scene.build();
+						sceneTransform = model;
+					}
+					SceneHit hit;
+					if (sceneBuilt && scene.intersect(rayFromScreen(camera.getViewProj(), x, y, (float)windowWidth, (float)windowHeight), hit)) {
+						std::cout << "Picked mesh " << hit.instance << ", triangle " << hit.triangle << " at "
+							<< hit.position.x << ", " << hit.position.y << ", " << hit.position.z << std::endl;
+					}
 					SDL_SetRelativeMouseMode(SDL_TRUE);
 				}
 			}
@@ -215,6 +293,9 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		time += delta;
 
+		// Uniform handles follow a swapped program by themselves
+		shaderWatcher.update();
+
 		if (buttonW) {
 			camera.moveFront(cameraSpeed * delta);
 		}
@@ -244,19 +325,59 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 		//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		//glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-		if (modelViewLocation != -1) {
-			glUniformMatrix4fv(modelViewLocation, 1, GL_FALSE, &modelView[0][0]);
+		GLState::activeTexture(GL_TEXTURE0);
+		GLState::bindTexture(GL_TEXTURE_2D, textureId);
+		modelLoader.update();
+		if (!sceneBuilt && monkey.isReady()) {
+			for (const MeshBvh& mesh : monkeyBvhs) {
+				scene.add(&mesh, model);
+			}
+			scene.build();
+			sceneTransform = model;
+			sceneBuilt = true;
 		}
-		if (invModelViewLocation != -1) {
-			glUniformMatrix4fv(invModelViewLocation, 1, GL_FALSE, &invModelView[0][0]);
+		if (indirectShader) {
+			modelViewUniform.set(modelView);
+			invModelViewUniform.set(invModelView);
+			modelViewProjUniform.set(modelViewProj);
+			monkey.renderIndirect(indirectShader);
 		}
-		if (modelViewProjMatrixLocation != -1) {
-			glUniformMatrix4fv(modelViewProjMatrixLocation, 1, GL_FALSE, &modelViewProj[0][0]);
+		else {
+			// The queue sets the matrices of every draw itself
+			int drawableWidth;
+			int drawableHeight;
+			SDL_GL_GetDrawableSize(window, &drawableWidth, &drawableHeight);
+			if (hiZ) {
+				hiZ->resize(drawableWidth, drawableHeight);
+			}
+			lodSelector.setProjection(camera.getProjection(), drawableHeight);
+			renderQueue.begin(camera.getView(), camera.getProjection());
+			renderQueue.submit(monkey, &basicVariants, model, RenderPass::Opaque, &monkeyLods);
+			queueStats = renderQueue.execute();
 		}
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-		monkey.render();
 		SDL_GL_SwapWindow(window);
+		StagingStats stagingStats = stagingRing.endFrame();
+		GLStateCounters stateCounters = GLState::endFrame();
+#ifdef _DEBUG
+		if (stagingStats.stalls || stagingStats.wrapWaits) {
+			std::cout << "Staging: " << stagingStats.bytesUploaded << " bytes uploaded, " << stagingStats.stalls << " stalls, "
+				<< stagingStats.wrapWaits << " ring wrap waits" << std::endl;
+		}
+#endif // _DEBUG
+		if (printFrameStats) {
+			std::cout << "GL state: " << stateCounters.issued << " calls issued, " << stateCounters.skipped << " redundant calls skipped" << std::endl;
+			std::cout << "Staging: " << stagingStats.bytesUploaded << " bytes uploaded, " << stagingStats.stalls << " stalls, "
+				<< stagingStats.wrapWaits << " ring wrap waits" << std::endl;
+			if (!indirectShader) {
+				std::cout << "Render queue: " << queueStats.draws << " draws, " << queueStats.triangles << " triangles, " << queueStats.culled << " culled, " << queueStats.programChanges << " program, "
+					<< queueStats.materialChanges << " material and " << queueStats.vertexArrayChanges << " VAO changes" << std::endl;
+				if (hiZ) {
+					std::cout << "Occlusion: " << queueStats.occluded << " occluded, " << queueStats.retested - queueStats.occluded << " of "
+						<< queueStats.retested << " retested draws visible again" << std::endl;
+				}
+			}
+			printFrameStats = false;
+		}
 
 		uint64_t endCounter = SDL_GetPerformanceCounter();
 		uint64_t counterElapse = endCounter - lastCounter;
@@ -266,7 +387,9 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 		lastCounter = endCounter;
 	}
 
-	glDeleteTextures(1, &textureId);
+	GLState::deleteTextures(1, &textureId);
+	delete indirectShader;
+	delete hiZ;
 
 	return 0;
 }
\ No newline at end of file
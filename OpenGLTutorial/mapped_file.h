@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read only memory mapping of a whole file. The data stays valid until the MappedFile is destroyed.
+struct MappedFile {
+	MappedFile(const char* filename) {
+#ifdef _WIN32
+		fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) {
+			std::cout << "File " << filename << " not found" << std::endl;
+			return;
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(fileHandle, &fileSize);
+		size = (uint64_t)fileSize.QuadPart;
+		if (size == 0) {
+			return;
+		}
+		mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mappingHandle == nullptr) {
+			std::cout << "Error mapping file " << filename << std::endl;
+			return;
+		}
+		data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+		fileDescriptor = open(filename, O_RDONLY);
+		if (fileDescriptor == -1) {
+			std::cout << "File " << filename << " not found" << std::endl;
+			return;
+		}
+		struct stat fileStat;
+		fstat(fileDescriptor, &fileStat);
+		size = (uint64_t)fileStat.st_size;
+		if (size == 0) {
+			return;
+		}
+		void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (mapping == MAP_FAILED) {
+			std::cout << "Error mapping file " << filename << std::endl;
+			return;
+		}
+		// The loader walks the file front to back once, so let the kernel read ahead aggressively
+		madvise(mapping, size, MADV_SEQUENTIAL);
+		madvise(mapping, size, MADV_WILLNEED);
+		data = (const uint8_t*)mapping;
+#endif
+	}
+	virtual ~MappedFile() {
+#ifdef _WIN32
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mappingHandle) {
+			CloseHandle(mappingHandle);
+		}
+		if (fileHandle != INVALID_HANDLE_VALUE) {
+			CloseHandle(fileHandle);
+		}
+#else
+		if (data) {
+			munmap((void*)data, size);
+		}
+		if (fileDescriptor != -1) {
+			close(fileDescriptor);
+		}
+#endif
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() {
+		return data != nullptr;
+	}
+	const uint8_t* getData() {
+		return data;
+	}
+	uint64_t getSize() {
+		return size;
+	}
+private:
+	const uint8_t* data = nullptr;
+	uint64_t size = 0;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "gl_state.h"
+
+// Uniform block binding of the Materials block in basic.frag
+#define MATERIAL_BLOCK_BINDING 0
+// Materials in one bound range of the buffer, has to match the array size in basic.frag
+#define MATERIALS_PER_PAGE 256
+
+struct Material
+{
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	glm::vec3 emissive;
+	float shininess;
+};
+
+// std140 layout of a Material in the uniform block
+struct MaterialBlockEntry {
+	glm::vec3 diffuse;
+	float padding0;
+	glm::vec3 specular;
+	float padding1;
+	glm::vec3 emissive;
+	float shininess;
+};
+
+static_assert(sizeof(MaterialBlockEntry) == 48, "MaterialBlockEntry must match the std140 array stride");
+
+// Stores every distinct material once in a uniform buffer, draws refer to them by index.
+// The buffer is split into pages of MATERIALS_PER_PAGE materials because a uniform block can only be 16 KB on some drivers,
+// draws bind the page of their material and set the index inside of it.
+// Changes are uploaded by prepare(), materials that did not change are never uploaded again.
+class MaterialRegistry {
+public:
+	MaterialRegistry() {
+	}
+	virtual ~MaterialRegistry() {
+		if (bufferId) {
+			GLState::deleteBuffers(1, &bufferId);
+		}
+	}
+	MaterialRegistry(const MaterialRegistry&) = delete;
+	MaterialRegistry& operator=(const MaterialRegistry&) = delete;
+
+	// Returns the index of an identical material, or adds it
+	uint32_t add(const Material& material) {
+		MaterialKey key;
+		memcpy(key.data(), &material, sizeof(Material));
+		auto it = indices.find(key);
+		if (it != indices.end()) {
+			return it->second;
+		}
+		uint32_t index = (uint32_t)materials.size();
+		materials.push_back(material);
+		indices[key] = index;
+		markDirty(index);
+		return index;
+	}
+
+	void set(uint32_t index, const Material& material) {
+		MaterialKey oldKey;
+		memcpy(oldKey.data(), &materials[index], sizeof(Material));
+		auto it = indices.find(oldKey);
+		if (it != indices.end() && it->second == index) {
+			indices.erase(it);
+		}
+		materials[index] = material;
+		MaterialKey key;
+		memcpy(key.data(), &material, sizeof(Material));
+		indices.emplace(key, index);
+		markDirty(index);
+	}
+
+	const Material& get(uint32_t index) {
+		return materials[index];
+	}
+
+	// Changes whenever a material was added or changed
+	uint32_t getGeneration() {
+		return generation;
+	}
+
+	// Uploads added and changed materials, call before drawing with them
+	void prepare() {
+		if (dirtyBegin >= dirtyEnd) {
+			return;
+		}
+		uint32_t numPages = ((uint32_t)materials.size() + MATERIALS_PER_PAGE - 1) / MATERIALS_PER_PAGE;
+		if (!bufferId) {
+			glGenBuffers(1, &bufferId);
+		}
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, bufferId);
+		if (numPages > capacityPages) {
+			// Grow to twice the size and upload everything
+			capacityPages = std::max(numPages, capacityPages * 2);
+			glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)capacityPages * MATERIALS_PER_PAGE * sizeof(MaterialBlockEntry), nullptr, GL_DYNAMIC_DRAW);
+			dirtyBegin = 0;
+			dirtyEnd = (uint32_t)materials.size();
+		}
+		std::vector<MaterialBlockEntry> entries(dirtyEnd - dirtyBegin);
+		for (uint32_t i = dirtyBegin; i < dirtyEnd; i++) {
+			const Material& material = materials[i];
+			MaterialBlockEntry& entry = entries[i - dirtyBegin];
+			entry = MaterialBlockEntry();
+			entry.diffuse = material.diffuse;
+			entry.specular = material.specular;
+			entry.emissive = material.emissive;
+			entry.shininess = material.shininess;
+		}
+		glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)dirtyBegin * sizeof(MaterialBlockEntry), entries.size() * sizeof(MaterialBlockEntry), entries.data());
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+		dirtyBegin = UINT32_MAX;
+		dirtyEnd = 0;
+	}
+
+	// Binds the page of the material and returns the material's index inside of it.
+	// GLState skips the bind when the page is already bound, registries share the binding point so this has to
+	// be called again whenever another registry was bound in between.
+	uint32_t bind(uint32_t index) {
+		uint32_t page = index / MATERIALS_PER_PAGE;
+		// The page size in bytes is a multiple of 256, which satisfies every GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+		const GLsizeiptr pageSize = MATERIALS_PER_PAGE * sizeof(MaterialBlockEntry);
+		GLState::bindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, bufferId, page * pageSize, pageSize);
+		return index % MATERIALS_PER_PAGE;
+	}
+private:
+	typedef std::array<float, sizeof(Material) / sizeof(float)> MaterialKey;
+
+	void markDirty(uint32_t index) {
+		dirtyBegin = std::min(dirtyBegin, index);
+		dirtyEnd = std::max(dirtyEnd, index + 1);
+		generation++;
+	}
+
+	std::vector<Material> materials;
+	std::map<MaterialKey, uint32_t> indices;
+	GLuint bufferId = 0;
+	uint32_t capacityPages = 0;
+	uint32_t dirtyBegin = UINT32_MAX;
+	uint32_t dirtyEnd = 0;
+	uint32_t generation = 0;
+};
@@ -1,72 +1,533 @@
 #pragma once
 #include "../dependencies/glm/glm.hpp"
 #include "shader.h"
+#include "uniform.h"
+#include "shader_variants.h"
 #include "vertex_buffer.h"
-#include "index_buffer.h"
+#include "geometry_arena.h"
+#include "material_registry.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "mapped_file.h"
+#include "bmf.h"
+#include <algorithm>
 #include <vector>
+#include <memory>
 #include <fstream>
 #include <iostream>
+#include <cstring>
 
-struct Material
-{
-	glm::vec3 diffuse;
-	glm::vec3 specular;
-	glm::vec3 emissive;
-	float shininess;
+static_assert(sizeof(Material) == sizeof(BmfMaterial), "Material must match the bmf material layout");
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	// In indices, not bytes
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
+// Per draw data read by basic_indirect.vert/frag, std430 layout
+struct IndirectDrawData {
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+	// w holds the shininess
+	glm::vec4 emissive;
+	glm::vec4 positionScale;
+	glm::vec4 positionOffset;
+};
+
+// Uniforms of the shader meshes are drawn with, shared by all meshes of a model instead of looked up per mesh
+struct MeshUniforms {
+	void lookUp(Shader* shader) {
+		materialIndex = Uniform<GLint>(shader, SHADER_NAME("u_materialIndex"));
+		positionScale = Uniform<glm::vec3>(shader, SHADER_NAME("u_positionScale"));
+		positionOffset = Uniform<glm::vec3>(shader, SHADER_NAME("u_positionOffset"));
+	}
+
+	Shader* getShader() {
+		return materialIndex.getShader();
+	}
+
+	Uniform<GLint> materialIndex;
+	Uniform<glm::vec3> positionScale;
+	Uniform<glm::vec3> positionOffset;
+};
+
+// Index range of one level of detail, level 0 is the full mesh
+struct MeshLod {
+	// In indices from the first index of the mesh
+	uint32_t firstIndex;
+	uint32_t numIndices;
+	// Largest distance from the full mesh in model space
+	float error;
 };
 
 class Mesh
 {
 public:
-	Mesh(std::vector<Vertex>& vertices, uint64_t numVertices, std::vector<uint32_t>& indices, uint64_t numIndices, Material material, Shader* shader) {
-		this->material = material;
-		this->shader = shader;
-		this->numIndices = numIndices;
+	// The geometry is placed in a block of the pool and the material in the registry, both have to outlive the mesh
+	Mesh(const BmfMeshEntry& entry, const void* vertices, const void* indices, const BmfMeshlet* meshlets, uint32_t numMeshlets, MeshUniforms* uniforms, GeometryPool* geometry, MaterialRegistry* materials) {
+		Material material;
+		memcpy(&material, &entry.material, sizeof(Material));
+		this->uniforms = uniforms;
+		this->geometry = geometry;
+		this->materials = materials;
+		this->numIndices = entry.numIndices;
+		materialIndex = materials->add(material);
 
-		vertexBuffer = new VertexBuffer(vertices.data(), numVertices);
-		indexBuffer = new IndexBuffer(indices.data(), numIndices, sizeof(uint32_t));
+		allocation = geometry->allocate(entry, vertices, indices);
+		// Indices are relative to the mesh, the base vertex moves them to its place in the shared vertex buffer
+		baseVertex = (GLint)allocation.firstVertex;
+		indexType = entry.indexElementSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		lods.push_back({ 0, (uint32_t)entry.numIndices, 0.0f });
+		for (uint32_t i = 0; i < entry.numLods; i++) {
+			lods.push_back({ lods.back().firstIndex + lods.back().numIndices, entry.lodNumIndices[i], entry.lodErrors[i] });
+		}
+		this->meshlets.assign(meshlets, meshlets + numMeshlets);
 
-		diffuseLocation = glGetUniformLocation(shader->getShaderId(), "u_diffuse");
-		specularLocation = glGetUniformLocation(shader->getShaderId(), "u_specular");
-		emissiveLocation = glGetUniformLocation(shader->getShaderId(), "u_emissive");
-		shininessLocation = glGetUniformLocation(shader->getShaderId(), "u_shininess");
+		boundsMin = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+		boundsMax = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+		if (entry.vertexFormat == BMF_VERTEX_FORMAT_QUANTIZED) {
+			positionOffset = boundsMin;
+			positionScale = boundsMax - boundsMin;
+			quantized = true;
+		}
+		boundingRadius = computeBoundingRadius(entry, vertices);
 	}
 	~Mesh() {
-		delete vertexBuffer;
-		delete indexBuffer;
+		geometry->free(allocation);
 	}
 	inline void render() {
-		vertexBuffer->bind();
-		indexBuffer->bind();
-		glUniform3fv(diffuseLocation, 1, (float*)&material.diffuse);
-		glUniform3fv(specularLocation, 1, (float*)&material.specular);
-		glUniform3fv(emissiveLocation, 1, (float*)&material.emissive);
-		glUniform1f(shininessLocation, material.shininess);
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+		allocation.block->bind();
+		uniforms->materialIndex.set((GLint)materials->bind(materialIndex));
+		uniforms->positionScale.set(positionScale);
+		uniforms->positionOffset.set(positionOffset);
+		draw();
+	}
+	// Only the draw call, the VAO, material and dequantization have to be set already
+	inline void draw(uint32_t lod = 0) {
+		const MeshLod& level = lods[lod];
+		uint64_t offset = allocation.indexOffset + (uint64_t)level.firstIndex * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+		glDrawElementsBaseVertex(GL_TRIANGLES, level.numIndices, indexType, (void*)offset, baseVertex);
+	}
+	inline void drawInstanced(GLsizei numInstances) {
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, numIndices, indexType, (void*)allocation.indexOffset, numInstances, baseVertex);
+	}
+	// What render() does as an indirect command and the data that replaces its uniforms
+	void getIndirect(DrawElementsIndirectCommand& command, IndirectDrawData& data) {
+		command.count = (uint32_t)numIndices;
+		command.instanceCount = 1;
+		command.firstIndex = (uint32_t)(allocation.indexOffset / (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t)));
+		command.baseVertex = baseVertex;
+		command.baseInstance = 0;
+		const Material& material = materials->get(materialIndex);
+		data.diffuse = glm::vec4(material.diffuse, 1.0f);
+		data.specular = glm::vec4(material.specular, 1.0f);
+		data.emissive = glm::vec4(material.emissive, material.shininess);
+		data.positionScale = glm::vec4(positionScale, 0.0f);
+		data.positionOffset = glm::vec4(positionOffset, 0.0f);
+	}
+	GeometryBlock* getBlock() {
+		return allocation.block;
+	}
+	GLenum getIndexType() {
+		return indexType;
+	}
+	MaterialRegistry* getMaterials() {
+		return materials;
+	}
+	uint32_t getMaterialIndex() {
+		return materialIndex;
+	}
+	// Features of basic.vert/frag drawing the mesh needs, looked up every time because materials can change
+	uint32_t getShaderFeatures() {
+		uint32_t features = materialShaderFeatures(materials->get(materialIndex));
+		return quantized ? features | SHADER_FEATURE_QUANTIZED_POSITIONS : features;
+	}
+	const glm::vec3& getPositionScale() {
+		return positionScale;
+	}
+	const glm::vec3& getPositionOffset() {
+		return positionOffset;
+	}
+	// Model space bounding box
+	const glm::vec3& getBoundsMin() {
+		return boundsMin;
+	}
+	const glm::vec3& getBoundsMax() {
+		return boundsMax;
+	}
+	// Radius of the bounding sphere around the center of the bounding box
+	float getBoundingRadius() {
+		return boundingRadius;
+	}
+	// 1 for meshes without simplified levels
+	uint32_t getNumLods() {
+		return (uint32_t)lods.size();
+	}
+	const MeshLod& getLod(uint32_t lod) {
+		return lods[lod];
+	}
+	// Clusters of the full mesh, empty for files written without them
+	const std::vector<BmfMeshlet>& getMeshlets() {
+		return meshlets;
 	}
 private:
-	VertexBuffer* vertexBuffer;
-	IndexBuffer* indexBuffer;
-	Shader* shader;
-	Material material;
+	// Distance from the box center to the farthest vertex, usually a lot tighter than half the box diagonal
+	float computeBoundingRadius(const BmfMeshEntry& entry, const void* vertices) {
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float maxDistance2 = 0.0f;
+		for (uint64_t i = 0; i < entry.numVertices; i++) {
+			glm::vec3 position;
+			if (entry.vertexFormat == BMF_VERTEX_FORMAT_QUANTIZED) {
+				const uint16_t* quantized = ((const BmfQuantizedVertex*)vertices)[i].position;
+				position = positionOffset + glm::vec3(quantized[0], quantized[1], quantized[2]) / 65535.0f * positionScale;
+			}
+			else {
+				position = ((const Vertex*)vertices)[i].positon;
+			}
+			glm::vec3 offset = position - center;
+			maxDistance2 = std::max(maxDistance2, glm::dot(offset, offset));
+		}
+		return std::sqrt(maxDistance2);
+	}
+
+	GeometryPool* geometry;
+	GeometryAllocation allocation;
+	GLint baseVertex = 0;
+	MeshUniforms* uniforms;
+	MaterialRegistry* materials;
+	uint32_t materialIndex;
 	uint64_t numIndices = 0;
-	int diffuseLocation;
-	int specularLocation;
-	int emissiveLocation;
-	int shininessLocation;
+	std::vector<MeshLod> lods;
+	std::vector<BmfMeshlet> meshlets;
+	GLenum indexType = GL_UNSIGNED_INT;
+	// Maps quantized positions back to model space, identity for float positions
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	bool quantized = false;
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	float boundingRadius = 0.0f;
+};
+
+// v1 files only store float vertices and no bounds, the bounds are computed from the vertices
+inline BmfMeshEntry version1Entry(const Material& material, uint64_t numVertices, uint64_t numIndices, const Vertex* vertices) {
+	BmfMeshEntry entry = {};
+	if (numVertices) {
+		glm::vec3 boundsMin = vertices[0].positon;
+		glm::vec3 boundsMax = vertices[0].positon;
+		for (uint64_t i = 1; i < numVertices; i++) {
+			boundsMin = glm::min(boundsMin, vertices[i].positon);
+			boundsMax = glm::max(boundsMax, vertices[i].positon);
+		}
+		memcpy(entry.boundsMin, &boundsMin, sizeof(entry.boundsMin));
+		memcpy(entry.boundsMax, &boundsMax, sizeof(entry.boundsMax));
+	}
+	memcpy(&entry.material, &material, sizeof(Material));
+	entry.vertexFormat = BMF_VERTEX_FORMAT_FLOAT;
+	entry.vertexStride = sizeof(Vertex);
+	entry.numVertices = numVertices;
+	entry.numIndices = numIndices;
+	entry.indexElementSize = sizeof(uint32_t);
+	return entry;
+}
+
+inline bool readMapped(const uint8_t* data, uint64_t size, uint64_t& offset, void* destination, uint64_t count) {
+	if (count > size - offset) {
+		std::cout << "Error reading model: file is truncated!" << std::endl;
+		return false;
+	}
+	memcpy(destination, data + offset, count);
+	offset += count;
+	return true;
+}
+
+// Validates a bmf file in memory and calls callback(entry, vertices, indices, meshlets, numMeshlets) for every mesh in it.
+// The pointers point into data, compressed meshes are passed on undecoded. Does not touch OpenGL, so it can run on any thread.
+template<typename Callback>
+bool forEachMappedMesh(const uint8_t* data, uint64_t size, Callback callback) {
+	if (bmfIsVersion2(data, size)) {
+		BmfHeader header;
+		memcpy(&header, data, sizeof(BmfHeader));
+		if (!bmfValidateHeader(header, size)) {
+			std::cout << "Error reading model: invalid bmf header!" << std::endl;
+			return false;
+		}
+		std::vector<BmfMeshEntry> entries(header.numMeshes);
+		memcpy(entries.data(), data + header.meshTableOffset, header.numMeshes * sizeof(BmfMeshEntry));
+		std::vector<BmfMeshletRange> meshletRanges(header.flags & BMF_FLAG_MESHLETS ? header.numMeshes : 0);
+		memcpy(meshletRanges.data(), data + bmfMeshletTableOffset(header), meshletRanges.size() * sizeof(BmfMeshletRange));
+		for (uint32_t i = 0; i < header.numMeshes; i++) {
+			const BmfMeshEntry& entry = entries[i];
+			if (!bmfValidateMeshEntry(entry, size)) {
+				std::cout << "Error reading model: invalid mesh entry!" << std::endl;
+				return false;
+			}
+			const BmfMeshlet* meshlets = nullptr;
+			uint32_t numMeshlets = 0;
+			if (!meshletRanges.empty()) {
+				meshlets = (const BmfMeshlet*)(data + meshletRanges[i].offset);
+				numMeshlets = meshletRanges[i].numMeshlets;
+				if (!bmfValidateMeshletRange(meshletRanges[i], size) || !bmfValidateMeshlets(meshlets, numMeshlets, entry)) {
+					std::cout << "Error reading model: invalid meshlets!" << std::endl;
+					return false;
+				}
+			}
+			callback(entry, data + entry.vertexOffset, data + entry.indexOffset, meshlets, numMeshlets);
+		}
+		return true;
+	}
+
+	uint64_t offset = 0;
+	uint64_t numMeshes;
+	if (!readMapped(data, size, offset, &numMeshes, sizeof(uint64_t))) {
+		return false;
+	}
+	for (uint64_t i = 0; i < numMeshes; i++)
+	{
+		Material material;
+		uint64_t numVertices = 0;
+		uint64_t numIndices = 0;
+		if (!readMapped(data, size, offset, &material, sizeof(Material))
+			|| !readMapped(data, size, offset, &numVertices, sizeof(uint64_t))
+			|| !readMapped(data, size, offset, &numIndices, sizeof(uint64_t))) {
+			return false;
+		}
+		uint64_t remaining = size - offset;
+		if (numVertices > remaining / sizeof(Vertex) || numIndices > remaining / sizeof(uint32_t)
+			|| numVertices * sizeof(Vertex) + numIndices * sizeof(uint32_t) > remaining) {
+			std::cout << "Error reading model: file is truncated!" << std::endl;
+			return false;
+		}
+		uint64_t verticesSize = numVertices * sizeof(Vertex);
+		uint64_t indicesSize = numIndices * sizeof(uint32_t);
+		const uint8_t* vertices = data + offset;
+		const uint8_t* indices = vertices + verticesSize;
+		offset += verticesSize + indicesSize;
+		callback(version1Entry(material, numVertices, numIndices, (const Vertex*)vertices), vertices, indices, nullptr, 0);
+	}
+	return true;
+}
+
+enum class ModelLoadMode {
+	// Reads the file component by component with std::ifstream
+	Stream,
+	// Maps the whole file into memory and uploads straight from the mapping
+	MemoryMapped
+};
+
+enum class ModelState {
+	// Nothing has been loaded yet
+	Empty,
+	// A ModelLoader is still streaming meshes in, render() draws the meshes that have arrived so far
+	Pending,
+	Ready,
+	Failed
 };
 
 class Model {
+	friend class ModelLoader;
 public:
 	Model()
 	{
 
 	}
 
-	void Init(const char* filename, Shader* shader) {
+	// Places the meshes in the given geometry pool and their materials in the given registry, which have to outlive the model.
+	// The model creates its own for those that are not given.
+	void Init(const char* filename, Shader* shader, ModelLoadMode mode = ModelLoadMode::MemoryMapped, GeometryPool* geometry = nullptr, MaterialRegistry* materials = nullptr) {
+		useResources(geometry, materials);
+		bool succeeded;
+		if (mode == ModelLoadMode::MemoryMapped) {
+			succeeded = initMapped(filename, shader);
+		}
+		else {
+			succeeded = initStream(filename, shader);
+		}
+		std::vector<uint8_t>().swap(decodedVertices);
+		std::vector<uint8_t>().swap(decodedIndices);
+		std::vector<uint8_t>().swap(decodeScratch);
+		// Like an async load, meshes read before an error are kept but the model counts as failed
+		state = succeeded ? ModelState::Ready : ModelState::Failed;
+	}
+
+	ModelState getState() {
+		return state;
+	}
+
+	bool isReady() {
+		return state == ModelState::Ready;
+	}
+
+	const std::vector<Mesh*>& getMeshes() {
+		return meshes;
+	}
+
+	void render() {
+		if (meshes.empty()) {
+			return;
+		}
+		materials->prepare();
+		for (Mesh* mesh : meshes) {
+			mesh->render();
+		}
+	}
+
+	// Draws every mesh once per instance with a single instanced draw call per mesh.
+	// shader has to be basic.vert/frag with INSTANCED defined, the caller sets its u_view and u_projection.
+	void renderInstanced(Shader* shader, InstanceBuffer& instances) {
+		if (meshes.empty() || instances.getNumInstances() == 0) {
+			return;
+		}
+		if (instancedUniforms.getShader() != shader) {
+			instancedUniforms.lookUp(shader);
+		}
+		instances.upload();
+		materials->prepare();
+		GeometryBlock* block = nullptr;
+		for (Mesh* mesh : meshes) {
+			if (mesh->getBlock() != block) {
+				if (block) {
+					InstanceBuffer::unbindAttributes();
+				}
+				block = mesh->getBlock();
+				block->bind();
+				instances.bindAttributes();
+			}
+			instancedUniforms.materialIndex.set((GLint)materials->bind(mesh->getMaterialIndex()));
+			instancedUniforms.positionScale.set(mesh->getPositionScale());
+			instancedUniforms.positionOffset.set(mesh->getPositionOffset());
+			mesh->drawInstanced((GLsizei)instances.getNumInstances());
+		}
+		InstanceBuffer::unbindAttributes();
+	}
+
+	static bool supportsIndirect() {
+		return GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_draw_parameters && GLEW_ARB_shader_storage_buffer_object;
+	}
+
+	// Draws all meshes with one glMultiDrawElementsIndirect per geometry block and index type.
+	// shader has to be basic_indirect.vert/frag, which fetch the material of every draw through gl_DrawID.
+	void renderIndirect(Shader* shader) {
+		if (meshes.empty()) {
+			return;
+		}
+		if (indirectMeshCount != meshes.size() || indirectMaterialGeneration != materials->getGeneration()) {
+			buildIndirect();
+		}
+		if (drawOffset.getShader() != shader) {
+			drawOffset = Uniform<GLint>(shader, SHADER_NAME("u_drawOffset"));
+		}
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBufferId);
+		for (const IndirectBatch& batch : indirectBatches) {
+			batch.block->bind();
+			drawOffset.set((GLint)batch.firstCommand);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, (void*)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)), batch.numCommands, 0);
+		}
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	~Model() {
+		if (loadHandle) {
+			// Tells the loader to drop meshes that are still on their way
+			*loadHandle = false;
+		}
+		for (Mesh* mesh : meshes) {
+			delete mesh;
+		}
+		delete ownGeometry;
+		delete ownMaterials;
+		if (indirectBufferId) {
+			GLState::deleteBuffers(1, &indirectBufferId);
+			GLState::deleteBuffers(1, &drawDataBufferId);
+		}
+	}
+private:
+	// Draws of one geometry block with one index type, they can go into one multi draw
+	struct IndirectBatch {
+		GeometryBlock* block;
+		GLenum indexType;
+		uint32_t firstCommand;
+		uint32_t numCommands;
+	};
+
+	// Rebuilds the command and draw data buffers, runs again whenever meshes were added
+	void buildIndirect() {
+		std::vector<Mesh*> sorted = meshes;
+		std::stable_sort(sorted.begin(), sorted.end(), [](Mesh* a, Mesh* b) {
+			return a->getBlock() != b->getBlock() ? a->getBlock() < b->getBlock() : a->getIndexType() < b->getIndexType();
+		});
+		std::vector<DrawElementsIndirectCommand> commands(sorted.size());
+		std::vector<IndirectDrawData> drawData(sorted.size());
+		indirectBatches.clear();
+		for (uint32_t i = 0; i < sorted.size(); i++) {
+			sorted[i]->getIndirect(commands[i], drawData[i]);
+			if (indirectBatches.empty() || indirectBatches.back().block != sorted[i]->getBlock() || indirectBatches.back().indexType != sorted[i]->getIndexType()) {
+				indirectBatches.push_back({ sorted[i]->getBlock(), sorted[i]->getIndexType(), i, 0 });
+			}
+			indirectBatches.back().numCommands++;
+		}
+
+		if (!indirectBufferId) {
+			glGenBuffers(1, &indirectBufferId);
+			glGenBuffers(1, &drawDataBufferId);
+		}
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferId);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(IndirectDrawData), drawData.data(), GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		indirectMeshCount = meshes.size();
+		indirectMaterialGeneration = materials->getGeneration();
+	}
+
+	void useResources(GeometryPool* geometry, MaterialRegistry* materials) {
+		if (geometry) {
+			this->geometry = geometry;
+		}
+		else if (!this->geometry) {
+			ownGeometry = new GeometryPool();
+			this->geometry = ownGeometry;
+		}
+		if (materials) {
+			this->materials = materials;
+		}
+		else if (!this->materials) {
+			ownMaterials = new MaterialRegistry();
+			this->materials = ownMaterials;
+		}
+	}
+
+	// Hands the vertex and index ranges of the mapped file directly to the GPU buffers without intermediate copies
+	bool initMapped(const char* filename, Shader* shader) {
+		MappedFile file(filename);
+		if (!file.isOpen()) {
+			std::cout << "Error reading model!" << std::endl;
+			return false;
+		}
+		return forEachMappedMesh(file.getData(), file.getSize(), [&](const BmfMeshEntry& entry, const uint8_t* vertices, const uint8_t* indices, const BmfMeshlet* meshlets, uint32_t numMeshlets) {
+			createMesh(entry, vertices, indices, meshlets, numMeshlets, shader);
+		});
+	}
+
+	bool initStream(const char* filename, Shader* shader) {
 		std::ifstream input = std::ifstream(filename, std::ios::in | std::ios::binary);
 		if (!input.is_open()) {
 			std::cout << "Error reading model!" << std::endl;
+			return false;
+		}
+
+		uint32_t magic = 0;
+		input.read((char*)&magic, sizeof(uint32_t));
+		input.seekg(0);
+		if (magic == BMF_MAGIC) {
+			return initStreamVersion2(input, shader);
 		}
 
 		uint64_t numMeshes;
@@ -83,7 +544,7 @@ public:
 
 			input.read((char*)&numVertices, sizeof(uint64_t));
 			input.read((char*)&numIndices, sizeof(uint64_t));
-			for (uint64_t i = 0; i < numVertices; i++)
+			for (uint64_t i = 0; i < numVertices && input; i++)
 			{
 				Vertex vertex;
 				input.read((char*)&vertex.positon.x, sizeof(float));
@@ -94,27 +555,130 @@ public:
 				input.read((char*)&vertex.normal.z, sizeof(float));
 				vertices.push_back(vertex);
 			}
-			for (uint64_t i = 0; i < numIndices; i++)
+			for (uint64_t i = 0; i < numIndices && input; i++)
 			{
 				uint32_t index;
 				input.read((char*)&index, sizeof(uint32_t));
 				indices.push_back(index);
 			}
-			Mesh* mesh = new Mesh(vertices, numVertices, indices, numIndices , material, shader);
-			meshes.push_back(mesh);
+			if (!input) {
+				std::cout << "Error reading model: file is truncated!" << std::endl;
+				return false;
+			}
+			createMesh(version1Entry(material, numVertices, numIndices, vertices.data()), (const uint8_t*)vertices.data(), (const uint8_t*)indices.data(), nullptr, 0, shader);
 		}
+		return true;
 	}
-	void render() {
-		for (Mesh* mesh : meshes) {
-			mesh->render();
+
+	// Reads the mesh table with one read and then every mesh's vertex and index blobs with one read each
+	bool initStreamVersion2(std::ifstream& input, Shader* shader) {
+		input.seekg(0, std::ios::end);
+		uint64_t size = (uint64_t)input.tellg();
+		input.seekg(0);
+
+		BmfHeader header;
+		input.read((char*)&header, sizeof(BmfHeader));
+		if (!input || !bmfValidateHeader(header, size)) {
+			std::cout << "Error reading model: invalid bmf header!" << std::endl;
+			return false;
+		}
+		std::vector<BmfMeshEntry> entries(header.numMeshes);
+		input.seekg(header.meshTableOffset);
+		input.read((char*)entries.data(), header.numMeshes * sizeof(BmfMeshEntry));
+		std::vector<BmfMeshletRange> meshletRanges(header.flags & BMF_FLAG_MESHLETS ? header.numMeshes : 0);
+		input.read((char*)meshletRanges.data(), meshletRanges.size() * sizeof(BmfMeshletRange));
+
+		meshes.reserve(meshes.size() + header.numMeshes);
+		std::vector<uint8_t> blob;
+		std::vector<BmfMeshlet> meshlets;
+		for (uint32_t i = 0; i < header.numMeshes; i++) {
+			const BmfMeshEntry& entry = entries[i];
+			if (!bmfValidateMeshEntry(entry, size)) {
+				std::cout << "Error reading model: invalid mesh entry!" << std::endl;
+				return false;
+			}
+			meshlets.clear();
+			if (!meshletRanges.empty()) {
+				if (!bmfValidateMeshletRange(meshletRanges[i], size)) {
+					std::cout << "Error reading model: invalid meshlets!" << std::endl;
+					return false;
+				}
+				meshlets.resize(meshletRanges[i].numMeshlets);
+				input.seekg(meshletRanges[i].offset);
+				input.read((char*)meshlets.data(), meshlets.size() * sizeof(BmfMeshlet));
+				if (!input || !bmfValidateMeshlets(meshlets.data(), (uint32_t)meshlets.size(), entry)) {
+					std::cout << "Error reading model: invalid meshlets!" << std::endl;
+					return false;
+				}
+			}
+			blob.resize(entry.indexOffset + entry.indexSize - entry.vertexOffset);
+			input.seekg(entry.vertexOffset);
+			input.read((char*)blob.data(), blob.size());
+			if (!input) {
+				std::cout << "Error reading model: file is truncated!" << std::endl;
+				return false;
+			}
+			createMesh(entry, blob.data(), blob.data() + (entry.indexOffset - entry.vertexOffset), meshlets.data(), (uint32_t)meshlets.size(), shader);
 		}
+		return true;
 	}
 
-	~Model() {
-		for (Mesh* mesh : meshes) {
-			delete mesh;
+	// Called by the ModelLoader on the render thread, returns the handle that stays true while the model is alive
+	std::shared_ptr<bool> beginAsyncLoad() {
+		if (loadHandle) {
+			// Meshes of an earlier load that is still in flight are dropped
+			*loadHandle = false;
 		}
+		loadHandle = std::make_shared<bool>(true);
+		state = ModelState::Pending;
+		return loadHandle;
 	}
-private:
+
+	void finishAsyncLoad(bool succeeded) {
+		loadHandle.reset();
+		state = succeeded ? ModelState::Ready : ModelState::Failed;
+	}
+
+	void createMesh(const BmfMeshEntry& entry, const uint8_t* vertices, const uint8_t* indices, const BmfMeshlet* meshlets, uint32_t numMeshlets, Shader* shader) {
+		if (bmfVertexStride(entry.vertexFormat) == 0 || entry.vertexStride != bmfVertexStride(entry.vertexFormat)) {
+			std::cout << "Skipping mesh with unsupported vertex format " << entry.vertexFormat << std::endl;
+			return;
+		}
+		if (entry.compression != BMF_COMPRESSION_NONE) {
+			if (!bmfDecodeMesh(entry, vertices, indices, decodedVertices, decodedIndices, decodeScratch)) {
+				std::cout << "Error reading model: corrupt compressed mesh!" << std::endl;
+				return;
+			}
+			vertices = decodedVertices.data();
+			indices = decodedIndices.data();
+		}
+		if (uniforms.getShader() != shader) {
+			uniforms.lookUp(shader);
+		}
+		Mesh* mesh = new Mesh(entry, vertices, indices, meshlets, numMeshlets, &uniforms, geometry, materials);
+		meshes.push_back(mesh);
+	}
+
 	std::vector<Mesh*> meshes;
+	ModelState state = ModelState::Empty;
+	GeometryPool* geometry = nullptr;
+	MaterialRegistry* materials = nullptr;
+	// Only set when no shared pool or registry was given
+	GeometryPool* ownGeometry = nullptr;
+	MaterialRegistry* ownMaterials = nullptr;
+	MeshUniforms uniforms;
+	// Looked up separately, renderInstanced() draws with a different program than the one given to Init()
+	MeshUniforms instancedUniforms;
+	std::vector<IndirectBatch> indirectBatches;
+	size_t indirectMeshCount = 0;
+	uint32_t indirectMaterialGeneration = 0;
+	GLuint indirectBufferId = 0;
+	GLuint drawDataBufferId = 0;
+	Uniform<GLint> drawOffset;
+	// Shared with a ModelLoader while an async load is in flight, only accessed on the render thread
+	std::shared_ptr<bool> loadHandle;
+	// Reused between meshes while decoding compressed files
+	std::vector<uint8_t> decodedVertices;
+	std::vector<uint8_t> decodedIndices;
+	std::vector<uint8_t> decodeScratch;
 };
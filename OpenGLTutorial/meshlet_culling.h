@@ -0,0 +1,305 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "shader.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "frustum_culling.h"
+#include "gpu_culling.h"
+
+// Per meshlet entry of cull_meshlets.comp, std430 layout
+struct GpuCullMeshlet {
+	glm::vec4 centerRadius;
+	// w holds the cutoff
+	glm::vec4 coneApexCutoff;
+	glm::vec4 coneAxis;
+	uint32_t count;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t drawIndex;
+	uint32_t batch;
+	uint32_t batchFirstMeshlet;
+	uint32_t pad[2];
+};
+
+static_assert(sizeof(GpuCullMeshlet) == 80, "GpuCullMeshlet must match the std430 layout of cull_meshlets.comp");
+
+// Counts of the last MeshletCuller::render(), summed over all instances
+struct MeshletCullStats {
+	uint32_t drawn = 0;
+	// Rejected by the normal cone test after passing the frustum test
+	uint32_t coneCulled = 0;
+	uint32_t triangles = 0;
+};
+
+// Culls the meshlets of every instance of a model on the GPU instead of whole meshes, so only the visible parts of
+// large meshes are drawn. cull_meshlets.comp tests the bounding sphere of every meshlet of every instance against
+// the frustum and its normal cone against the camera position, meshlets facing away are dropped as a whole.
+// Each visible meshlet becomes a command of the multi draw of its geometry block and index type, consumed like
+// the commands of GpuCuller. Meshes written without meshlets are culled as one meshlet without a normal cone.
+// The cone test assumes back faces are culled.
+class MeshletCuller {
+public:
+	MeshletCuller() : cullShader("cull_meshlets.comp") {
+		frustumPlanesLocation = cullShader.getUniformLocation(SHADER_NAME("u_frustumPlanes"));
+		cameraPositionLocation = cullShader.getUniformLocation(SHADER_NAME("u_cameraPosition"));
+		numInstancesLocation = cullShader.getUniformLocation(SHADER_NAME("u_numInstances"));
+		numMeshletsLocation = cullShader.getUniformLocation(SHADER_NAME("u_numMeshlets"));
+		coneCullingLocation = cullShader.getUniformLocation(SHADER_NAME("u_coneCulling"));
+		glGenBuffers(1, &meshletBufferId);
+		glGenBuffers(1, &drawDataBufferId);
+		glGenBuffers(1, &commandBufferId);
+		glGenBuffers(1, &drawRecordBufferId);
+		glGenBuffers(1, &counterBufferId);
+		glGenBuffers(1, &statsBufferId);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, statsBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		useCountReadback = !GLEW_ARB_indirect_parameters;
+	}
+	virtual ~MeshletCuller() {
+		GLState::deleteBuffers(1, &meshletBufferId);
+		GLState::deleteBuffers(1, &drawDataBufferId);
+		GLState::deleteBuffers(1, &commandBufferId);
+		GLState::deleteBuffers(1, &drawRecordBufferId);
+		GLState::deleteBuffers(1, &counterBufferId);
+		GLState::deleteBuffers(1, &statsBufferId);
+	}
+	MeshletCuller(const MeshletCuller&) = delete;
+	MeshletCuller& operator=(const MeshletCuller&) = delete;
+
+	static bool isSupported() {
+		return GpuCuller::isSupported();
+	}
+
+	// Reads the command counts back even where glMultiDrawElementsIndirectCount is available
+	void setCountReadback(bool enabled) {
+		useCountReadback = enabled || !GLEW_ARB_indirect_parameters;
+	}
+
+	// Only the frustum test is left without it
+	void setConeCulling(bool enabled) {
+		coneCulling = enabled;
+	}
+
+	// Culls the meshlets of every instance of model and draws the visible ones.
+	// shader has to be gpu_culled.vert with basic_indirect.frag, view and projection are set as its uniforms.
+	void render(Model& model, InstanceBuffer& instances, Shader* shader, const glm::mat4& view, const glm::mat4& projection) {
+		const std::vector<Mesh*>& meshes = model.getMeshes();
+		uint32_t numInstances = instances.getNumInstances();
+		if (meshes.empty() || numInstances == 0) {
+			return;
+		}
+		if (&model != builtModel || meshes.size() != builtMeshCount || meshes[0]->getMaterials()->getGeneration() != builtMaterialGeneration) {
+			buildMeshlets(model);
+		}
+		reserveCommands(numInstances * builtMeshletCount);
+		instances.upload();
+		cull(instances, numInstances, view, projection);
+		draw(instances, shader, view, projection, numInstances);
+	}
+
+	// Waits for the GPU
+	MeshletCullStats readStats() {
+		MeshletCullStats stats;
+		std::vector<uint32_t> batchCounts(batches.size());
+		uint32_t counts[2] = {};
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, counterBufferId);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, batchCounts.size() * sizeof(uint32_t), batchCounts.data());
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, statsBufferId);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts), counts);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+		for (uint32_t count : batchCounts) {
+			stats.drawn += count;
+		}
+		stats.triangles = counts[0];
+		stats.coneCulled = counts[1];
+		return stats;
+	}
+
+	uint32_t getNumMeshlets() {
+		return builtMeshletCount;
+	}
+private:
+	// Meshlets of one geometry block with one index type, their commands go into one multi draw
+	struct Batch {
+		GeometryBlock* block;
+		GLenum indexType;
+		uint32_t firstMeshlet;
+		uint32_t numMeshlets;
+	};
+
+	// Uploads the bounds and draw templates of all meshlets, grouped into batches like GpuCuller groups meshes
+	void buildMeshlets(Model& model) {
+		std::vector<Mesh*> sorted = model.getMeshes();
+		std::stable_sort(sorted.begin(), sorted.end(), [](Mesh* a, Mesh* b) {
+			return a->getBlock() != b->getBlock() ? a->getBlock() < b->getBlock() : a->getIndexType() < b->getIndexType();
+		});
+		std::vector<GpuCullMeshlet> cullMeshlets;
+		std::vector<IndirectDrawData> drawData(sorted.size());
+		batches.clear();
+		for (uint32_t i = 0; i < sorted.size(); i++) {
+			Mesh* mesh = sorted[i];
+			if (batches.empty() || batches.back().block != mesh->getBlock() || batches.back().indexType != mesh->getIndexType()) {
+				batches.push_back({ mesh->getBlock(), mesh->getIndexType(), (uint32_t)cullMeshlets.size(), 0 });
+			}
+			DrawElementsIndirectCommand command;
+			mesh->getIndirect(command, drawData[i]);
+			GpuCullMeshlet cullMeshlet = {};
+			cullMeshlet.baseVertex = command.baseVertex;
+			cullMeshlet.drawIndex = i;
+			cullMeshlet.batch = (uint32_t)batches.size() - 1;
+			cullMeshlet.batchFirstMeshlet = batches.back().firstMeshlet;
+			const std::vector<BmfMeshlet>& meshlets = mesh->getMeshlets();
+			if (meshlets.empty()) {
+				cullMeshlet.centerRadius = glm::vec4((mesh->getBoundsMin() + mesh->getBoundsMax()) * 0.5f, mesh->getBoundingRadius());
+				cullMeshlet.coneApexCutoff = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+				cullMeshlet.count = command.count;
+				cullMeshlet.firstIndex = command.firstIndex;
+				cullMeshlets.push_back(cullMeshlet);
+			}
+			for (const BmfMeshlet& meshlet : meshlets) {
+				cullMeshlet.centerRadius = glm::vec4(meshlet.center[0], meshlet.center[1], meshlet.center[2], meshlet.radius);
+				cullMeshlet.coneApexCutoff = glm::vec4(meshlet.coneApex[0], meshlet.coneApex[1], meshlet.coneApex[2], meshlet.coneCutoff);
+				cullMeshlet.coneAxis = glm::vec4(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2], 0.0f);
+				cullMeshlet.count = meshlet.numTriangles * 3;
+				cullMeshlet.firstIndex = command.firstIndex + meshlet.firstIndex;
+				cullMeshlets.push_back(cullMeshlet);
+			}
+			batches.back().numMeshlets = (uint32_t)cullMeshlets.size() - batches.back().firstMeshlet;
+		}
+
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, meshletBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, cullMeshlets.size() * sizeof(GpuCullMeshlet), cullMeshlets.data(), GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(IndirectDrawData), drawData.data(), GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, batches.size() * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		counters.resize(batches.size());
+		builtModel = &model;
+		builtMeshCount = sorted.size();
+		builtMeshletCount = (uint32_t)cullMeshlets.size();
+		builtMaterialGeneration = sorted[0]->getMaterials()->getGeneration();
+	}
+
+	// Grows the command and draw record buffers to hold a command for every meshlet of every instance
+	void reserveCommands(uint32_t numCommands) {
+		if (numCommands <= commandCapacity) {
+			return;
+		}
+		commandCapacity = std::max(numCommands, commandCapacity * 2);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferId);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, (GLsizeiptr)commandCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawRecordBufferId);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)commandCapacity * 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+	}
+
+	void cull(InstanceBuffer& instances, uint32_t numInstances, const glm::mat4& view, const glm::mat4& projection) {
+		Frustum frustum = Frustum::fromViewProj(projection * view);
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+		cullShader.bind();
+		glUniform4fv(frustumPlanesLocation, 6, (const float*)frustum.planes);
+		glUniform3fv(cameraPositionLocation, 1, (const float*)&cameraPosition);
+		glUniform1ui(numInstancesLocation, numInstances);
+		glUniform1ui(numMeshletsLocation, builtMeshletCount);
+		glUniform1i(coneCullingLocation, coneCulling);
+
+		// Zeroed on the GPU, nothing is uploaded per frame
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBufferId);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, statsBufferId);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instances.getBufferId());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshletBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawRecordBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, counterBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, statsBufferId);
+
+		uint32_t numGroups = (numInstances * builtMeshletCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE;
+		uint32_t groupsX = std::min(numGroups, (uint32_t)GPU_CULL_MAX_GROUPS_X);
+		glDispatchCompute(groupsX, (numGroups + groupsX - 1) / groupsX, 1);
+		// Commands, draw records and counts are read by the draw, the counts also by the readback
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+
+	void draw(InstanceBuffer& instances, Shader* shader, const glm::mat4& view, const glm::mat4& projection, uint32_t numInstances) {
+		if (viewUniform.getShader() != shader) {
+			viewUniform = Uniform<glm::mat4>(shader, SHADER_NAME("u_view"));
+			projectionUniform = Uniform<glm::mat4>(shader, SHADER_NAME("u_projection"));
+		}
+		if (useCountReadback) {
+			GLState::bindBuffer(GL_COPY_READ_BUFFER, counterBufferId);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, counters.size() * sizeof(uint32_t), counters.data());
+			GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		shader->bind();
+		viewUniform.set(view);
+		projectionUniform.set(projection);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBufferId);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instances.getBufferId());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, instances.getNormalBufferId());
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferId);
+		if (!useCountReadback) {
+			GLState::bindBuffer(GL_PARAMETER_BUFFER_ARB, counterBufferId);
+		}
+		for (uint32_t i = 0; i < batches.size(); i++) {
+			const Batch& batch = batches[i];
+			if (useCountReadback && counters[i] == 0) {
+				continue;
+			}
+			batch.block->bind();
+			// Every command draws one instance, its base instance points at its own record
+			GLState::bindBuffer(GL_ARRAY_BUFFER, drawRecordBufferId);
+			glEnableVertexAttribArray(GPU_CULL_RECORD_LOCATION);
+			glVertexAttribIPointer(GPU_CULL_RECORD_LOCATION, 2, GL_UNSIGNED_INT, 2 * sizeof(uint32_t), nullptr);
+			glVertexAttribDivisor(GPU_CULL_RECORD_LOCATION, 1);
+			void* firstCommand = (void*)((uint64_t)batch.firstMeshlet * numInstances * sizeof(DrawElementsIndirectCommand));
+			if (useCountReadback) {
+				glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, firstCommand, (GLsizei)counters[i], 0);
+			}
+			else {
+				glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, batch.indexType, firstCommand, (GLintptr)(i * sizeof(uint32_t)), (GLsizei)(batch.numMeshlets * numInstances), 0);
+			}
+			// Draws without records must not read the attribute
+			glDisableVertexAttribArray(GPU_CULL_RECORD_LOCATION);
+		}
+		if (!useCountReadback) {
+			GLState::bindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+		}
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	Shader cullShader;
+	int frustumPlanesLocation = -1;
+	int cameraPositionLocation = -1;
+	int numInstancesLocation = -1;
+	int numMeshletsLocation = -1;
+	int coneCullingLocation = -1;
+	Uniform<glm::mat4> viewUniform;
+	Uniform<glm::mat4> projectionUniform;
+	bool useCountReadback = false;
+	bool coneCulling = true;
+
+	GLuint meshletBufferId = 0;
+	GLuint drawDataBufferId = 0;
+	GLuint commandBufferId = 0;
+	GLuint drawRecordBufferId = 0;
+	GLuint counterBufferId = 0;
+	GLuint statsBufferId = 0;
+	uint32_t commandCapacity = 0;
+
+	std::vector<Batch> batches;
+	std::vector<uint32_t> counters;
+	Model* builtModel = nullptr;
+	size_t builtMeshCount = 0;
+	uint32_t builtMeshletCount = 0;
+	uint32_t builtMaterialGeneration = 0;
+};
@@ -0,0 +1,233 @@
+#pragma once
+#include "mesh.h"
+#include "bvh.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Loads models in the background without blocking the render thread.
+// Worker threads map and decode the bmf files into staging memory, update() then uploads finished meshes
+// until the per frame upload budget is used up, so a big model arrives over several frames instead of stalling one.
+// Everything except the workers runs on the thread that owns the OpenGL context.
+class ModelLoader {
+public:
+	// uploadBudget is the number of vertex and index bytes update() uploads per call,
+	// maxStagedBytes limits how far the workers can decode ahead of the uploads.
+	// Meshes go into geometry and materials when given. If the uploads go through a staging ring the budget should stay well below the ring's capacity.
+	ModelLoader(uint32_t numThreads = 2, uint64_t uploadBudget = 4 * 1024 * 1024, uint64_t maxStagedBytes = 64 * 1024 * 1024, GeometryPool* geometry = nullptr, MaterialRegistry* materials = nullptr) {
+		this->uploadBudget = uploadBudget;
+		this->geometry = geometry;
+		this->materials = materials;
+		this->maxStagedBytes = maxStagedBytes;
+		for (uint32_t i = 0; i < std::max(numThreads, 1u); i++) {
+			workers.emplace_back(&ModelLoader::work, this);
+		}
+	}
+	virtual ~ModelLoader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		stagingSpace.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+	ModelLoader(const ModelLoader&) = delete;
+	ModelLoader& operator=(const ModelLoader&) = delete;
+
+	// Starts loading filename into model, which is Pending until all of its meshes are uploaded.
+	// With bvhs the workers also build a MeshBvh of every mesh from the geometry they decoded, for picking and
+	// collision. bvhs is cleared now and gets the MeshBvh of every mesh when it is uploaded, in the order of the
+	// model's meshes, so it is complete once the model is ready. It has to live as long as the load.
+	void load(Model* model, const char* filename, Shader* shader, std::vector<MeshBvh>* bvhs = nullptr) {
+		Job job;
+		job.model = model;
+		job.handle = model->beginAsyncLoad();
+		model->useResources(geometry, materials);
+		job.filename = filename;
+		job.shader = shader;
+		job.bvhs = bvhs;
+		if (bvhs) {
+			bvhs->clear();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		numPending++;
+		jobAvailable.notify_one();
+	}
+
+	// Uploads staged meshes, at least one if there is any, and returns the number of bytes uploaded
+	uint64_t update() {
+		uint64_t uploaded = 0;
+		while (uploaded < uploadBudget) {
+			StagedMesh mesh;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (staged.empty()) {
+					break;
+				}
+				mesh = std::move(staged.front());
+				staged.pop_front();
+				stagedBytes -= mesh.getSize();
+			}
+			stagingSpace.notify_all();
+
+			if (mesh.last) {
+				numPending--;
+				if (*mesh.handle) {
+					mesh.model->finishAsyncLoad(!mesh.failed);
+				}
+				continue;
+			}
+			if (!*mesh.handle) {
+				// The model was destroyed or reloaded in the meantime
+				continue;
+			}
+			mesh.model->createMesh(mesh.entry, mesh.vertices.data(), mesh.indices.data(), mesh.meshlets.data(), (uint32_t)mesh.meshlets.size(), mesh.shader);
+			if (mesh.bvhs) {
+				mesh.bvhs->push_back(std::move(mesh.bvh));
+			}
+			uploaded += mesh.getSize();
+		}
+		return uploaded;
+	}
+
+	void setUploadBudget(uint64_t bytes) {
+		uploadBudget = bytes;
+	}
+
+	// Number of models that have not finished loading
+	uint32_t getNumPending() {
+		return numPending;
+	}
+private:
+	struct Job {
+		Model* model = nullptr;
+		std::shared_ptr<bool> handle;
+		std::string filename;
+		Shader* shader = nullptr;
+		std::vector<MeshBvh>* bvhs = nullptr;
+	};
+
+	// One decoded mesh waiting for its upload, or the end marker of a model
+	struct StagedMesh {
+		Model* model = nullptr;
+		std::shared_ptr<bool> handle;
+		Shader* shader = nullptr;
+		BmfMeshEntry entry;
+		std::vector<uint8_t> vertices;
+		std::vector<uint8_t> indices;
+		std::vector<BmfMeshlet> meshlets;
+		std::vector<MeshBvh>* bvhs = nullptr;
+		MeshBvh bvh;
+		bool last = false;
+		bool failed = false;
+
+		uint64_t getSize() {
+			return vertices.size() + indices.size() + meshlets.size() * sizeof(BmfMeshlet);
+		}
+	};
+
+	void work() {
+		std::vector<uint8_t> scratch;
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			bool succeeded = false;
+			MappedFile file(job.filename.c_str());
+			if (!file.isOpen()) {
+				std::cout << "Error reading model!" << std::endl;
+			}
+			else {
+				succeeded = forEachMappedMesh(file.getData(), file.getSize(), [&](const BmfMeshEntry& entry, const uint8_t* vertices, const uint8_t* indices, const BmfMeshlet* meshlets, uint32_t numMeshlets) {
+					stage(job, entry, vertices, indices, meshlets, numMeshlets, scratch);
+				});
+			}
+
+			StagedMesh end;
+			end.model = job.model;
+			end.handle = job.handle;
+			end.last = true;
+			end.failed = !succeeded;
+			push(std::move(end));
+		}
+	}
+
+	void stage(const Job& job, const BmfMeshEntry& entry, const uint8_t* vertices, const uint8_t* indices, const BmfMeshlet* meshlets, uint32_t numMeshlets, std::vector<uint8_t>& scratch) {
+		if (bmfVertexStride(entry.vertexFormat) == 0 || entry.vertexStride != bmfVertexStride(entry.vertexFormat)) {
+			std::cout << "Skipping mesh with unsupported vertex format " << entry.vertexFormat << std::endl;
+			return;
+		}
+		StagedMesh mesh;
+		mesh.model = job.model;
+		mesh.handle = job.handle;
+		mesh.shader = job.shader;
+		mesh.entry = entry;
+		if (entry.compression != BMF_COMPRESSION_NONE) {
+			if (!bmfDecodeMesh(entry, vertices, indices, mesh.vertices, mesh.indices, scratch)) {
+				std::cout << "Error reading model: corrupt compressed mesh!" << std::endl;
+				return;
+			}
+			mesh.entry.compression = BMF_COMPRESSION_NONE;
+		}
+		else {
+			mesh.vertices.assign(vertices, vertices + entry.numVertices * entry.vertexStride);
+			mesh.indices.assign(indices, indices + bmfTotalIndices(entry) * entry.indexElementSize);
+		}
+		mesh.meshlets.assign(meshlets, meshlets + numMeshlets);
+		mesh.entry.vertexSize = mesh.vertices.size();
+		mesh.entry.indexSize = mesh.indices.size();
+		if (job.bvhs) {
+			if (!buildMeshBvh(mesh.entry, mesh.vertices.data(), mesh.indices.data(), mesh.bvh)) {
+				// Drawing it would read outside of the vertices as well
+				std::cout << "Skipping mesh with invalid indices" << std::endl;
+				return;
+			}
+			mesh.bvhs = job.bvhs;
+		}
+		push(std::move(mesh));
+	}
+
+	// Blocks while the staging memory is full, a single mesh larger than the limit is let through on its own
+	void push(StagedMesh&& mesh) {
+		uint64_t size = mesh.getSize();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stagingSpace.wait(lock, [&] { return stopping || stagedBytes == 0 || stagedBytes + size <= maxStagedBytes; });
+			if (stopping) {
+				return;
+			}
+			stagedBytes += size;
+			staged.push_back(std::move(mesh));
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable stagingSpace;
+	std::deque<Job> jobs;
+	std::deque<StagedMesh> staged;
+	uint64_t stagedBytes = 0;
+	uint64_t maxStagedBytes;
+	uint64_t uploadBudget;
+	GeometryPool* geometry;
+	MaterialRegistry* materials;
+	uint32_t numPending = 0;
+	bool stopping = false;
+};
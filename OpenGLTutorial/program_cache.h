@@ -0,0 +1,219 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "gl_state.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Directory the program binaries are written to, relative to the working directory
+#ifndef PROGRAM_CACHE_DIRECTORY
+#define PROGRAM_CACHE_DIRECTORY "shader_cache"
+#endif
+#define PROGRAM_CACHE_MAGIC 0x48435250 // "PRCH"
+// Larger entries are treated as corrupt
+#define PROGRAM_CACHE_MAX_BINARY_SIZE (64 * 1024 * 1024)
+
+// Start of every cache file, the program binary follows
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t binaryFormat;
+	uint64_t key;
+	uint64_t size;
+};
+
+struct ProgramCacheStats {
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	// Binaries the driver refused to load, they count as misses too
+	uint32_t rejected = 0;
+};
+
+// 64 bit FNV-1a, pass the previous hash to continue it
+inline uint64_t hashProgramData(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// On disk cache of linked program binaries, so shaders are only compiled on the first start.
+// Every program has one file named after it, which holds the key it was built with. The key hashes the sources
+// exactly as they are handed to the compiler, so defines added to them are covered too, and the vendor, renderer
+// and version strings of the driver. A file whose key does not match is a miss and gets overwritten, as does a
+// binary the driver rejects, which happens when it was updated without changing its version string.
+// Only used on the thread that owns the OpenGL context.
+class ProgramCache {
+public:
+	static bool isSupported() {
+		if (!GLEW_ARB_get_program_binary) {
+			return false;
+		}
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		return numFormats > 0;
+	}
+
+	static void setEnabled(bool enabled) {
+		get().enabled = enabled;
+	}
+
+	static bool isEnabled() {
+		State& state = get();
+		if (state.supported < 0) {
+			state.supported = isSupported() ? 1 : 0;
+		}
+		return state.enabled && state.supported;
+	}
+
+	static uint64_t computeKey(const std::vector<std::string>& sources) {
+		uint64_t key = getDriverHash();
+		for (const std::string& source : sources) {
+			uint64_t size = source.size();
+			key = hashProgramData(&size, sizeof(uint64_t), key);
+			key = hashProgramData(source.data(), source.size(), key);
+		}
+		return key;
+	}
+
+	// Returns a program created from the cached binary, 0 if there is none for this key
+	static GLuint load(const std::string& name, uint64_t key) {
+		if (!isEnabled()) {
+			return 0;
+		}
+		State& state = get();
+		FILE* file = openFile(name, "rb");
+		ProgramCacheHeader header;
+		if (file == nullptr || fread(&header, sizeof(ProgramCacheHeader), 1, file) != 1
+			|| header.magic != PROGRAM_CACHE_MAGIC || header.key != key || header.size > PROGRAM_CACHE_MAX_BINARY_SIZE) {
+			if (file) {
+				fclose(file);
+			}
+			state.stats.misses++;
+			return 0;
+		}
+		std::vector<uint8_t> binary(header.size);
+		bool read = fread(binary.data(), 1, binary.size(), file) == binary.size();
+		fclose(file);
+		if (!read) {
+			state.stats.misses++;
+			return 0;
+		}
+
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) {
+			GLState::deleteProgram(program);
+			state.stats.rejected++;
+			state.stats.misses++;
+			return 0;
+		}
+		state.stats.hits++;
+		return program;
+	}
+
+	// Has to be called before a program that is going to be stored is linked
+	static void prepare(GLuint program) {
+		if (isEnabled()) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	// Writes the binary of a linked program
+	static void store(const std::string& name, uint64_t key, GLuint program) {
+		if (!isEnabled()) {
+			return;
+		}
+		GLint linked = GL_FALSE;
+		GLint size = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (linked != GL_TRUE || size <= 0) {
+			return;
+		}
+		std::vector<uint8_t> binary(size);
+		GLenum binaryFormat = 0;
+		glGetProgramBinary(program, size, &size, &binaryFormat, binary.data());
+
+		makeDirectory();
+		FILE* file = openFile(name, "wb");
+		if (file == nullptr) {
+			std::cout << "Error writing program cache " << name << std::endl;
+			return;
+		}
+		ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, binaryFormat, key, (uint64_t)size };
+		fwrite(&header, sizeof(ProgramCacheHeader), 1, file);
+		fwrite(binary.data(), 1, (size_t)size, file);
+		fclose(file);
+	}
+
+	// Deletes the cached binary of a program
+	static void evict(const std::string& name) {
+		std::remove(getPath(name).c_str());
+	}
+
+	static ProgramCacheStats getStats() {
+		return get().stats;
+	}
+private:
+	struct State {
+		bool enabled = true;
+		// -1 until the first call with a current context
+		int supported = -1;
+		bool driverHashed = false;
+		uint64_t driverHash = 0;
+		ProgramCacheStats stats;
+	};
+
+	static State& get() {
+		static State state;
+		return state;
+	}
+
+	static uint64_t getDriverHash() {
+		State& state = get();
+		if (!state.driverHashed) {
+			state.driverHash = hashProgramData(nullptr, 0);
+			for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+				const char* value = (const char*)glGetString(name);
+				std::string string = value ? value : "";
+				state.driverHash = hashProgramData(string.c_str(), string.size() + 1, state.driverHash);
+			}
+			state.driverHashed = true;
+		}
+		return state.driverHash;
+	}
+
+	static std::string getPath(const std::string& name) {
+		std::string filename = name;
+		for (char& c : filename) {
+			if (c == '/' || c == '\\' || c == ':') {
+				c = '_';
+			}
+		}
+		return std::string(PROGRAM_CACHE_DIRECTORY) + "/" + filename + ".bin";
+	}
+
+	static FILE* openFile(const std::string& name, const char* mode) {
+#pragma warning(disable: 4996)
+		return fopen(getPath(name).c_str(), mode);
+#pragma warning(default: 4996)
+	}
+
+	static void makeDirectory() {
+#ifdef _WIN32
+		_mkdir(PROGRAM_CACHE_DIRECTORY);
+#else
+		mkdir(PROGRAM_CACHE_DIRECTORY, 0755);
+#endif
+	}
+};
@@ -0,0 +1,417 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+#include "../dependencies/glm/glm.hpp"
+#include "shader.h"
+#include "mesh.h"
+#include "shader_variants.h"
+#include "gl_state.h"
+#include "frustum_culling.h"
+#include "hiz_buffer.h"
+#include "lod_selector.h"
+
+enum class RenderPass : uint32_t {
+	// Drawn first, front to back so early depth testing rejects hidden fragments
+	Opaque = 0,
+	// Drawn after everything opaque, back to front
+	Transparent = 1
+};
+
+// State changes of one execute(), a change is counted whenever a draw needs different state than the draw before it
+struct RenderQueueStats {
+	uint32_t draws = 0;
+	// Triangles of all draws at the level of detail they were drawn with
+	uint64_t triangles = 0;
+	// Draws skipped because their bounds are outside of the view frustum
+	uint32_t culled = 0;
+	// Draws the Hi-Z test against the read back pyramid of an earlier frame rejected
+	uint32_t retested = 0;
+	// Rejected draws that were skipped, the others were drawn because their verdict could be stale
+	uint32_t occluded = 0;
+	uint32_t programChanges = 0;
+	uint32_t materialChanges = 0;
+	uint32_t vertexArrayChanges = 0;
+
+	uint32_t getStateChanges() {
+		return programChanges + materialChanges + vertexArrayChanges;
+	}
+};
+
+// LSD radix sort of keys, values are moved along with their keys. Sorts 8 bits per pass and skips the passes
+// in which all keys have the same digit, usually the pass and shader bytes. Stable, scratch buffers are reused.
+inline void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& scratchKeys, std::vector<uint32_t>& scratchValues) {
+	const size_t count = keys.size();
+	scratchKeys.resize(count);
+	scratchValues.resize(count);
+	// One histogram per digit, all built in a single pass over the keys
+	uint32_t histograms[8][256] = {};
+	for (uint64_t key : keys) {
+		for (int digit = 0; digit < 8; digit++) {
+			histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+	for (int digit = 0; digit < 8; digit++) {
+		uint32_t* histogram = histograms[digit];
+		if (count == 0 || histogram[(keys[0] >> (digit * 8)) & 0xFF] == count) {
+			continue;
+		}
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++) {
+			uint32_t bucketSize = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketSize;
+		}
+		for (size_t i = 0; i < count; i++) {
+			uint32_t destination = histogram[(keys[i] >> (digit * 8)) & 0xFF]++;
+			scratchKeys[destination] = keys[i];
+			scratchValues[destination] = values[i];
+		}
+		keys.swap(scratchKeys);
+		values.swap(scratchValues);
+	}
+}
+
+// Collects the draws of a frame, sorts them by state and draws them.
+// Every mesh is submitted as a 64 bit key plus its mesh and transform, from the most significant bit down:
+//   2 bits pass, 8 bits shader, 6 bits material registry, 10 bits material, 14 bits VAO, 24 bits view depth
+// so sorting the keys groups draws by program, then material, then geometry block, and orders each group by depth.
+// Shaders, registries and geometry blocks get small ids the first time they are seen in a frame, draws beyond the
+// id range still render correctly but are not grouped. The ids are handed out again every frame, so a destroyed
+// object whose address is reused never inherits them.
+// Draws whose mesh bounds are outside of the view frustum are culled before sorting.
+// With a LodSelector every mesh is drawn with the level of detail its projected error allows.
+// With a HiZBuffer the remaining draws are also tested against the depth of an earlier frame. After drawing the
+// pyramid is rebuilt and its read back started, which arrives a frame or more later. Until then the last one that
+// arrived is used. Its verdict is only trusted if it was built with the current view projection and after the frame
+// the draw was first rejected in, in which it was still drawn. Every other rejected draw is drawn anyway, like the
+// second pass of the GpuCuller, so moving the camera or a mesh never hides it. Only an occluder that moves away
+// can keep hiding a mesh for the frames the read back is behind.
+class RenderQueue {
+public:
+	// Culling is split across numCullingThreads once there are enough draws
+	RenderQueue(uint32_t numCullingThreads = 1) : culler(numCullingThreads) {
+	}
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+
+	// Starts a new frame, drops the draws of the last one
+	void begin(const glm::mat4& view, const glm::mat4& projection) {
+		this->view = view;
+		this->projection = projection;
+		frustum = Frustum::fromViewProj(projection * view);
+		bounds.clear();
+		items.clear();
+		keys.clear();
+		transforms.clear();
+		registries.clear();
+		shaders.clear();
+		blocks.clear();
+	}
+
+	// Queues every mesh the model has so far, all drawn with shader and modelMatrix.
+	// lods keeps the levels of detail of this instance of the model between frames for the hysteresis.
+	void submit(Model& model, Shader* shader, const glm::mat4& modelMatrix, RenderPass pass = RenderPass::Opaque, LodState* lods = nullptr) {
+		submit(model, shader, nullptr, modelMatrix, pass, lods);
+	}
+
+	// Like submit with a shader, every mesh is drawn with the cheapest variant that has the features it needs
+	void submit(Model& model, ShaderVariants* variants, const glm::mat4& modelMatrix, RenderPass pass = RenderPass::Opaque, LodState* lods = nullptr) {
+		submit(model, nullptr, variants, modelMatrix, pass, lods);
+	}
+	void setCulling(bool enabled) {
+		culling = enabled;
+	}
+
+	// Draws meshes at the level of detail selector picks, nullptr draws everything at full detail
+	void setLodSelector(LodSelector* selector) {
+		lodSelector = selector;
+	}
+
+	// Enables occlusion culling against hiZ, which has to be sized like the framebuffer. Every execute() rebuilds it
+	// from the depth of the bound framebuffer and reads it back without waiting for the GPU. nullptr disables it.
+	// Draws are recognized across frames by their mesh and submission order, so submit in the same order every
+	// frame or rejected draws are drawn until the next read back confirms them again.
+	void setOcclusion(HiZBuffer* hiZ) {
+		this->hiZ = hiZ;
+	}
+
+	// Draws everything submitted since begin(), in key order or in submission order when sorted is false
+	RenderQueueStats execute(bool sorted = true) {
+		RenderQueueStats stats;
+		for (MaterialRegistry* materials : registries) {
+			materials->prepare();
+		}
+		if (culling) {
+			culler.cull(frustum, bounds, visible);
+		}
+		bool occlusion = false;
+		bool currentView = false;
+		uint32_t build = 0;
+		if (hiZ) {
+			hiZ->updateReadBack();
+			occlusion = hiZ->hasReadBack();
+			currentView = hiZ->getReadBackViewProj() == projection * view;
+			// The pyramid built after drawing this frame
+			build = hiZ->getNumBuilds() + 1;
+		}
+		rejected.swap(lastRejected);
+		rejected.clear();
+		order.clear();
+		sortedKeys.clear();
+		for (uint32_t i = 0; i < items.size(); i++) {
+			if (culling && !visible[i]) {
+				stats.culled++;
+				continue;
+			}
+			if (occlusion && isOccluded(i)) {
+				stats.retested++;
+				// Keep the build of the first rejection while the draw stays rejected
+				std::pair<Mesh*, uint32_t> id(items[i].mesh, items[i].transform);
+				auto last = lastRejected.find(id);
+				uint32_t rejectedBuild = last != lastRejected.end() ? last->second : build;
+				rejected[id] = rejectedBuild;
+				if (currentView && hiZ->getReadBackBuild() >= rejectedBuild) {
+					stats.occluded++;
+					continue;
+				}
+			}
+			order.push_back(i);
+			sortedKeys.push_back(keys[i]);
+		}
+		draw(sorted, stats);
+
+		if (hiZ) {
+			hiZ->build(projection * view);
+			hiZ->requestReadBack();
+		}
+		return stats;
+	}
+
+	uint32_t getNumDraws() {
+		return (uint32_t)items.size();
+	}
+private:
+	void submit(Model& model, Shader* shader, ShaderVariants* variants, const glm::mat4& modelMatrix, RenderPass pass, LodState* lods) {
+		const std::vector<Mesh*>& meshes = model.getMeshes();
+		if (meshes.empty()) {
+			return;
+		}
+		Transform transform;
+		transform.modelView = view * modelMatrix;
+		transform.modelViewProj = projection * transform.modelView;
+		transform.invModelView = glm::transpose(glm::inverse(transform.modelView));
+		uint32_t transformIndex = (uint32_t)transforms.size();
+		transforms.push_back(transform);
+
+		uint64_t shaderKey = shader ? std::min(shaderSlot(shader), MAX_SHADERS - 1) : 0;
+		float scale = std::sqrt(std::max(std::max(glm::dot(modelMatrix[0], modelMatrix[0]), glm::dot(modelMatrix[1], modelMatrix[1])), glm::dot(modelMatrix[2], modelMatrix[2])));
+		if (lods) {
+			lods->levels.resize(meshes.size(), 0);
+		}
+		for (size_t i = 0; i < meshes.size(); i++) {
+			Mesh* mesh = meshes[i];
+			Shader* meshShader = shader;
+			if (variants) {
+				meshShader = variants->select(mesh->getShaderFeatures());
+				shaderKey = std::min(shaderSlot(meshShader), MAX_SHADERS - 1);
+			}
+			uint64_t registryKey = std::min(registrySlot(mesh->getMaterials()), MAX_REGISTRIES - 1);
+			glm::vec3 center = (mesh->getBoundsMin() + mesh->getBoundsMax()) * 0.5f;
+			glm::vec3 viewCenter = glm::vec3(transform.modelView * glm::vec4(center, 1.0f));
+			float depth = -viewCenter.z;
+			uint32_t lod = 0;
+			if (lodSelector) {
+				lod = lodSelector->select(mesh, glm::length(viewCenter) - mesh->getBoundingRadius() * scale, scale, lods ? lods->levels[i] : 0);
+				if (lods) {
+					lods->levels[i] = (uint8_t)lod;
+				}
+			}
+			uint64_t depthKey = quantizeDepth(depth);
+			if (pass == RenderPass::Transparent) {
+				depthKey = MAX_DEPTH - depthKey;
+			}
+			// Registries share the material binding point, grouping by registry first keeps their pages from being rebound
+			uint64_t materialKey = registryKey << 10 | std::min((uint64_t)mesh->getMaterialIndex(), MAX_MATERIALS - 1);
+			uint64_t blockKey = std::min(blockSlot(mesh->getBlock()), MAX_BLOCKS - 1);
+			keys.push_back((uint64_t)pass << 62 | shaderKey << 54 | materialKey << 38 | blockKey << 24 | depthKey);
+			items.push_back({ mesh, meshShader, transformIndex, lod });
+			bounds.add(modelMatrix, mesh->getBoundsMin(), mesh->getBoundsMax(), mesh->getBoundingRadius());
+		}
+	}
+
+	static const uint64_t MAX_SHADERS = 1 << 8;
+	static const uint64_t MAX_REGISTRIES = 1 << 6;
+	static const uint64_t MAX_MATERIALS = 1 << 10;
+	static const uint64_t MAX_BLOCKS = 1 << 14;
+	static const uint64_t MAX_DEPTH = (1 << 24) - 1;
+
+	struct Transform {
+		glm::mat4 modelView;
+		glm::mat4 modelViewProj;
+		glm::mat4 invModelView;
+	};
+
+	struct RenderItem {
+		Mesh* mesh;
+		Shader* shader;
+		uint32_t transform;
+		uint32_t lod;
+	};
+
+	// Uniforms of a shader, they follow its program when a reload replaces it
+	struct ShaderSlot {
+		Shader* shader;
+		MeshUniforms uniforms;
+		Uniform<glm::mat4> modelViewProj;
+		Uniform<glm::mat4> modelView;
+		Uniform<glm::mat4> invModelView;
+	};
+
+	// Tests the world space box of an item against the read back pyramid
+	bool isOccluded(uint32_t item) {
+		glm::vec3 center(bounds.centerX[item], bounds.centerY[item], bounds.centerZ[item]);
+		glm::vec3 extents(bounds.extentX[item], bounds.extentY[item], bounds.extentZ[item]);
+		return hiZ->isOccluded(center - extents, center + extents);
+	}
+
+	// Draws the items in order, sorted by their keys first when sorted is true
+	void draw(bool sorted, RenderQueueStats& stats) {
+		if (sorted) {
+			radixSort(sortedKeys, order, scratchKeys, scratchOrder);
+		}
+
+		Shader* shader = nullptr;
+		ShaderSlot* slot = nullptr;
+		uint32_t transformIndex = UINT32_MAX;
+		MaterialRegistry* materials = nullptr;
+		uint32_t materialIndex = UINT32_MAX;
+		GeometryBlock* block = nullptr;
+		glm::vec3 positionScale;
+		glm::vec3 positionOffset;
+		for (uint32_t i : order) {
+			const RenderItem& item = items[i];
+			Mesh* mesh = item.mesh;
+			if (item.shader != shader || !slot) {
+				shader = item.shader;
+				slot = &shaders[shaderSlot(shader)];
+				GLState::useProgram(shader->getShaderId());
+				// Uniforms belong to the program, everything has to be set again
+				transformIndex = UINT32_MAX;
+				materials = nullptr;
+				stats.programChanges++;
+			}
+			if (item.transform != transformIndex) {
+				transformIndex = item.transform;
+				const Transform& transform = transforms[transformIndex];
+				slot->modelViewProj.set(transform.modelViewProj);
+				slot->modelView.set(transform.modelView);
+				slot->invModelView.set(transform.invModelView);
+			}
+			if (mesh->getMaterials() != materials || mesh->getMaterialIndex() != materialIndex) {
+				materials = mesh->getMaterials();
+				materialIndex = mesh->getMaterialIndex();
+				slot->uniforms.materialIndex.set((GLint)materials->bind(materialIndex));
+				// Dequantization is set together with the material so it is also set again after program changes
+				positionScale = mesh->getPositionScale();
+				positionOffset = mesh->getPositionOffset();
+				slot->uniforms.positionScale.set(positionScale);
+				slot->uniforms.positionOffset.set(positionOffset);
+				stats.materialChanges++;
+			}
+			else if (mesh->getPositionScale() != positionScale || mesh->getPositionOffset() != positionOffset) {
+				positionScale = mesh->getPositionScale();
+				positionOffset = mesh->getPositionOffset();
+				slot->uniforms.positionScale.set(positionScale);
+				slot->uniforms.positionOffset.set(positionOffset);
+			}
+			if (mesh->getBlock() != block) {
+				block = mesh->getBlock();
+				block->bind();
+				stats.vertexArrayChanges++;
+			}
+			mesh->draw(item.lod);
+			stats.draws++;
+			stats.triangles += mesh->getLod(item.lod).numIndices / 3;
+		}
+	}
+
+	// The bits of a positive float sort like its value, the upper 24 bits keep the exponent and 15 bits of the mantissa
+	static uint64_t quantizeDepth(float depth) {
+		if (!(depth > 0.0f)) {
+			return 0;
+		}
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof(uint32_t));
+		return bits >> 8;
+	}
+
+	uint64_t shaderSlot(Shader* shader) {
+		for (size_t i = 0; i < shaders.size(); i++) {
+			if (shaders[i].shader == shader) {
+				return i;
+			}
+		}
+		ShaderSlot slot;
+		slot.shader = shader;
+		lookUp(slot);
+		shaders.push_back(slot);
+		return shaders.size() - 1;
+	}
+
+	static void lookUp(ShaderSlot& slot) {
+		slot.uniforms.lookUp(slot.shader);
+		slot.modelViewProj = Uniform<glm::mat4>(slot.shader, SHADER_NAME("u_modelViewProj"));
+		slot.modelView = Uniform<glm::mat4>(slot.shader, SHADER_NAME("u_modelView"));
+		slot.invModelView = Uniform<glm::mat4>(slot.shader, SHADER_NAME("u_invModelView"));
+	}
+
+	uint64_t registrySlot(MaterialRegistry* materials) {
+		auto it = std::find(registries.begin(), registries.end(), materials);
+		if (it != registries.end()) {
+			return it - registries.begin();
+		}
+		registries.push_back(materials);
+		return registries.size() - 1;
+	}
+
+	uint64_t blockSlot(GeometryBlock* block) {
+		auto it = std::find(blocks.begin(), blocks.end(), block);
+		if (it != blocks.end()) {
+			return it - blocks.begin();
+		}
+		blocks.push_back(block);
+		return blocks.size() - 1;
+	}
+
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 projection = glm::mat4(1.0f);
+	Frustum frustum;
+	bool culling = true;
+	FrustumCuller culler;
+	HiZBuffer* hiZ = nullptr;
+	LodSelector* lodSelector = nullptr;
+	// World space bounds of every item
+	CullingBounds bounds;
+	std::vector<uint8_t> visible;
+	// Draws the Hi-Z test rejected this and last frame by mesh and submission, with the build they were first rejected in
+	std::map<std::pair<Mesh*, uint32_t>, uint32_t> rejected;
+	std::map<std::pair<Mesh*, uint32_t>, uint32_t> lastRejected;
+	std::vector<RenderItem> items;
+	std::vector<uint64_t> keys;
+	std::vector<Transform> transforms;
+	// Objects the draws of the frame use, their index is their id
+	std::vector<MaterialRegistry*> registries;
+	std::vector<ShaderSlot> shaders;
+	std::vector<GeometryBlock*> blocks;
+	// Sort buffers, reused every frame
+	std::vector<uint64_t> sortedKeys;
+	std::vector<uint64_t> scratchKeys;
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> scratchOrder;
+};
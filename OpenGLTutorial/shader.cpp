@@ -1,44 +1,158 @@
 #include "shader.h"
+#include "material_registry.h"
+#include "gl_state.h"
+#include "program_cache.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <utility>
 
-Shader::Shader(const char* vertexShaderFilename, const char* fragmentShaderFilename) {
+static uint32_t nextShaderRevision = 1;
+
+Shader::Shader(const char* vertexShaderFilename, const char* fragmentShaderFilename, bool deferred, const std::vector<std::string>& defines) {
+	revision = nextShaderRevision++;
+	this->defines = defines;
+	filenames[0] = vertexShaderFilename;
+	filenames[1] = fragmentShaderFilename;
+	numFiles = 2;
 	shaderId = createShader(vertexShaderFilename, fragmentShaderFilename);
+	if (!deferred) {
+		wait();
+	}
+}
+
+Shader::Shader(const char* computeShaderFilename, bool deferred) {
+	revision = nextShaderRevision++;
+	filenames[0] = computeShaderFilename;
+	numFiles = 1;
+	shaderId = createComputeShader(computeShaderFilename);
+	if (!deferred) {
+		wait();
+	}
 }
 
 Shader::~Shader() {
-	glDeleteProgram(shaderId);
+	for (uint32_t i = 0; i < numStages; i++) {
+		glDeleteShader(stages[i]);
+	}
+	GLState::deleteProgram(shaderId);
 }
 
 void Shader::bind() {
-	glUseProgram(shaderId);
+	wait();
+	GLState::useProgram(shaderId);
 }
 
 void Shader::unbind() {
-	glUseProgram(0);
+	GLState::useProgram(0);
 }
 
 GLuint Shader::getShaderId() {
+	wait();
 	return shaderId;
 }
 
+bool Shader::isReady() {
+	if (ready) {
+		return true;
+	}
+	// Without parallel compile the status query is what compiles, so the program is only ready once waited for
+	if (supportsParallelCompile()) {
+		GLint completed = GL_FALSE;
+		glGetProgramiv(shaderId, GL_COMPLETION_STATUS_KHR, &completed);
+		if (completed == GL_TRUE) {
+			finish();
+		}
+	}
+	return ready;
+}
+
+void Shader::wait() {
+	if (!ready) {
+		finish();
+	}
+}
+
+bool Shader::isLinked() {
+	wait();
+	return linked;
+}
+
+uint32_t Shader::getRevision() {
+	return revision;
+}
+
+ShaderReflection& Shader::getReflection() {
+	wait();
+	return reflection;
+}
+
+GLint Shader::getUniformLocation(uint32_t nameHash) {
+	return getReflection().getUniformLocation(nameHash);
+}
+
+uint32_t Shader::getNumFiles() {
+	return numFiles;
+}
+
+const std::vector<std::string>& Shader::getDefines() {
+	return defines;
+}
+
+const std::string& Shader::getFilename(uint32_t index) {
+	return filenames[index];
+}
+
+Shader* Shader::rebuild() {
+	if (numFiles == 1) {
+		return new Shader(filenames[0].c_str(), true);
+	}
+	return new Shader(filenames[0].c_str(), filenames[1].c_str(), true, defines);
+}
+
+void Shader::swap(Shader& other) {
+	other.wait();
+	GLint currentProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+
+	std::swap(shaderId, other.shaderId);
+	std::swap(stages, other.stages);
+	std::swap(numStages, other.numStages);
+	std::swap(linked, other.linked);
+	std::swap(cacheName, other.cacheName);
+	std::swap(cacheKey, other.cacheKey);
+	std::swap(reflection, other.reflection);
+	revision = nextShaderRevision++;
+	other.revision = nextShaderRevision++;
+
+	// Draws that rely on this shader still being bound use the new program from now on
+	if ((GLuint)currentProgram == other.shaderId) {
+		GLState::useProgram(shaderId);
+	}
+}
+
+bool Shader::supportsParallelCompile() {
+	return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+bool Shader::enableParallelCompile() {
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		return true;
+	}
+	if (GLEW_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		return true;
+	}
+	return false;
+}
+
 GLuint Shader::compile(std::string shaderSource, GLenum type) {
 	GLuint id = glCreateShader(type);
 	const char* src = shaderSource.c_str();
 	glShaderSource(id, 1, &src, 0);
+	// The status is only queried in finish, so the driver can compile in the background
 	glCompileShader(id);
-
-	int result;
-	glGetShaderiv(id, GL_COMPILE_STATUS, &result);
-	if (result != GL_TRUE) {
-		int length = 0;
-		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
-		char* message = new char[length];
-		glGetShaderInfoLog(id, length, &length, message);
-		std::cout << "Shader compilation error: " << message << std::endl;
-		delete[] message;
-		return 0;
-	}
 	return id;
 }
 
@@ -64,25 +178,127 @@ std::string Shader::parse(const char* filename) {
 	return contents;
 }
 
+// The defines have to follow #version, #line keeps the line numbers of compile errors matching the file
+void Shader::injectDefines(std::string& source) {
+	if (defines.empty()) {
+		return;
+	}
+	size_t version = source.find("#version");
+	size_t position = version == std::string::npos ? 0 : source.find('\n', version);
+	position = position == std::string::npos ? source.size() : position + 1;
+	uint32_t nextLine = (uint32_t)std::count(source.begin(), source.begin() + position, '\n') + 1;
+
+	std::string injected;
+	if (position > 0 && source[position - 1] != '\n') {
+		injected += "\n";
+	}
+	for (const std::string& define : defines) {
+		injected += "#define " + define + "\n";
+	}
+	injected += "#line " + std::to_string(nextLine) + "\n";
+	source.insert(position, injected);
+}
+
 GLuint Shader::createShader(const char* vertexShaderFilename, const char* fragmentShaderFilename) {
 	std::string vertexShaderSource = parse(vertexShaderFilename);
 	std::string fragmentShaderSource = parse(fragmentShaderFilename);
+	injectDefines(vertexShaderSource);
+	injectDefines(fragmentShaderSource);
+
+	// Every set of defines is a different program and needs its own cache file
+	cacheName = std::string(vertexShaderFilename) + "+" + fragmentShaderFilename;
+	for (size_t i = 0; i < defines.size(); i++) {
+		cacheName += (i == 0 ? "@" : ",") + defines[i];
+	}
+	cacheKey = ProgramCache::computeKey({ vertexShaderSource, fragmentShaderSource });
+	GLuint program = ProgramCache::load(cacheName, cacheKey);
+	if (program) {
+		reflect(program);
+		return program;
+	}
 
-	GLuint program = glCreateProgram();
-	GLuint vs = compile(vertexShaderSource, GL_VERTEX_SHADER);
-	GLuint fs = compile(fragmentShaderSource, GL_FRAGMENT_SHADER);
+	program = glCreateProgram();
+	stages[0] = compile(vertexShaderSource, GL_VERTEX_SHADER);
+	stages[1] = compile(fragmentShaderSource, GL_FRAGMENT_SHADER);
+	numStages = 2;
 
-	glAttachShader(program, vs);
-	glAttachShader(program, fs);
+	glAttachShader(program, stages[0]);
+	glAttachShader(program, stages[1]);
+	ProgramCache::prepare(program);
 	glLinkProgram(program);
+	ready = false;
+	return program;
+}
 
-#ifndef _DEBUG
-	glDetachShader(program, vs);
-	glDetachShader(program, fs);
+GLuint Shader::createComputeShader(const char* computeShaderFilename) {
+	std::string computeShaderSource = parse(computeShaderFilename);
 
-	glDeleteShader(vs);
-	glDeleteShader(fs);
-#endif // !_DEBUG
+	cacheName = computeShaderFilename;
+	cacheKey = ProgramCache::computeKey({ computeShaderSource });
+	GLuint program = ProgramCache::load(cacheName, cacheKey);
+	if (program) {
+		reflect(program);
+		return program;
+	}
+
+	program = glCreateProgram();
+	stages[0] = compile(computeShaderSource, GL_COMPUTE_SHADER);
+	numStages = 1;
+
+	glAttachShader(program, stages[0]);
+	ProgramCache::prepare(program);
+	glLinkProgram(program);
+	ready = false;
 	return program;
 }
 
+// Queries the results of the compiles and the link, which blocks until the driver is done with them
+void Shader::finish() {
+	for (uint32_t i = 0; i < numStages; i++) {
+		int result;
+		glGetShaderiv(stages[i], GL_COMPILE_STATUS, &result);
+		if (result != GL_TRUE) {
+			int length = 0;
+			glGetShaderiv(stages[i], GL_INFO_LOG_LENGTH, &length);
+			char* message = new char[length];
+			glGetShaderInfoLog(stages[i], length, &length, message);
+			std::cout << "Shader compilation error: " << message << std::endl;
+			delete[] message;
+		}
+	}
+
+	int result;
+	glGetProgramiv(shaderId, GL_LINK_STATUS, &result);
+	if (result != GL_TRUE) {
+		int length = 0;
+		glGetProgramiv(shaderId, GL_INFO_LOG_LENGTH, &length);
+		char* message = new char[length];
+		glGetProgramInfoLog(shaderId, length, &length, message);
+		std::cout << "Shader link error " << cacheName << ": " << message << std::endl;
+		delete[] message;
+		linked = false;
+	}
+	else {
+		reflect(shaderId);
+		ProgramCache::store(cacheName, cacheKey, shaderId);
+	}
+
+#ifndef _DEBUG
+	for (uint32_t i = 0; i < numStages; i++) {
+		glDetachShader(shaderId, stages[i]);
+		glDeleteShader(stages[i]);
+	}
+	numStages = 0;
+#endif // !_DEBUG
+	ready = true;
+}
+
+// Enumerates the program once after linking, and binds the uniform blocks to their fixed binding points,
+// which a program loaded from a binary needs again as well
+void Shader::reflect(GLuint program) {
+	reflection.reflect(program);
+	const ShaderUniformBlock* materialBlock = reflection.findBlock(SHADER_NAME("Materials"));
+	if (materialBlock) {
+		glUniformBlockBinding(program, materialBlock->index, MATERIAL_BLOCK_BINDING);
+	}
+}
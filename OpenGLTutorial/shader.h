@@ -1,18 +1,68 @@
 #pragma once
 #include <GL/glew.h>
+#include "shader_reflection.h"
+#include <cstdint>
 #include <string>
+#include <vector>
 
+// A deferred shader only submits its compiles and link, so the driver can build many programs at the same time
+// when it supports GL_KHR_parallel_shader_compile. Create all of them first and poll isReady, bind and
+// getShaderId wait for the program to be finished.
+// defines are injected after the #version line of both stages, as #define with nothing after the name.
 struct Shader {
-	Shader(const char* vertexShaderFilename, const char* fragmentShaderFilename);
+	Shader(const char* vertexShaderFilename, const char* fragmentShaderFilename, bool deferred = false, const std::vector<std::string>& defines = {});
+	// Compute program, needs OpenGL 4.3
+	Shader(const char* computeShaderFilename, bool deferred = false);
 	virtual ~Shader();
 
 	void bind();
 	void unbind();
 	GLuint getShaderId();
+	// Never blocks, true once the program is linked
+	bool isReady();
+	// Blocks until the program is linked
+	void wait();
+	// Waits, false if compiling or linking failed
+	bool isLinked();
+	// Changes whenever the program is replaced, uniform locations cached under an older revision are stale.
+	// Unique across all shaders, so it also tells shaders apart.
+	uint32_t getRevision();
+	// Waits, the active uniforms, uniform blocks and attributes of the program
+	ShaderReflection& getReflection();
+	// Pass the name through SHADER_NAME, -1 if the program does not use the uniform
+	GLint getUniformLocation(uint32_t nameHash);
+
+	const std::vector<std::string>& getDefines();
+	uint32_t getNumFiles();
+	const std::string& getFilename(uint32_t index);
+	// Starts building the program again from the current files, returns a deferred shader owned by the caller
+	Shader* rebuild();
+	// Takes the program of a finished shader, which gets the old one in return
+	void swap(Shader& other);
+
+	static bool supportsParallelCompile();
+	// Lets the driver compile on as many threads as it wants, returns false without parallel compile support
+	static bool enableParallelCompile();
 private:
 	GLuint compile(std::string shaderSource, GLenum type);
 	std::string parse(const char* filename);
+	void injectDefines(std::string& source);
 	GLuint createShader(const char* vertexShaderFilename, const char* fragmentShaderFilename);
+	GLuint createComputeShader(const char* computeShaderFilename);
+	void finish();
+	void reflect(GLuint program);
 
 	GLuint shaderId;
+	// Stages that are still compiling, deleted once the program is finished
+	GLuint stages[2] = {};
+	uint32_t numStages = 0;
+	bool ready = true;
+	bool linked = true;
+	uint32_t revision;
+	std::string filenames[2];
+	uint32_t numFiles = 0;
+	std::vector<std::string> defines;
+	std::string cacheName;
+	uint64_t cacheKey = 0;
+	ShaderReflection reflection;
 };
\ No newline at end of file
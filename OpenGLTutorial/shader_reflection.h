@@ -0,0 +1,162 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 32 bit FNV-1a of a uniform, block or attribute name
+constexpr uint32_t hashShaderName(const char* name, uint32_t hash = 2166136261u) {
+	while (*name) {
+		hash = (hash ^ (uint8_t)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+// Hash of a name literal that is guaranteed to be computed by the compiler
+#define SHADER_NAME(name) (std::integral_constant<uint32_t, hashShaderName(name)>::value)
+
+// Largest uniform value a Uniform handle caches, a mat4
+#define SHADER_UNIFORM_MAX_VALUE_SIZE 64
+
+struct ShaderUniform {
+	uint32_t hash;
+	GLint location;
+	GLenum type;
+	// Number of array elements, 1 for everything else
+	GLint size;
+	std::string name;
+	// Last value written through a Uniform handle
+	bool hasValue = false;
+	alignas(16) uint8_t value[SHADER_UNIFORM_MAX_VALUE_SIZE];
+};
+
+struct ShaderUniformBlock {
+	uint32_t hash;
+	GLuint index;
+	GLint dataSize;
+	std::string name;
+};
+
+struct ShaderAttribute {
+	uint32_t hash;
+	GLint location;
+	GLenum type;
+	std::string name;
+};
+
+// Active uniforms, uniform blocks and attributes of a linked program, enumerated once after linking.
+// Every table is sorted by the hash of the names, array uniforms are found under their name without [0].
+struct ShaderReflection {
+	void reflect(GLuint program) {
+		uniforms.clear();
+		blocks.clear();
+		attributes.clear();
+		std::vector<char> name(maxNameLength(program));
+
+		GLint numUniforms = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+		for (GLint i = 0; i < numUniforms; i++) {
+			ShaderUniform uniform;
+			GLsizei length = 0;
+			glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, name.data());
+			uniform.location = glGetUniformLocation(program, name.data());
+			// Members of uniform blocks have no location, they are set through the buffer of the block
+			if (uniform.location < 0) {
+				continue;
+			}
+			uniform.name.assign(name.data(), length);
+			if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0) {
+				uniform.name.resize(uniform.name.size() - 3);
+			}
+			uniform.hash = hashShaderName(uniform.name.c_str());
+			uniforms.push_back(uniform);
+		}
+
+		GLint numBlocks = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+		for (GLint i = 0; i < numBlocks; i++) {
+			ShaderUniformBlock block;
+			GLsizei length = 0;
+			glGetActiveUniformBlockName(program, (GLuint)i, (GLsizei)name.size(), &length, name.data());
+			glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+			block.index = (GLuint)i;
+			block.name.assign(name.data(), length);
+			block.hash = hashShaderName(block.name.c_str());
+			blocks.push_back(block);
+		}
+
+		GLint numAttributes = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+		for (GLint i = 0; i < numAttributes; i++) {
+			ShaderAttribute attribute;
+			GLint size = 0;
+			GLsizei length = 0;
+			glGetActiveAttrib(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &attribute.type, name.data());
+			attribute.location = glGetAttribLocation(program, name.data());
+			attribute.name.assign(name.data(), length);
+			attribute.hash = hashShaderName(attribute.name.c_str());
+			attributes.push_back(attribute);
+		}
+
+		sortByHash(uniforms);
+		sortByHash(blocks);
+		sortByHash(attributes);
+	}
+
+	// Returns nullptr for names the program does not use
+	ShaderUniform* findUniform(uint32_t hash) {
+		return findByHash(uniforms, hash);
+	}
+
+	const ShaderUniformBlock* findBlock(uint32_t hash) const {
+		return findByHash(blocks, hash);
+	}
+
+	const ShaderAttribute* findAttribute(uint32_t hash) const {
+		return findByHash(attributes, hash);
+	}
+
+	GLint getUniformLocation(uint32_t hash) {
+		ShaderUniform* uniform = findUniform(hash);
+		return uniform ? uniform->location : -1;
+	}
+
+	std::vector<ShaderUniform> uniforms;
+	std::vector<ShaderUniformBlock> blocks;
+	std::vector<ShaderAttribute> attributes;
+private:
+	static size_t maxNameLength(GLuint program) {
+		GLint uniformLength = 0;
+		GLint blockLength = 0;
+		GLint attributeLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformLength);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &blockLength);
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &attributeLength);
+		return (size_t)std::max({ uniformLength, blockLength, attributeLength, 1 });
+	}
+
+	template<typename T>
+	static void sortByHash(std::vector<T>& table) {
+		std::sort(table.begin(), table.end(), [](const T& a, const T& b) { return a.hash < b.hash; });
+		for (size_t i = 1; i < table.size(); i++) {
+			if (table[i].hash == table[i - 1].hash) {
+				std::cout << "Error shader names " << table[i - 1].name << " and " << table[i].name << " have the same hash" << std::endl;
+			}
+		}
+	}
+
+	template<typename T>
+	static T* findByHash(std::vector<T>& table, uint32_t hash) {
+		auto it = std::lower_bound(table.begin(), table.end(), hash, [](const T& entry, uint32_t hash) { return entry.hash < hash; });
+		return it != table.end() && it->hash == hash ? &*it : nullptr;
+	}
+
+	template<typename T>
+	static const T* findByHash(const std::vector<T>& table, uint32_t hash) {
+		auto it = std::lower_bound(table.begin(), table.end(), hash, [](const T& entry, uint32_t hash) { return entry.hash < hash; });
+		return it != table.end() && it->hash == hash ? &*it : nullptr;
+	}
+};
@@ -0,0 +1,180 @@
+#pragma once
+#include "shader.h"
+#include "shader_watcher.h"
+#include "material_registry.h"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Optional parts of basic.vert/frag, a variant is the set of features it was compiled with
+enum ShaderFeature : uint32_t {
+	// Reads the model matrix from an instance attribute, see InstanceBuffer
+	SHADER_FEATURE_INSTANCED = 1 << 0,
+	// Dequantizes positions with u_positionScale and u_positionOffset. Quantized normals need no feature, the
+	// vertex fetch already decodes their GL_INT_2_10_10_10_REV attribute
+	SHADER_FEATURE_QUANTIZED_POSITIONS = 1 << 1,
+	SHADER_FEATURE_SPECULAR = 1 << 2,
+	SHADER_FEATURE_EMISSIVE = 1 << 3,
+};
+#define SHADER_FEATURE_COUNT 4
+#define SHADER_VARIANT_COUNT (1 << SHADER_FEATURE_COUNT)
+// Features that change the inputs of the shader, a variant has to match them exactly instead of covering them
+#define SHADER_FEATURES_EXACT SHADER_FEATURE_INSTANCED
+
+// Name of the define and in manifests, indexed by the bit of the feature
+inline const char* shaderFeatureName(uint32_t bit) {
+	static const char* names[SHADER_FEATURE_COUNT] = { "INSTANCED", "QUANTIZED_POSITIONS", "SPECULAR", "EMISSIVE" };
+	return names[bit];
+}
+
+// SHADER_VARIANT tells the shader that only the listed features are wanted
+inline std::vector<std::string> shaderFeatureDefines(uint32_t features) {
+	std::vector<std::string> defines = { "SHADER_VARIANT" };
+	for (uint32_t bit = 0; bit < SHADER_FEATURE_COUNT; bit++) {
+		if (features & (1u << bit)) {
+			defines.push_back(shaderFeatureName(bit));
+		}
+	}
+	return defines;
+}
+
+// Features a material needs, black specular or emissive colors need no code
+inline uint32_t materialShaderFeatures(const Material& material) {
+	uint32_t features = 0;
+	if (material.specular != glm::vec3(0.0f)) {
+		features |= SHADER_FEATURE_SPECULAR;
+	}
+	if (material.emissive != glm::vec3(0.0f)) {
+		features |= SHADER_FEATURE_EMISSIVE;
+	}
+	return features;
+}
+
+inline uint32_t countShaderFeatures(uint32_t features) {
+	uint32_t count = 0;
+	for (; features; features &= features - 1) {
+		count++;
+	}
+	return count;
+}
+
+// Permutations of one vertex and fragment shader pair, identified by their feature bits.
+// Variants are compiled the first time they are asked for, or up front from a manifest. Each variant is its own
+// Shader, so the program cache stores them separately and uniform handles work per variant.
+class ShaderVariants {
+public:
+	ShaderVariants(const char* vertexShaderFilename, const char* fragmentShaderFilename)
+		: vertexShaderFilename(vertexShaderFilename), fragmentShaderFilename(fragmentShaderFilename) {
+		for (Shader*& variant : variants) {
+			variant = nullptr;
+		}
+	}
+	~ShaderVariants() {
+		for (Shader* variant : variants) {
+			delete variant;
+		}
+	}
+	ShaderVariants(const ShaderVariants&) = delete;
+	ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+	// The variant with exactly these features, compiled on first use
+	Shader* get(uint32_t features) {
+		Shader*& variant = variants[features & (SHADER_VARIANT_COUNT - 1)];
+		if (variant == nullptr) {
+			variant = build(features, false);
+		}
+		return variant;
+	}
+
+	// The built variant with the fewest features that covers the required ones, so a simple material never runs the
+	// code of features it does not use and nothing has to be compiled while drawing when the manifest was complete.
+	// Only when no built variant covers them the exact one is compiled.
+	Shader* select(uint32_t required) {
+		Shader* best = nullptr;
+		uint32_t bestCount = UINT32_MAX;
+		for (uint32_t features = 0; features < SHADER_VARIANT_COUNT; features++) {
+			if (variants[features] == nullptr || (features & required) != required
+				|| (features & SHADER_FEATURES_EXACT) != (required & SHADER_FEATURES_EXACT)) {
+				continue;
+			}
+			uint32_t count = countShaderFeatures(features);
+			if (count < bestCount) {
+				best = variants[features];
+				bestCount = count;
+			}
+		}
+		return best ? best : get(required);
+	}
+
+	// Submits the compiles of a variant without waiting for them
+	void precompile(uint32_t features) {
+		Shader*& variant = variants[features & (SHADER_VARIANT_COUNT - 1)];
+		if (variant == nullptr) {
+			variant = build(features, true);
+		}
+	}
+
+	// Precompiles every variant of a manifest, one per line as feature names separated by spaces.
+	// none stands for the variant without features, lines starting with # are comments.
+	bool precompile(const char* manifestFilename) {
+		std::ifstream manifest(manifestFilename);
+		if (!manifest) {
+			std::cout << "Error opening shader manifest " << manifestFilename << std::endl;
+			return false;
+		}
+		std::string line;
+		while (std::getline(manifest, line)) {
+			std::istringstream words(line);
+			std::string word;
+			uint32_t features = 0;
+			bool empty = true;
+			bool valid = true;
+			while (words >> word && word[0] != '#') {
+				empty = false;
+				if (word == "none") {
+					continue;
+				}
+				uint32_t bit = 0;
+				while (bit < SHADER_FEATURE_COUNT && word != shaderFeatureName(bit)) {
+					bit++;
+				}
+				if (bit == SHADER_FEATURE_COUNT) {
+					std::cout << "Error unknown shader feature " << word << " in " << manifestFilename << std::endl;
+					valid = false;
+					break;
+				}
+				features |= 1u << bit;
+			}
+			if (!empty && valid) {
+				precompile(features);
+			}
+		}
+		return true;
+	}
+
+	// Reloads every variant, the ones built later too, when the shader files change
+	void setWatcher(ShaderWatcher* watcher) {
+		this->watcher = watcher;
+		for (Shader* variant : variants) {
+			if (variant && watcher) {
+				watcher->watch(variant);
+			}
+		}
+	}
+private:
+	Shader* build(uint32_t features, bool deferred) {
+		Shader* variant = new Shader(vertexShaderFilename.c_str(), fragmentShaderFilename.c_str(), deferred, shaderFeatureDefines(features));
+		if (watcher) {
+			watcher->watch(variant);
+		}
+		return variant;
+	}
+
+	std::string vertexShaderFilename;
+	std::string fragmentShaderFilename;
+	Shader* variants[SHADER_VARIANT_COUNT];
+	ShaderWatcher* watcher = nullptr;
+};
@@ -0,0 +1,202 @@
+#pragma once
+#include "shader.h"
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Rebuilds shaders whose source files changed while the application runs. A rebuild is compiled as a deferred
+// shader next to the live one and swapped in once it linked, so a shader that fails to compile keeps drawing
+// with its old program and the errors are printed. Uses inotify on Linux and compares modification times
+// everywhere else. Only used on the thread that owns the OpenGL context.
+class ShaderWatcher {
+public:
+	ShaderWatcher() {
+#ifdef __linux__
+		inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotifyFd < 0) {
+			std::cout << "Error initializing inotify, shaders are not reloaded" << std::endl;
+		}
+#endif
+	}
+
+	~ShaderWatcher() {
+		for (WatchedShader& watched : shaders) {
+			delete watched.pending;
+		}
+#ifdef __linux__
+		if (inotifyFd >= 0) {
+			close(inotifyFd);
+		}
+#endif
+	}
+
+	void watch(Shader* shader) {
+		WatchedShader watched;
+		watched.shader = shader;
+		for (uint32_t i = 0; i < shader->getNumFiles(); i++) {
+			const std::string& filename = shader->getFilename(i);
+			watched.files.push_back(filename);
+			watched.modified.push_back(modificationTime(filename));
+#ifdef __linux__
+			watchDirectory(filename);
+#endif
+		}
+		shaders.push_back(watched);
+	}
+
+	// Call once per frame. Returns true if a program was swapped, Uniform handles follow it by themselves but
+	// locations queried with getUniformLocation have to be queried again.
+	bool update() {
+		collectChanges();
+
+		bool swapped = false;
+		for (WatchedShader& watched : shaders) {
+			if (watched.changed) {
+				// A newer change replaces a rebuild that is still compiling
+				delete watched.pending;
+				watched.pending = watched.shader->rebuild();
+				watched.changed = false;
+			}
+			if (watched.pending == nullptr) {
+				continue;
+			}
+			// Without parallel compile there is no background work to wait for
+			if (Shader::supportsParallelCompile() && !watched.pending->isReady()) {
+				continue;
+			}
+			if (watched.pending->isLinked()) {
+				watched.shader->swap(*watched.pending);
+				std::cout << "Reloaded " << describe(watched) << std::endl;
+				swapped = true;
+			}
+			else {
+				std::cout << "Error reloading " << describe(watched) << ", keeping the old program" << std::endl;
+			}
+			delete watched.pending;
+			watched.pending = nullptr;
+		}
+		return swapped;
+	}
+private:
+	struct WatchedShader {
+		Shader* shader = nullptr;
+		// Rebuild that is still compiling
+		Shader* pending = nullptr;
+		std::vector<std::string> files;
+		std::vector<time_t> modified;
+		bool changed = false;
+	};
+
+	static time_t modificationTime(const std::string& filename) {
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0) {
+			return 0;
+		}
+		return info.st_mtime;
+	}
+
+	static std::string describe(const WatchedShader& watched) {
+		std::string name = watched.files[0];
+		for (size_t i = 1; i < watched.files.size(); i++) {
+			name += "+" + watched.files[i];
+		}
+		return name;
+	}
+
+	void collectChanges() {
+#ifdef __linux__
+		if (inotifyFd >= 0) {
+			readEvents();
+			return;
+		}
+#endif
+		for (WatchedShader& watched : shaders) {
+			for (size_t i = 0; i < watched.files.size(); i++) {
+				time_t modified = modificationTime(watched.files[i]);
+				if (modified != watched.modified[i]) {
+					watched.modified[i] = modified;
+					watched.changed = true;
+				}
+			}
+		}
+	}
+
+#ifdef __linux__
+	struct WatchedDirectory {
+		int descriptor;
+		std::string path;
+	};
+
+	static void splitPath(const std::string& filename, std::string& directory, std::string& name) {
+		size_t slash = filename.find_last_of('/');
+		directory = slash == std::string::npos ? "." : filename.substr(0, slash);
+		name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+	}
+
+	// Editors often save by writing a new file and renaming it, so the directory is watched instead of the file
+	void watchDirectory(const std::string& filename) {
+		if (inotifyFd < 0) {
+			return;
+		}
+		std::string directory, name;
+		splitPath(filename, directory, name);
+		for (const WatchedDirectory& watched : directories) {
+			if (watched.path == directory) {
+				return;
+			}
+		}
+		int descriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (descriptor < 0) {
+			std::cout << "Error watching " << directory << std::endl;
+			return;
+		}
+		directories.push_back({ descriptor, directory });
+	}
+
+	void readEvents() {
+		alignas(inotify_event) char buffer[4096];
+		while (true) {
+			ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+			if (length <= 0) {
+				return;
+			}
+			for (ssize_t offset = 0; offset < length;) {
+				const inotify_event* event = (const inotify_event*)(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+				if (event->len > 0) {
+					fileChanged(event->wd, event->name);
+				}
+			}
+		}
+	}
+
+	void fileChanged(int descriptor, const char* changedName) {
+		for (const WatchedDirectory& directory : directories) {
+			if (directory.descriptor != descriptor) {
+				continue;
+			}
+			for (WatchedShader& watched : shaders) {
+				for (const std::string& filename : watched.files) {
+					std::string fileDirectory, name;
+					splitPath(filename, fileDirectory, name);
+					if (fileDirectory == directory.path && name == changedName) {
+						watched.changed = true;
+					}
+				}
+			}
+		}
+	}
+
+	int inotifyFd = -1;
+	std::vector<WatchedDirectory> directories;
+#endif
+
+	std::vector<WatchedShader> shaders;
+};
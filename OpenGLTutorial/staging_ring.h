@@ -0,0 +1,172 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include "gl_state.h"
+
+struct StagingStats {
+	uint64_t bytesUploaded = 0;
+	// Waits on a fence the GPU had not reached yet
+	uint32_t stalls = 0;
+	// Allocations that had to wait for the GPU to release ring space
+	uint32_t wrapWaits = 0;
+};
+
+// A region of the ring, data stays writable and buffer/offset stay valid until the end of the frame
+struct StagingAllocation {
+	void* data = nullptr;
+	GLuint buffer = 0;
+	GLintptr offset = 0;
+};
+
+// Upload ring in one persistently and coherently mapped buffer.
+// Writes go straight into the mapping and are copied to their destination with glCopyBufferSubData, or are
+// used directly as per frame dynamic data. Every frame ends with a fence, space is only reused after the GPU
+// passed the fence of the frame that wrote it, so there are no implicit driver synchronisations.
+// Needs GL_ARB_buffer_storage, without it upload() falls back to glBufferSubData and allocate() is unavailable.
+class StagingRing {
+public:
+	StagingRing(uint64_t capacity = 32 * 1024 * 1024) {
+		this->capacity = capacity;
+		if (!GLEW_ARB_buffer_storage) {
+			std::cout << "GL_ARB_buffer_storage is not supported, uploading without staging ring" << std::endl;
+			return;
+		}
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &bufferId);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, bufferId);
+		glBufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+		mapping = (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+		if (!mapping) {
+			std::cout << "Error mapping staging ring" << std::endl;
+			GLState::deleteBuffers(1, &bufferId);
+			bufferId = 0;
+		}
+	}
+	virtual ~StagingRing() {
+		for (Fence& fence : fences) {
+			glDeleteSync(fence.sync);
+		}
+		if (bufferId) {
+			GLState::bindBuffer(GL_COPY_READ_BUFFER, bufferId);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+			GLState::deleteBuffers(1, &bufferId);
+		}
+	}
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	bool isSupported() {
+		return mapping != nullptr;
+	}
+
+	// Reserves size bytes of per frame data, size must not exceed the capacity
+	StagingAllocation allocate(uint64_t size, uint64_t alignment = 16) {
+		StagingAllocation allocation;
+		if (!isSupported() || size > capacity) {
+			return allocation;
+		}
+		uint64_t start = (head + alignment - 1) / alignment * alignment;
+		if (start % capacity + size > capacity) {
+			// Does not fit in front of the end of the buffer, continue at its beginning
+			start = (start / capacity + 1) * capacity;
+		}
+		bool waited = false;
+		while (start + size - tail > capacity) {
+			if (tail == head) {
+				// The GPU is done with everything, including the space skipped at the end of the buffer
+				tail = start;
+				break;
+			}
+			waitOldest();
+			waited = true;
+		}
+		if (waited) {
+			frameStats.wrapWaits++;
+		}
+		head = start + size;
+		allocation.data = mapping + start % capacity;
+		allocation.buffer = bufferId;
+		allocation.offset = (GLintptr)(start % capacity);
+		return allocation;
+	}
+
+	// Copies size bytes from data into destinationBuffer at destinationOffset through the ring
+	void upload(GLuint destinationBuffer, uint64_t destinationOffset, const void* data, uint64_t size) {
+		frameStats.bytesUploaded += size;
+		if (!isSupported()) {
+			GLState::bindBuffer(GL_COPY_WRITE_BUFFER, destinationBuffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, destinationOffset, size, data);
+			GLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			return;
+		}
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, bufferId);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, destinationBuffer);
+		// Uploads larger than a quarter of the ring go in pieces so the ring does not have to drain completely
+		const uint64_t chunkSize = capacity / 4;
+		const uint8_t* source = (const uint8_t*)data;
+		for (uint64_t copied = 0; copied < size; copied += chunkSize) {
+			uint64_t count = std::min(chunkSize, size - copied);
+			StagingAllocation allocation = allocate(count);
+			memcpy(allocation.data, source + copied, count);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.offset, destinationOffset + copied, count);
+		}
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, 0);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// Fences the work of this frame and returns its statistics
+	StagingStats endFrame() {
+		if (isSupported() && (fences.empty() || fences.back().end != head)) {
+			fences.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head });
+		}
+		// Release whatever the GPU has already finished without waiting
+		while (!fences.empty() && glClientWaitSync(fences.front().sync, 0, 0) != GL_TIMEOUT_EXPIRED) {
+			releaseOldest();
+		}
+		StagingStats stats = frameStats;
+		frameStats = StagingStats();
+		return stats;
+	}
+private:
+	struct Fence {
+		GLsync sync;
+		// Ring position up to which the fence covers the allocations
+		uint64_t end;
+	};
+
+	void waitOldest() {
+		if (fences.empty() || fences.back().end != head) {
+			// The current frame filled the ring by itself, fence what has been issued so far
+			fences.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head });
+		}
+		GLenum result = glClientWaitSync(fences.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (result == GL_TIMEOUT_EXPIRED) {
+			frameStats.stalls++;
+			while (result == GL_TIMEOUT_EXPIRED) {
+				result = glClientWaitSync(fences.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			}
+		}
+		releaseOldest();
+	}
+
+	void releaseOldest() {
+		glDeleteSync(fences.front().sync);
+		tail = fences.front().end;
+		fences.pop_front();
+	}
+
+	GLuint bufferId = 0;
+	uint8_t* mapping = nullptr;
+	uint64_t capacity;
+	// Monotonic positions, the ring offset is position % capacity
+	uint64_t head = 0;
+	uint64_t tail = 0;
+	std::deque<Fence> fences;
+	StagingStats frameStats;
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include "shader.h"
+#include "gl_state.h"
+#include "../dependencies/glm/glm.hpp"
+#include <cstring>
+#include <iostream>
+
+// How a value type is written, and which GLSL types it may be written to
+template<typename T>
+struct UniformTraits;
+
+template<>
+struct UniformTraits<GLint> {
+	static bool accepts(GLenum type) {
+		return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY || type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE;
+	}
+	static void apply(GLint location, const GLint& value) {
+		glUniform1i(location, value);
+	}
+};
+
+template<>
+struct UniformTraits<GLuint> {
+	static bool accepts(GLenum type) {
+		return type == GL_UNSIGNED_INT || type == GL_BOOL;
+	}
+	static void apply(GLint location, const GLuint& value) {
+		glUniform1ui(location, value);
+	}
+};
+
+template<>
+struct UniformTraits<float> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT;
+	}
+	static void apply(GLint location, const float& value) {
+		glUniform1f(location, value);
+	}
+};
+
+template<>
+struct UniformTraits<glm::vec2> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_VEC2;
+	}
+	static void apply(GLint location, const glm::vec2& value) {
+		glUniform2fv(location, 1, &value[0]);
+	}
+};
+
+template<>
+struct UniformTraits<glm::vec3> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_VEC3;
+	}
+	static void apply(GLint location, const glm::vec3& value) {
+		glUniform3fv(location, 1, &value[0]);
+	}
+};
+
+template<>
+struct UniformTraits<glm::vec4> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_VEC4;
+	}
+	static void apply(GLint location, const glm::vec4& value) {
+		glUniform4fv(location, 1, &value[0]);
+	}
+};
+
+template<>
+struct UniformTraits<glm::ivec2> {
+	static bool accepts(GLenum type) {
+		return type == GL_INT_VEC2;
+	}
+	static void apply(GLint location, const glm::ivec2& value) {
+		glUniform2iv(location, 1, &value[0]);
+	}
+};
+
+template<>
+struct UniformTraits<glm::mat3> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_MAT3;
+	}
+	static void apply(GLint location, const glm::mat3& value) {
+		glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+};
+
+template<>
+struct UniformTraits<glm::mat4> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_MAT4;
+	}
+	static void apply(GLint location, const glm::mat4& value) {
+		glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+};
+
+class UniformCounters {
+public:
+	// Returns the glUniform calls of the frame that were issued and skipped because the value was already set
+	static GLStateCounters endFrame() {
+		GLStateCounters frame = counters();
+		counters() = GLStateCounters();
+		return frame;
+	}
+protected:
+	static GLStateCounters& counters() {
+		static GLStateCounters counters;
+		return counters;
+	}
+};
+
+// Typed handle of a uniform in the reflection table of a shader. Keeps the last value written to the uniform in
+// the table, so writing the same value again never reaches the driver. That only holds when the uniform is always
+// written through handles, never with glUniform directly. Like glUniform, set needs the program to be bound.
+// Follows the program of the shader when a reload swaps it.
+template<typename T>
+class Uniform : public UniformCounters {
+	static_assert(sizeof(T) <= SHADER_UNIFORM_MAX_VALUE_SIZE, "Uniform value is too large to be cached");
+public:
+	Uniform() {}
+
+	// Pass the name through SHADER_NAME, so it is hashed at compile time
+	Uniform(Shader* shader, uint32_t nameHash) : shader(shader), nameHash(nameHash) {}
+
+	void set(const T& value) {
+		if (shader == nullptr) {
+			return;
+		}
+		if (revision != shader->getRevision()) {
+			resolve();
+		}
+		if (uniform == nullptr) {
+			return;
+		}
+		if (uniform->hasValue && memcmp(uniform->value, &value, sizeof(T)) == 0) {
+			counters().skipped++;
+			return;
+		}
+		memcpy(uniform->value, &value, sizeof(T));
+		uniform->hasValue = true;
+		UniformTraits<T>::apply(uniform->location, value);
+		counters().issued++;
+	}
+
+	// False if the program does not use the uniform
+	bool isActive() {
+		if (shader && revision != shader->getRevision()) {
+			resolve();
+		}
+		return uniform != nullptr;
+	}
+
+	Shader* getShader() {
+		return shader;
+	}
+private:
+	void resolve() {
+		revision = shader->getRevision();
+		uniform = shader->getReflection().findUniform(nameHash);
+		if (uniform && !UniformTraits<T>::accepts(uniform->type)) {
+			std::cout << "Error uniform " << uniform->name << " has a different type than its handle" << std::endl;
+			uniform = nullptr;
+		}
+	}
+
+	Shader* shader = nullptr;
+	uint32_t nameHash = 0;
+	// Revision of the shader the uniform was resolved for
+	uint32_t revision = 0;
+	ShaderUniform* uniform = nullptr;
+};
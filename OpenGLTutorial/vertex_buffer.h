@@ -1,36 +1,61 @@
 #pragma once
 #include <GL/glew.h>
 #include <cstdint>
+#include "../dependencies/glm/glm.hpp"
+#include "bmf.h"
+#include "gl_state.h"
+#include "staging_ring.h"
 
 struct Vertex {
 	glm::vec3 positon;
 	glm::vec3 normal;
 };
 
+// Sets up the attributes of the bound VAO for the vertex buffer bound to GL_ARRAY_BUFFER
+inline void setVertexAttributes(uint32_t vertexFormat) {
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	if (vertexFormat == BMF_VERTEX_FORMAT_QUANTIZED) {
+		// Positions arrive in [0, 1] and are scaled to the mesh bounds in the vertex shader
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(BmfQuantizedVertex), (void*)offsetof(struct BmfQuantizedVertex, position));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(BmfQuantizedVertex), (void*)offsetof(struct BmfQuantizedVertex, normal));
+	}
+	else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(struct Vertex, positon));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(struct Vertex, normal));
+	}
+}
+
 struct VertexBuffer {
-	VertexBuffer(void* data, uint32_t numVertices) {
+	// With a staging ring the buffer gets immutable storage and is filled through the ring
+	VertexBuffer(const void* data, uint32_t numVertices, uint32_t vertexFormat = BMF_VERTEX_FORMAT_FLOAT, StagingRing* staging = nullptr) {
 		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
+		GLState::bindVertexArray(vao);
 
 		glGenBuffers(1, &bufferId);
-		glBindBuffer(GL_ARRAY_BUFFER, bufferId);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), data, GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, bufferId);
+		uint64_t size = (uint64_t)numVertices * bmfVertexStride(vertexFormat);
+		if (staging && staging->isSupported()) {
+			glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, 0);
+			staging->upload(bufferId, 0, data, size);
+		}
+		else {
+			glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+		}
 
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(struct Vertex, positon));
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(struct Vertex, normal));
+		setVertexAttributes(vertexFormat);
 
-		glBindVertexArray(0);
+		GLState::bindVertexArray(0);
 	}
 	virtual ~VertexBuffer() {
-		glDeleteBuffers(1, &bufferId);
+		GLState::deleteBuffers(1, &bufferId);
+		GLState::deleteVertexArrays(1, &vao);
 	}
 	void bind() {
-		glBindVertexArray(vao);
+		GLState::bindVertexArray(vao);
 	}
 	void unbind() {
-		glBindVertexArray(0);
+		GLState::bindVertexArray(0);
 	}
 private:
 	GLuint bufferId;